@@ -70,6 +70,16 @@ int main()
     }
   }
 
+  // visibility checks write into a list of objects, which must be able to hold all objects of a model
+  uint32_t maxObjectCount = 0;
+  for(int m=0; m<MODEL_COUNT; ++m) {
+    uint32_t objCount = 0;
+    T3DModelIter it = t3d_model_iter_create(models[m], T3D_CHUNK_TYPE_OBJECT);
+    while(t3d_model_iter_next(&it))++objCount;
+    if(objCount > maxObjectCount)maxObjectCount = objCount;
+  }
+  T3DObject **visibleList = malloc(sizeof(T3DObject*) * maxObjectCount);
+
   uint64_t ticks = 0;
   for(uint32_t frame=1; ; ++frame)
   {
@@ -145,6 +155,7 @@ int main()
     // note that this data is always available in all models, even without a BVH
     bool modelIsVisible = t3d_frustum_vs_aabb_s16(&frustum, model->aabbMin, model->aabbMax);
 
+    uint32_t visibleCount = 0;
     uint64_t ticksStart = get_ticks();
     if(modelIsVisible) {
       // If visible, perform more detailed checks with the BVH (if present in the file)
@@ -153,13 +164,28 @@ int main()
       // since at lower object counts the BVH might not be as efficient as a simple linear check
 
       const T3DBvh *bvh = t3d_model_bvh_get(model); // BVHs are optional, use '--bvh' in the gltf importer (see Makefile)
+      // Models can also contain a precomputed potentially-visible-set (use '--pvs' in the gltf importer)
+      // this is a grid of cells, each knowing which objects could be seen from it (e.g. ignoring objects behind walls)
+      // like the frustum, the position to check must be in model space
+      const uint32_t *pvsRow = NULL;
+      const T3DPvs *pvs = t3d_model_pvs_get(model);
+      if(pvs) {
+        T3DVec3 camPosModel;
+        t3d_vec3_scale(&camPosModel, &camPos, 1.0f / modelScale);
+        pvsRow = t3d_model_pvs_query(pvs, &camPosModel);
+      }
+
       if(bvh) {
-        t3d_model_bvh_query_frustum(bvh, &frustum);
+        // this returns a compact list of visible objects, in the same order as in the model
+        visibleCount = t3d_model_bvh_query_frustum_pvs(bvh, &frustum, pvsRow, visibleList, maxObjectCount);
       } else {
         // without BVH, you can still iterate over all objects and perform a manual frustum checks
         T3DModelIter it = t3d_model_iter_create(model, T3D_CHUNK_TYPE_OBJECT);
         while(t3d_model_iter_next(&it)) {
-          it.object->isVisible = t3d_frustum_vs_aabb_s16(&frustum, it.object->aabbMin, it.object->aabbMax);
+          if(!t3d_model_pvs_is_visible(pvsRow, it.object))continue;
+          if(t3d_frustum_vs_aabb_s16(&frustum, it.object->aabbMin, it.object->aabbMax)) {
+            visibleList[visibleCount++] = it.object;
+          }
         }
       }
     }
@@ -203,26 +229,23 @@ int main()
     // Now draw all objects that we determined to be visible
     // we still want to optimize materials, so we create a state here and draw them directly
     // the objects (so vertex loads + triangle draws) are recorded since they don't depend on visibility
-    int totalObjects = 0;
-    if(modelIsVisible)
-    {
-      T3DModelState state = t3d_model_state_create();
-      T3DModelIter it = t3d_model_iter_create(model, T3D_CHUNK_TYPE_OBJECT);
-      while(t3d_model_iter_next(&it)) {
-        if(it.object->isVisible) {
-          // draw material and object
-          t3d_model_draw_material(it.object->material, &state);
-          rspq_block_run(it.object->userBlock);
-          it.object->isVisible = false; // BVH only sets visible objects, so we need to reset this
-
-          // collect some metrics
-          ++visibleObjects;
-          triCount += it.object->triCount;
-        }
-        ++totalObjects;
-      }
+    // (without recorded objects, you can also use 't3d_model_draw_objects' with the list instead)
+    T3DModelState state = t3d_model_state_create();
+    for(uint32_t i=0; i<visibleCount; ++i) {
+      // draw material and object
+      T3DObject *obj = visibleList[i];
+      t3d_model_draw_material(obj->material, &state);
+      rspq_block_run(obj->userBlock);
+
+      // collect some metrics
+      ++visibleObjects;
+      triCount += obj->triCount;
     }
 
+    int totalObjects = 0;
+    T3DModelIter it = t3d_model_iter_create(model, T3D_CHUNK_TYPE_OBJECT);
+    while(t3d_model_iter_next(&it))++totalObjects;
+
     t3d_matrix_pop(1);
 
     // ----------- DRAW (2D) ------------ //
@@ -31,6 +31,11 @@ uint32_t T3D_RSP_ID = 0;
 static T3DViewport *currentViewport = NULL;
 static T3DMat4FP *matrixStack = NULL;
 
+// last values set by the user, restored once lighting is enabled again
+static uint8_t lightAmbient[4] = {0, 0, 0, 0};
+static int lightCount = 0;
+static bool lightEnabled = true;
+
 void t3d_init(T3DInitParams params)
 {
   if(params.matrixStackSize <= 0)params.matrixStackSize = 8;
@@ -57,6 +62,10 @@ void t3d_init(T3DInitParams params)
   *clipSizePtr = RSP_T3D_CODE_CLIP_OVERLAY_CODE_END - RSP_T3D_CODE_CLIP_clipTriangle + 7;
 
   T3D_RSP_ID = rspq_overlay_register(&rsp_tiny3d);
+
+  memset(lightAmbient, 0, sizeof(lightAmbient));
+  lightCount = 0;
+  lightEnabled = true;
 }
 
 void t3d_destroy(void)
@@ -154,13 +163,11 @@ void t3d_frame_start(void) {
   rdpq_mode_end();
 }
 
-void t3d_light_set_count(int count)
-{
+static void write_light_count(int count) {
   t3d_dmem_set_u16((RSP_T3D_ACTIVE_LIGHT_SIZE & 0xFFF), (count * 16) << 8);
 }
 
-void t3d_light_set_ambient(const uint8_t *color)
-{
+static void write_light_ambient(const uint8_t *color) {
   rspq_write(T3D_RSP_ID, T3D_CMD_LIGHT_SET,
     (RSP_T3D_COLOR_AMBIENT & 0xFFFF), // address
     (color[0] << 24) | (color[1] << 16) | (color[2] << 8) | color[3],
@@ -168,6 +175,29 @@ void t3d_light_set_ambient(const uint8_t *color)
   );
 }
 
+void t3d_light_set_count(int count)
+{
+  lightCount = count;
+  if(lightEnabled)write_light_count(count);
+}
+
+void t3d_light_set_ambient(const uint8_t *color)
+{
+  memcpy(lightAmbient, color, sizeof(lightAmbient));
+  if(lightEnabled)write_light_ambient(color);
+}
+
+void t3d_light_set_enabled(bool enabled)
+{
+  if(enabled == lightEnabled)return;
+  lightEnabled = enabled;
+
+  // without lights and a white ambient color, vertex colors are used as is
+  const uint8_t white[4] = {0xFF, 0xFF, 0xFF, 0xFF};
+  write_light_count(enabled ? lightCount : 0);
+  write_light_ambient(enabled ? lightAmbient : white);
+}
+
 void t3d_light_set_directional(int index, const uint8_t *color, const T3DVec3 *dir)
 {
   T3DVec3 lightDirView;
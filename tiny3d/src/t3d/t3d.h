@@ -389,6 +389,16 @@ void t3d_light_set_point(int index, const uint8_t *color, const T3DVec3 *pos, fl
  */
 void t3d_light_set_count(int count);
 
+/**
+ * Enables or disables lighting, use this to draw materials with lighting baked into the vertex colors.
+ * While disabled, no lights are active and the ambient color is white, so vertex colors are used as is.
+ * Changes to the ambient color and light count are still stored, and applied once enabled again.
+ * Model draw functions call this on their own for materials with baked lighting, see 't3d_model_state_set_lighting'.
+ * Note: call this outside of recorded blocks, otherwise the values at the time of recording are restored.
+ * @param enabled
+ */
+void t3d_light_set_enabled(bool enabled);
+
 /**
  * Sets the range of the fog.
  * To disable fog, use 't3d_fog_disable' or set 'near' and 'far' to 0.
@@ -5,32 +5,111 @@
 
 #include "t3d/t3danim.h"
 #include <malloc.h>
+#include <string.h>
 
 #define SQRT_2_INV 0.70710678118f
 #define KF_TIME_TICK (1.0f / 60.0f)
+#define MAX_STREAM_FILES 16
+
+// streamed data is big-endian, this is a no-op on the N64 and only swaps on the host (e.g. in tests)
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  #define BE16(x) __builtin_bswap16(x)
+  #define BE32(x) __builtin_bswap32(x)
+#else
+  #define BE16(x) (x)
+  #define BE32(x) (x)
+#endif
 
 // Maps the input data streamed from the animation data file
 typedef struct {
   uint16_t nextTime;
   uint16_t channelIdx;
-  uint16_t data[2]; // can be either 1 or 2 16-bit values (scalar / quat)
+  uint16_t data[3]; // 1 to 6 bytes, see 'KF_DATA_SIZE'
 } T3DAnimKF;
 
+// Size of the data in a keyframe, the index is encoded in the 2 MSBs of the previous keyframe's time:
+// 8-bit scalar delta, 16-bit scalar, 32-bit quat. / cubic scalar, 48-bit quat.
+static const uint8_t KF_DATA_SIZE[4] = {1, 2, 4, 6};
+#define KF_SIZE_HEADER 4
+
+// Header of a snapshot in the streaming file, followed by the state of each channel
+typedef struct {
+  uint32_t streamOffset; // position of the next keyframe to load
+  uint16_t nextKfSize;
+  uint16_t _padding;
+} T3DAnimSnapshot;
+
+typedef struct {
+  uint16_t timeStart; // in ticks
+  uint16_t timeEnd;
+  uint16_t dataCurr[3]; // rotations are always stored with 48 bits
+  uint16_t dataNext[3];
+} T3DAnimSnapshotChannel;
+
+static T3DAnimStreamFile streamFiles[MAX_STREAM_FILES] = {0};
+
+static T3DAnimStreamFile* stream_file_acquire(const char *path) {
+  T3DAnimStreamFile *freeSlot = NULL;
+  for(int i=0; i<MAX_STREAM_FILES; ++i) {
+    T3DAnimStreamFile *f = &streamFiles[i];
+    if(f->refCount == 0) {
+      if(!freeSlot)freeSlot = f;
+    } else if(strcmp(f->path, path) == 0) {
+      ++f->refCount;
+      return f;
+    }
+  }
+
+  assertf(freeSlot, "Too many animation files open (max: %d)", MAX_STREAM_FILES);
+  *freeSlot = (T3DAnimStreamFile){
+    .path = strdup(path),
+    .file = asset_fopen(path, NULL),
+    .refCount = 1,
+    .pos = 0
+  };
+  return freeSlot;
+}
+
+static void stream_file_release(T3DAnimStreamFile *f) {
+  if(--f->refCount == 0) {
+    fclose(f->file);
+    free(f->path);
+    f->file = NULL;
+    f->path = NULL;
+  }
+}
+
 T3DAnim t3d_anim_create(const T3DModel *model, const char *name) {
   T3DChunkAnim* animDef = t3d_model_get_animation(model, name);
   assertf(animDef, "Animation '%s' not found in model", name);
 
-  return (T3DAnim){
+  T3DAnim anim = (T3DAnim){
     .animRef = animDef,
+    .skeletonRef = t3d_model_get_skeleton(model),
     .targetsScalar = NULL,
     .targetsQuat = NULL,
     .time = 0.0f,
     .speed = 1.0f,
     .nextKfSize = sizeof(T3DAnimKF),
-    .file = asset_fopen(animDef->filePath, NULL),
+    .file = stream_file_acquire(animDef->filePath),
     .isPlaying = 1,
     .isLooping = 1
   };
+
+  t3d_anim_stream_init(&anim.stream, anim.file, animDef->fileOffset, animDef->fileSize, T3D_ANIM_STREAM_BUFFER_SIZE);
+  t3d_anim_stream_prefetch(&anim.stream);
+  return anim;
+}
+
+void t3d_anim_preload(T3DAnim *anim) {
+  if(t3d_anim_stream_is_resident(&anim->stream))return;
+
+  // once everything is loaded, any position is valid, so playback can continue where it was
+  uint32_t readPos = anim->stream.readPos;
+  t3d_anim_stream_destroy(&anim->stream);
+  t3d_anim_stream_init(&anim->stream, anim->file, anim->animRef->fileOffset, anim->animRef->fileSize, anim->animRef->fileSize);
+  t3d_anim_stream_prefetch(&anim->stream);
+  anim->stream.readPos = readPos;
 }
 
 static void rewind_anim(T3DAnim *anim)
@@ -42,7 +121,7 @@ static void rewind_anim(T3DAnim *anim)
     anim->targetsQuat[c].base.timeEnd = 0;
   }
   anim->nextKfSize = sizeof(T3DAnimKF);
-  rewind(anim->file);
+  t3d_anim_stream_rewind(&anim->stream);
 }
 
 void t3d_anim_attach(T3DAnim *anim, const T3DSkeleton *skeleton) {
@@ -56,12 +135,36 @@ void t3d_anim_attach(T3DAnim *anim, const T3DSkeleton *skeleton) {
 
   uint32_t channelCount = anim->animRef->channelsScalar + anim->animRef->channelsQuat;
 
+  // animations from another model (e.g. a library) use its bone order, map them by name once here
+  const T3DChunkSkeleton *skelSrc = anim->skeletonRef;
+  const T3DChunkSkeleton *skelDst = skeleton->skeletonRef;
+  uint16_t *boneRemap = NULL;
+  if(skelSrc && skelSrc != skelDst) {
+    assertf(skelSrc->signature == skelDst->signature,
+      "Animation '%s' does not match the skeleton (%08lX != %08lX)", anim->animRef->name, skelSrc->signature, skelDst->signature
+    );
+    // same bones in the same order (e.g. a copy of the model) can use the indices as they are
+    bool sameOrder = skelSrc->boneCount == skelDst->boneCount;
+    for(uint32_t b = 0; sameOrder && b < skelSrc->boneCount; b++) {
+      sameOrder = strcmp(skelSrc->bones[b].name, skelDst->bones[b].name) == 0;
+    }
+
+    if(!sameOrder) {
+      boneRemap = malloc(sizeof(uint16_t) * skelSrc->boneCount);
+      for(uint32_t b = 0; b < skelSrc->boneCount; b++) {
+        int d = t3d_skeleton_chunk_find_bone(skelDst, skelSrc->bones[b].name);
+        assertf(d >= 0, "Bone '%s' not found in skeleton", skelSrc->bones[b].name);
+        boneRemap[b] = d;
+      }
+    }
+  }
+
   uint32_t idxQuat = 0;
   uint32_t idxScalar = 0;
   for(uint32_t i = 0; i < channelCount; i++)
   {
     T3DAnimChannelMapping *channelMap = &anim->animRef->channelMappings[i];
-    T3DBone *bone = &skeleton->bones[channelMap->targetIdx];
+    T3DBone *bone = &skeleton->bones[boneRemap ? boneRemap[channelMap->targetIdx] : channelMap->targetIdx];
 
     switch(channelMap->targetType) {
       case T3D_ANIM_TARGET_TRANSLATION:
@@ -79,6 +182,8 @@ void t3d_anim_attach(T3DAnim *anim, const T3DSkeleton *skeleton) {
       default: {assertf(false, "Unknown animation target %d", channelMap->targetType);}
     }
   }
+
+  if(boneRemap)free(boneRemap);
 }
 
 inline static void attach_scalar(T3DAnim* anim, uint32_t targetIdx, T3DVec3* target, int32_t *updateFlag, uint8_t targetType) {
@@ -113,6 +218,10 @@ static inline float s10ToFloat(uint32_t value, float offset, float scale) {
   return (float)value / 1023.0f * scale + offset;
 }
 
+static inline float s15ToFloat(uint32_t value, float offset, float scale) {
+  return (float)value / 32767.0f * scale + offset;
+}
+
 static inline void unpack_quat(uint16_t dataHi, uint16_t dataLo, T3DQuat *out) {
   int largestIdx = dataHi >> 14;
   int idx0 = (largestIdx + 1) & 0b11;
@@ -130,20 +239,65 @@ static inline void unpack_quat(uint16_t dataHi, uint16_t dataLo, T3DQuat *out) {
   out->v[largestIdx] = sqrtf(1.0f - q0*q0 - q1*q1 - q2*q2);
 }
 
+static inline void unpack_quat48(const uint16_t data[3], T3DQuat *out) {
+  uint64_t value = ((uint64_t)data[0] << 32) | ((uint32_t)data[1] << 16) | data[2];
+  int largestIdx = (value >> 45) & 0b11;
+  int idx0 = (largestIdx + 1) & 0b11;
+  int idx1 = (largestIdx + 2) & 0b11;
+  int idx2 = (largestIdx + 3) & 0b11;
+
+  float q0 = s15ToFloat((value >> 30) & 0x7FFF, -SQRT_2_INV, SQRT_2_INV+SQRT_2_INV);
+  float q1 = s15ToFloat((value >> 15) & 0x7FFF, -SQRT_2_INV, SQRT_2_INV+SQRT_2_INV);
+  float q2 = s15ToFloat((value      ) & 0x7FFF, -SQRT_2_INV, SQRT_2_INV+SQRT_2_INV);
+
+  out->v[idx0] = q0;
+  out->v[idx1] = q1;
+  out->v[idx2] = q2;
+  out->v[largestIdx] = sqrtf(fmaxf(0.0f, 1.0f - q0*q0 - q1*q1 - q2*q2));
+}
+
 static inline T3DAnimTargetBase* get_base_target(T3DAnim *anim, uint64_t channelIdx, bool isRot) {
   return isRot ?
     (T3DAnimTargetBase*)&anim->targetsQuat[channelIdx] :
     (T3DAnimTargetBase*)&anim->targetsScalar[channelIdx - anim->animRef->channelsQuat];
 }
 
+// moves the next value of a target into the current one, and decodes the new next value
+static inline void push_keyframe_value(T3DAnimTargetBase *targetBase, const T3DAnimChannelMapping *channelMap, const uint16_t data[3], uint32_t dataSize) {
+  if(channelMap->targetType == T3D_ANIM_TARGET_ROTATION) {
+    T3DAnimTargetQuat *target = (T3DAnimTargetQuat*)targetBase;
+    target->kfCurr = target->kfNext;
+    if(dataSize == 6) {
+      unpack_quat48(data, &target->kfNext);
+    } else {
+      unpack_quat(data[0], data[1], &target->kfNext);
+    }
+  } else {
+    T3DAnimTargetScalar *target = (T3DAnimTargetScalar*)targetBase;
+    target->kfCurr = target->kfNext;
+    target->tangentCurr = target->tangentNext;
+    if(dataSize == 1) { // delta to the previous value, only used in linear channels
+      target->kfNext += (float)(int8_t)(data[0] >> 8) * channelMap->deltaScale;
+      target->tangentNext = 0.0f;
+    } else {
+      target->kfNext = (float)data[0] * channelMap->quantScale + channelMap->quantOffset;
+      target->tangentNext = dataSize >= 4 ? ((float)(int16_t)data[1] * channelMap->tangentScale) : 0.0f;
+    }
+  }
+}
+
 static inline bool load_keyframe(T3DAnim *anim) {
   T3DAnimKF kf;
-  size_t readBytes = fread(&kf, anim->nextKfSize, 1, anim->file);
-  if(readBytes == 0)return false;
+  if(anim->nextKfSize <= KF_SIZE_HEADER)return false; // end of the stream (e.g. snapshots in older files)
+  uint32_t dataSize = anim->nextKfSize - KF_SIZE_HEADER;
+  if(!t3d_anim_stream_read(&anim->stream, &kf, anim->nextKfSize))return false;
+
+  kf.nextTime = BE16(kf.nextTime);
+  kf.channelIdx = BE16(kf.channelIdx);
+  for(uint32_t i=0; i<(dataSize+1)/2; ++i)kf.data[i] = BE16(kf.data[i]);
 
-  bool isLarge = kf.nextTime & 0x8000;
-  anim->nextKfSize = isLarge ? sizeof(T3DAnimKF) : (sizeof(T3DAnimKF)-2);
-  kf.nextTime &= 0x7FFF;
+  anim->nextKfSize = KF_SIZE_HEADER + KF_DATA_SIZE[kf.nextTime >> 14];
+  kf.nextTime &= 0x3FFF;
 
   T3DAnimChannelMapping *channelMap = &anim->animRef->channelMappings[kf.channelIdx];
 
@@ -152,17 +306,7 @@ static inline bool load_keyframe(T3DAnim *anim) {
 
   targetBase->timeStart = targetBase->timeEnd;
   targetBase->timeEnd += (float)kf.nextTime * KF_TIME_TICK;
-
-  if(channelMap->targetType == T3D_ANIM_TARGET_ROTATION) {
-    T3DAnimTargetQuat *target = (T3DAnimTargetQuat*)targetBase;
-    target->kfCurr = target->kfNext;
-    unpack_quat(kf.data[0], kf.data[1], &target->kfNext);
-  } else {
-    T3DAnimTargetScalar *target = (T3DAnimTargetScalar*)targetBase;
-    target->kfCurr = target->kfNext;
-    target->kfNext = (float)kf.data[0] * channelMap->quantScale + channelMap->quantOffset;
-  }
-
+  push_keyframe_value(targetBase, channelMap, kf.data, dataSize);
   return true;
 }
 
@@ -202,21 +346,74 @@ void t3d_anim_update(T3DAnim *anim, float deltaTime) {
       //t3d_quat_slerp(t->targetQuat, &t->kfCurr, &t->kfNext, interp);
     } else {
       T3DAnimTargetScalar *t = (T3DAnimTargetScalar*)target;
-      *t->targetScalar = t3d_lerp(t->kfCurr, t->kfNext, interp);
+      if(anim->animRef->channelMappings[c].tangentScale != 0.0f) {
+        *t->targetScalar = t3d_hermite(t->kfCurr, t->tangentCurr * timeDiff, t->kfNext, t->tangentNext * timeDiff, interp);
+      } else {
+        *t->targetScalar = t3d_lerp(t->kfCurr, t->kfNext, interp);
+      }
     }
   }
+
+  // load ahead of the playback, so the next update can read from memory
+  t3d_anim_stream_prefetch(&anim->stream);
 }
 
 void t3d_anim_destroy(T3DAnim *anim) {
   if(anim->targetsQuat)free(anim->targetsQuat); // 'targetsScalar' is part of this memory-block
-  if(anim->file)fclose(anim->file);
+  t3d_anim_stream_destroy(&anim->stream);
+  if(anim->file)stream_file_release(anim->file);
   anim->targetsQuat = NULL;
   anim->targetsScalar = NULL;
   anim->file = NULL;
 }
 
+/**
+ * Restores the state of all channels from a snapshot.
+ * Afterwards, playback continues by loading keyframes from the position stored in the snapshot.
+ */
+static void load_snapshot(T3DAnim *anim, uint32_t idx) {
+  const T3DChunkAnim *animDef = anim->animRef;
+  uint32_t channelCount = animDef->channelsScalar + animDef->channelsQuat;
+  uint32_t offset = animDef->snapshotOffset
+    + idx * (sizeof(T3DAnimSnapshot) + channelCount * sizeof(T3DAnimSnapshotChannel));
+
+  T3DAnimSnapshot snapshot;
+  t3d_anim_stream_file_read(anim->file, offset, &snapshot, sizeof(snapshot));
+  offset += sizeof(snapshot);
+
+  for(uint32_t c=0; c<channelCount; ++c) {
+    T3DAnimSnapshotChannel ch;
+    t3d_anim_stream_file_read(anim->file, offset, &ch, sizeof(ch));
+    offset += sizeof(ch);
+    for(uint32_t i=0; i<sizeof(ch)/sizeof(uint16_t); ++i) {
+      ((uint16_t*)&ch)[i] = BE16(((uint16_t*)&ch)[i]);
+    }
+
+    T3DAnimTargetBase *targetBase = get_base_target(anim, c, c < animDef->channelsQuat);
+    targetBase->timeStart = (float)ch.timeStart * KF_TIME_TICK;
+    targetBase->timeEnd = (float)ch.timeEnd * KF_TIME_TICK;
+    push_keyframe_value(targetBase, &animDef->channelMappings[c], ch.dataCurr, sizeof(ch.dataCurr));
+    push_keyframe_value(targetBase, &animDef->channelMappings[c], ch.dataNext, sizeof(ch.dataNext));
+  }
+
+  anim->nextKfSize = BE16(snapshot.nextKfSize);
+  t3d_anim_stream_seek(&anim->stream, BE32(snapshot.streamOffset));
+}
+
 void t3d_anim_set_time(T3DAnim *anim, float time) {
   if(time > anim->animRef->duration)time = anim->animRef->duration;
-  if(time < anim->time)rewind_anim(anim);
+  bool isRewind = time < anim->time;
+  if(isRewind)rewind_anim(anim);
+
+  // jump to the last snapshot before the new time, unless playback is already past it
+  uint32_t snapshotTicks = anim->animRef->snapshotTicks;
+  if(anim->animRef->snapshotCount > 0) {
+    uint32_t idx = (uint32_t)(time / ((float)snapshotTicks * KF_TIME_TICK));
+    if(idx > anim->animRef->snapshotCount)idx = anim->animRef->snapshotCount;
+    float snapshotTime = (float)(idx * snapshotTicks) * KF_TIME_TICK;
+    if(idx > 0 && (isRewind || snapshotTime > anim->time)) {
+      load_snapshot(anim, idx - 1);
+    }
+  }
   anim->time = time;
 }
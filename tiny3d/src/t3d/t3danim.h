@@ -7,6 +7,7 @@
 
 #include "t3dmodel.h"
 #include "t3dskeleton.h"
+#include "t3danimstream.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -36,17 +37,21 @@ typedef struct {
   float* targetScalar;
   float kfCurr;
   float kfNext;
+  float tangentCurr; // only used for cubic channels
+  float tangentNext;
 } T3DAnimTargetScalar;
 
 typedef struct {
   T3DChunkAnim *animRef;
+  const T3DChunkSkeleton *skeletonRef; // skeleton the channels refer to, used to map bones of other skeletons
   T3DAnimTargetQuat *targetsQuat;
   T3DAnimTargetScalar *targetsScalar;
 
   float speed;
   float time;
 
-  FILE *file;
+  T3DAnimStreamFile *file;
+  T3DAnimStream stream;
   int nextKfSize;
   uint8_t isPlaying;
   uint8_t isLooping;
@@ -54,14 +59,26 @@ typedef struct {
 
 /**
  * Creates an animation instance from a model's animation definition
+ * The model can also be an animation library ('.t3da', created with '--anim-lib'),
+ * those animations can then be attached to any skeleton with the same bones.
  * @param model The model to create the animation from
  * @param name The name of the animation to create
  * @return The created animation
  */
 T3DAnim t3d_anim_create(const T3DModel *model, const char* name);
 
+/**
+ * Loads the entire animation data into memory, no further file access is needed after that.
+ * By default, only animations fitting into the streaming buffer are kept in memory.
+ * This is useful for short animations played by many instances, or to avoid file access during gameplay.
+ * @param anim The animation to preload
+ */
+void t3d_anim_preload(T3DAnim* anim);
+
 /**
  * Attaches an animation to a skeleton.
+ * If the skeleton is from a different model than the animation, bones are mapped by name.
+ * This requires both skeletons to have the same bones and hierarchy (see 'signature' in T3DChunkSkeleton).
  * @param anim The animation to attach
  * @param skeleton The skeleton to attach the animation to
  */
@@ -0,0 +1,97 @@
+/**
+* @copyright 2024 - Max Bebök
+* @license MIT
+*/
+
+#include "t3d/t3danimstream.h"
+#include <stdlib.h>
+#include <string.h>
+
+uint32_t t3d_anim_stream_file_read(T3DAnimStreamFile *file, uint32_t offset, void *dst, uint32_t size) {
+  if(file->pos != offset) {
+    fseek(file->file, offset, SEEK_SET);
+  }
+  size_t readBytes = fread(dst, 1, size, file->file);
+  file->pos = offset + readBytes;
+  return readBytes;
+}
+
+void t3d_anim_stream_init(T3DAnimStream *stream, T3DAnimStreamFile *file, uint32_t offset, uint32_t size, uint32_t bufferSize) {
+  uint32_t sizeAligned = (size + T3D_ANIM_STREAM_BLOCK_SIZE - 1) & ~(T3D_ANIM_STREAM_BLOCK_SIZE - 1);
+  bufferSize = (bufferSize + T3D_ANIM_STREAM_BLOCK_SIZE - 1) & ~(T3D_ANIM_STREAM_BLOCK_SIZE - 1);
+
+  // a single read may span two blocks, so both must fit if data has to be streamed
+  if(bufferSize < T3D_ANIM_STREAM_BLOCK_SIZE*2)bufferSize = T3D_ANIM_STREAM_BLOCK_SIZE*2;
+  if(bufferSize > sizeAligned)bufferSize = sizeAligned;
+  if(bufferSize == 0)bufferSize = T3D_ANIM_STREAM_BLOCK_SIZE;
+
+  *stream = (T3DAnimStream){
+    .file = file,
+    .buffer = malloc(bufferSize),
+    .bufferSize = bufferSize,
+    .dataOffset = offset,
+    .dataSize = size,
+    .readPos = 0,
+    .loadPos = 0,
+    .loadStart = 0,
+  };
+}
+
+void t3d_anim_stream_rewind(T3DAnimStream *stream) {
+  t3d_anim_stream_seek(stream, 0);
+}
+
+void t3d_anim_stream_seek(T3DAnimStream *stream, uint32_t pos) {
+  // the buffer contains the last loaded bytes, which can be kept if the new position is inside of them
+  uint32_t bufferStart = stream->loadPos > stream->bufferSize ? (stream->loadPos - stream->bufferSize) : 0;
+  if(bufferStart < stream->loadStart)bufferStart = stream->loadStart;
+
+  if(pos < bufferStart || pos > stream->loadPos) {
+    stream->loadPos = pos & ~(T3D_ANIM_STREAM_BLOCK_SIZE - 1);
+    stream->loadStart = stream->loadPos;
+  }
+  stream->readPos = pos;
+}
+
+static void load_block(T3DAnimStream *stream) {
+  uint32_t size = stream->dataSize - stream->loadPos;
+  if(size > T3D_ANIM_STREAM_BLOCK_SIZE)size = T3D_ANIM_STREAM_BLOCK_SIZE;
+
+  // 'loadPos' is always at a block boundary (relative to the data, not the file)
+  // and the buffer is a multiple of blocks, so a block never wraps around
+  t3d_anim_stream_file_read(stream->file, stream->dataOffset + stream->loadPos,
+    stream->buffer + (stream->loadPos % stream->bufferSize), size
+  );
+  stream->loadPos += T3D_ANIM_STREAM_BLOCK_SIZE;
+}
+
+void t3d_anim_stream_prefetch(T3DAnimStream *stream) {
+  while(stream->loadPos < stream->dataSize
+    && (stream->loadPos + T3D_ANIM_STREAM_BLOCK_SIZE - stream->readPos) <= stream->bufferSize)
+  {
+    load_block(stream);
+  }
+}
+
+bool t3d_anim_stream_read(T3DAnimStream *stream, void *dst, uint32_t size) {
+  if(size == 0 || stream->readPos + size > stream->dataSize)return false;
+  if(stream->readPos + size > stream->loadPos) {
+    t3d_anim_stream_prefetch(stream);
+  }
+
+  uint32_t bufferPos = stream->readPos % stream->bufferSize;
+  uint32_t sizeA = stream->bufferSize - bufferPos;
+  if(sizeA >= size) {
+    memcpy(dst, stream->buffer + bufferPos, size);
+  } else {
+    memcpy(dst, stream->buffer + bufferPos, sizeA);
+    memcpy((uint8_t*)dst + sizeA, stream->buffer, size - sizeA);
+  }
+  stream->readPos += size;
+  return true;
+}
+
+void t3d_anim_stream_destroy(T3DAnimStream *stream) {
+  free(stream->buffer);
+  stream->buffer = NULL;
+}
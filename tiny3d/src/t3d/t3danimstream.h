@@ -0,0 +1,117 @@
+/**
+* @copyright 2024 - Max Bebök
+* @license MIT
+*/
+#ifndef TINY3D_T3DANIMSTREAM_H
+#define TINY3D_T3DANIMSTREAM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// Size of a single read from the streaming-data file.
+// Blocks are counted from the start of the data, which the importer aligns to this in the file.
+#define T3D_ANIM_STREAM_BLOCK_SIZE 256
+// Default size of the ring-buffer per animation instance, must be a multiple of the block size
+#define T3D_ANIM_STREAM_BUFFER_SIZE (T3D_ANIM_STREAM_BLOCK_SIZE * 2)
+
+// Streaming-data file, opened once and shared by all animation instances using it
+typedef struct {
+  char *path; // own copy, the model (and its string table) may be freed before the last user
+  FILE *file;
+  uint32_t refCount;
+  uint32_t pos; // current position in the file, used to skip seeking
+} T3DAnimStreamFile;
+
+/**
+ * Ring-buffer over a section of a streaming-data file.
+ * Data is loaded in whole blocks ahead of the read position.
+ * If the buffer can hold the entire section, it is only loaded once and kept in memory.
+ * This only depends on stdio, so it can also be used with regular files on a PC.
+ */
+typedef struct {
+  T3DAnimStreamFile *file;
+  uint8_t *buffer;
+  uint32_t bufferSize;
+  uint32_t dataOffset; // start of the section in the file
+  uint32_t dataSize;   // size of the section in bytes
+  uint32_t readPos;    // bytes consumed, relative to the section start
+  uint32_t loadPos;    // bytes loaded, relative to the section start
+  uint32_t loadStart;  // position loading started from after the last seek
+} T3DAnimStream;
+
+/**
+ * Reads data directly from a shared file, only seeking if needed.
+ * @param file file to read from
+ * @param offset offset in the file
+ * @param dst destination buffer
+ * @param size bytes to read
+ * @return bytes read
+ */
+uint32_t t3d_anim_stream_file_read(T3DAnimStreamFile *file, uint32_t offset, void *dst, uint32_t size);
+
+/**
+ * Initializes a stream and allocates its buffer, no data is loaded yet.
+ * @param stream stream to initialize
+ * @param file shared file to read from
+ * @param offset start of the data in the file
+ * @param size size of the data in bytes
+ * @param bufferSize size of the ring-buffer, rounded up to whole blocks. Capped by the data size.
+ */
+void t3d_anim_stream_init(T3DAnimStream *stream, T3DAnimStreamFile *file, uint32_t offset, uint32_t size, uint32_t bufferSize);
+
+/**
+ * Resets the read position to the start.
+ * If the beginning of the data is still in the buffer, nothing needs to be loaded again.
+ * @param stream
+ */
+void t3d_anim_stream_rewind(T3DAnimStream *stream);
+
+/**
+ * Sets the read position, data still in the buffer is kept if possible.
+ * @param stream
+ * @param pos position relative to the start of the data
+ */
+void t3d_anim_stream_seek(T3DAnimStream *stream, uint32_t pos);
+
+/**
+ * Loads as many blocks as fit into the free space of the buffer.
+ * This should be called after consuming data, so that the next reads don't need to wait on the file.
+ * @param stream
+ */
+void t3d_anim_stream_prefetch(T3DAnimStream *stream);
+
+/**
+ * Reads data from the stream, loading new blocks if needed.
+ * @param stream stream to read from
+ * @param dst destination buffer
+ * @param size bytes to read, must be at most one block
+ * @return false if the end of the data was reached or nothing was requested
+ */
+bool t3d_anim_stream_read(T3DAnimStream *stream, void *dst, uint32_t size);
+
+/**
+ * Checks if the stream holds all of its data in memory.
+ * @param stream
+ * @return true if no further file access is needed
+ */
+static inline bool t3d_anim_stream_is_resident(const T3DAnimStream *stream) {
+  return stream->bufferSize >= stream->dataSize;
+}
+
+/**
+ * Frees the buffer of the stream, the file itself is not closed.
+ * @param stream
+ */
+void t3d_anim_stream_destroy(T3DAnimStream *stream);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TINY3D_T3DANIMSTREAM_H
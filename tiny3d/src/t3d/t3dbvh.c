@@ -0,0 +1,144 @@
+/**
+* @copyright 2024 - Max Bebök
+* @license MIT
+*/
+
+#include <stdlib.h>
+#include "t3dmodel.h"
+
+#define BVH_STACK_SIZE 64
+#define BVH_ACTIVE_SHIFT 24 // bits 0-23 store 6 plane bits per frustum, followed by 4 active bits
+
+typedef struct {
+  uint16_t nodeIdx;
+  uint16_t _padding;
+  // per frustum: planes that still need to be checked (see 't3d_frustum_vs_aabb_s16_masked'),
+  // as well as a bit if the node may be visible in that frustum at all
+  uint32_t state;
+} T3DBvhStackEntry;
+
+static int compare_object_ptr(const void *a, const void *b) {
+  uintptr_t objA = (uintptr_t)*(T3DObject* const*)a;
+  uintptr_t objB = (uintptr_t)*(T3DObject* const*)b;
+  return (objA > objB) - (objA < objB);
+}
+
+// Tests an AABB against all frustums still active in 'state', returns the new state
+static inline uint32_t bvh_test_aabb(const T3DFrustum *frustums, uint32_t frustumCount, uint32_t state, const int16_t min[3], const int16_t max[3])
+{
+  for(uint32_t f=0; f<frustumCount; ++f) {
+    uint32_t activeBit = 1 << (BVH_ACTIVE_SHIFT + f);
+    uint32_t shift = f * 6;
+    uint32_t planeMask = (state >> shift) & T3D_FRUSTUM_PLANES_ALL;
+    // skip if already culled, or if a parent was fully inside
+    if(!(state & activeBit) || !planeMask)continue;
+
+    if(t3d_frustum_vs_aabb_s16_masked(&frustums[f], min, max, &planeMask)) {
+      state = (state & ~(T3D_FRUSTUM_PLANES_ALL << shift)) | (planeMask << shift);
+    } else {
+      state &= ~activeBit;
+    }
+  }
+  return state;
+}
+
+// Traverses the BVH once for all frustums with an explicit stack.
+// If 'objects' is NULL, only the 'isVisible' flag is set
+static uint32_t bvh_query(
+  const T3DBvh *bvh, const T3DFrustum *frustums, const uint32_t* const* pvsRows, uint32_t frustumCount,
+  uint8_t *viewportMasks, T3DObject **objects, uint32_t maxObjects
+) {
+  assertf(frustumCount > 0 && frustumCount <= T3D_BVH_MAX_FRUSTUMS, "Invalid frustum count: %lu", frustumCount);
+  const T3DBvhData *data = (T3DBvhData*)&bvh->nodes[bvh->nodeCount]; // data starts right after nodes
+  const char *basePtr = (const char*)bvh;
+  uint32_t objCount = 0;
+
+  uint32_t initialState = 0;
+  for(uint32_t f=0; f<frustumCount; ++f) {
+    initialState |= (T3D_FRUSTUM_PLANES_ALL << (f * 6)) | (1 << (BVH_ACTIVE_SHIFT + f));
+  }
+
+  T3DBvhStackEntry stack[BVH_STACK_SIZE];
+  int stackSize = 0;
+  stack[stackSize++] = (T3DBvhStackEntry){.nodeIdx = 0, .state = initialState};
+
+  while(stackSize > 0)
+  {
+    T3DBvhStackEntry entry = stack[--stackSize];
+    const T3DBvhNode *node = &bvh->nodes[entry.nodeIdx];
+
+    uint32_t state = bvh_test_aabb(frustums, frustumCount, entry.state, node->aabbMin, node->aabbMax);
+    if((state >> BVH_ACTIVE_SHIFT) == 0)continue;
+
+    int dataCount = node->value & 0b1111;
+    int offset = (int16_t)node->value >> 4;
+
+    if(dataCount == 0) {
+      assertf(stackSize + 2 <= BVH_STACK_SIZE, "BVH too deep, increase BVH_STACK_SIZE");
+      stack[stackSize++] = (T3DBvhStackEntry){.nodeIdx = entry.nodeIdx + offset + 1, .state = state};
+      stack[stackSize++] = (T3DBvhStackEntry){.nodeIdx = entry.nodeIdx + offset, .state = state};
+      continue;
+    }
+
+    int offsetEnd = offset + dataCount;
+    while(offset < offsetEnd) {
+      T3DObject* obj = (T3DObject*)(basePtr - ((uintptr_t)data[offset++].objectPtr << 2));
+
+      uint32_t objState = state;
+      if(pvsRows) {
+        for(uint32_t f=0; f<frustumCount; ++f) {
+          if(!t3d_model_pvs_is_visible(pvsRows[f], obj))objState &= ~(1 << (BVH_ACTIVE_SHIFT + f));
+        }
+      }
+
+      objState = bvh_test_aabb(frustums, frustumCount, objState, obj->aabbMin, obj->aabbMax);
+      uint32_t mask = objState >> BVH_ACTIVE_SHIFT;
+      if(mask == 0)continue;
+
+      if(!objects) {
+        obj->isVisible = true;
+      } else if(objCount < maxObjects) {
+        objects[objCount++] = obj;
+        if(viewportMasks)viewportMasks[obj->index] = mask;
+      }
+    }
+  }
+
+  // the BVH returns objects in spatial order, restore the order of the file (e.g. opaque before transparent)
+  if(objects && objCount > 1) {
+    qsort(objects, objCount, sizeof(T3DObject*), compare_object_ptr);
+  }
+  return objCount;
+}
+
+void t3d_model_bvh_query_frustum(const T3DBvh *bvh, const T3DFrustum *frustum) {
+  bvh_query(bvh, frustum, NULL, 1, NULL, NULL, 0);
+}
+
+uint32_t t3d_model_bvh_query_frustum_list(const T3DBvh *bvh, const T3DFrustum *frustum, T3DObject **objects, uint32_t maxObjects) {
+  return bvh_query(bvh, frustum, NULL, 1, NULL, objects, maxObjects);
+}
+
+uint32_t t3d_model_bvh_query_frustum_pvs(const T3DBvh *bvh, const T3DFrustum *frustum, const uint32_t *pvsRow, T3DObject **objects, uint32_t maxObjects) {
+  return bvh_query(bvh, frustum, &pvsRow, 1, NULL, objects, maxObjects);
+}
+
+uint32_t t3d_model_bvh_query_frustums(
+  const T3DBvh *bvh, const T3DFrustum *frustums, const uint32_t* const* pvsRows, uint32_t frustumCount,
+  uint8_t *viewportMasks, T3DObject **objects, uint32_t maxObjects
+) {
+  return bvh_query(bvh, frustums, pvsRows, frustumCount, viewportMasks, objects, maxObjects);
+}
+
+uint32_t t3d_model_objects_filter_viewport(
+  T3DObject* const* objects, uint32_t count, const uint8_t *viewportMasks, uint32_t viewport, T3DObject **out
+) {
+  uint32_t outCount = 0;
+  uint8_t bit = 1 << viewport;
+  for(uint32_t i=0; i<count; ++i) {
+    if(viewportMasks[objects[i]->index] & bit) {
+      out[outCount++] = objects[i];
+    }
+  }
+  return outCount;
+}
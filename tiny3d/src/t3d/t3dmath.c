@@ -137,6 +137,35 @@ bool t3d_frustum_vs_aabb_s16(const T3DFrustum *frustum, const int16_t min[3], co
   return true;
 }
 
+bool t3d_frustum_vs_aabb_s16_masked(const T3DFrustum *frustum, const int16_t min[3], const int16_t max[3], uint32_t *planeMask)
+{
+  uint32_t mask = *planeMask;
+  for(int i=0; i<6; ++i) {
+    if(!(mask & (1 << i)))continue;
+    const T3DVec4 *plane = &frustum->planes[i];
+
+    // distance of the corners closest and furthest along the plane normal
+    float distNear = plane->v[3];
+    float distFar = plane->v[3];
+    for(int a=0; a<3; ++a) {
+      float pMin = plane->v[a] * min[a];
+      float pMax = plane->v[a] * max[a];
+      if(pMin < pMax) {
+        distNear += pMin;
+        distFar += pMax;
+      } else {
+        distNear += pMax;
+        distFar += pMin;
+      }
+    }
+
+    if(distFar <= 0.0f)return false; // all corners outside
+    if(distNear > 0.0f)mask &= ~(1 << i); // all corners inside, no need to check this plane for children
+  }
+  *planeMask = mask;
+  return true;
+}
+
 bool t3d_frustum_vs_sphere(const T3DFrustum *frustum, const T3DVec3 *center, const float radius){
   for(int i=0; i<6; ++i) {
     float dist = t3d_vec3_dot((T3DVec3*)&frustum->planes[i], center) + frustum->planes[i].v[3];
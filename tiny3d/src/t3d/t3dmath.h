@@ -15,6 +15,7 @@ extern "C"
 #define T3D_DEG_TO_RAD(deg) (deg * 0.01745329252f)
 #define T3D_F32_TO_FIXED(val) (int32_t)((val) * (float)(1<<16))
 #define T3D_PI 3.14159265358979f
+#define T3D_FRUSTUM_PLANES_ALL 0b111111
 
 // 3D float vector
 typedef union {
@@ -73,6 +74,13 @@ inline static float t3d_lerp(float a, float b, float t) {
   return a + (b - a) * t;
 }
 
+/// @brief Cubic hermite interpolation between 'p0' and 'p1' by 't', tangents must be scaled to the interval
+inline static float t3d_hermite(float p0, float m0, float p1, float m1, float t) {
+  float t2 = t * t;
+  float t3 = t2 * t;
+  return (2*t3 - 3*t2 + 1) * p0 + (t3 - 2*t2 + t) * m0 + (-2*t3 + 3*t2) * p1 + (t3 - t2) * m1;
+}
+
 /// @brief Interpolates between two angles (radians) by 't'
 inline static float t3d_lerp_angle(float a, float b, float t) {
   float angleDiff = fmodf((b - a), T3D_PI*2);
@@ -511,6 +519,19 @@ bool t3d_frustum_vs_aabb(const T3DFrustum *frustum, const T3DVec3 *min, const T3
  */
 bool t3d_frustum_vs_aabb_s16(const T3DFrustum *frustum, const int16_t min[3], const int16_t max[3]);
 
+/**
+ * Checks if an s16 AABB is inside a frustum, only testing the planes set in 'planeMask'.
+ * Any plane the AABB is fully inside of gets cleared from the mask.
+ * This can be used in hierarchies (e.g. a BVH) to skip planes a parent was already fully inside of.
+ * Note that this function *may* choose to return false positives in favor of speed.
+ * @param frustum frustum
+ * @param min AABB min
+ * @param max AABB max
+ * @param planeMask in/out: bit 'i' is set if plane 'i' needs to be checked, start with 'T3D_FRUSTUM_PLANES_ALL'
+ * @return true if the AABB is inside the frustum
+ */
+bool t3d_frustum_vs_aabb_s16_masked(const T3DFrustum *frustum, const int16_t min[3], const int16_t max[3], uint32_t *planeMask);
+
 /**
  * Checks if a Sphere is inside a frustum.
  * Note that this function *may* choose to return false positives in favor of speed.
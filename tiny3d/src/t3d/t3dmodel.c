@@ -3,9 +3,12 @@
 * @license MIT
 */
 
+#include <stdlib.h>
+#include <malloc.h>
 #include "t3dmodel.h"
+#include "t3dtexcache.h"
 
-#define T3DM_VERSION 0x03
+#define T3DM_VERSION 0x0C
 
 static inline void* patch_pointer(void *ptr, uint32_t offset) {
   return (void*)(offset + (int32_t)ptr);
@@ -20,83 +23,47 @@ static inline bool is_power_of_two(uint16_t x) {
 }
 
 typedef struct {
-  uint16_t objectPtr;
-} T3DBvhData;
+  rspq_block_t *block;
+  T3DModelState state; // state after the block, so non-compiled materials can continue from it
+  T3DMaterial material; // copy at recording time, used to detect changes
+  T3DModelTileCb tileCb;
+  void* userData;
+} T3DCompiledMaterial;
 
 typedef struct {
-  uint32_t hash;
-  sprite_t *texture;
-  uint32_t count;
-} T3DTextureEntry;
+  rspq_block_t *block;
+  T3DCompiledMaterial *material;
+  bool hasBones;
+} T3DCompiledObject;
 
-static uint32_t textureCacheSize = 0;
-static T3DTextureEntry *textureCache = NULL;
-static T3DModelState dummyState;
-
-static sprite_t* texture_cache_get(uint32_t hash) {
-  for(uint32_t i = 0; i < textureCacheSize; i++) {
-    if(textureCache[i].hash == hash) {
-      textureCache[i].count++;
-      return textureCache[i].texture;
-    }
-  }
-  return NULL;
-}
-
-static void texture_cache_add(uint32_t hash, sprite_t *texture) {
-  T3DTextureEntry *cacheEntry = NULL;
-  for(uint32_t i = 0; i < textureCacheSize; i++) {
-    if(textureCache[i].hash == 0) {
-      cacheEntry = &textureCache[i];
-      break;
-    }
-  }
-
-  if(cacheEntry == NULL) {
-    textureCacheSize++;
-    if(textureCache == NULL) {
-      textureCache = malloc(sizeof(T3DTextureEntry));
-    } else {
-      textureCache = realloc(textureCache, sizeof(T3DTextureEntry) * textureCacheSize);
-    }
-    cacheEntry = &textureCache[textureCacheSize-1];
-  }
-
-  cacheEntry->hash = hash;
-  cacheEntry->texture = texture;
-  cacheEntry->count = 1;
-}
-
-static void texture_cache_free(uint32_t hash)
-{
-  for(uint32_t i = 0; i < textureCacheSize; i++) {
-    if(textureCache[i].hash == hash) {
-      textureCache[i].count--;
-      //debugf("Free Texture: %08lX, count=%lu\n", hash, textureCache[i].count);
-      if(textureCache[i].count == 0) {
-        sprite_free(textureCache[i].texture);
-        textureCache[i].hash = 0;
-      }
-      return;
-    }
-  }
+typedef struct {
+  uint32_t objectCount;
+  uint32_t materialCount;
+  T3DCompiledObject *objects; // indexed by 'T3DObject.index'
+  T3DCompiledMaterial materials[];
+} T3DDrawCache;
+
+static void texture_free(void *texture) {
+  sprite_free((sprite_t*)texture);
 }
 
-static void texture_cache_free_mem()
-{
-  uint32_t emptyEntries = 0;
-
-  for(uint32_t i = 0; i < textureCacheSize; i++) {
-    if(textureCache[i].hash == 0) {
-      emptyEntries++;
-    }
-  }
+static T3DTexCache textureCache = {
+  .lruHead = -1,
+  .lruTail = -1,
+  .freeFn = texture_free,
+};
+static T3DModelState dummyState;
 
-  if(textureCache && emptyEntries == textureCacheSize)
-  {
-    free(textureCache);
-    textureCache = NULL;
-    textureCacheSize = 0;
+static void load_texture(T3DMaterialTexture *tex) {
+  if(!tex->texPath || tex->texture)return;
+  tex->texture = t3d_tex_cache_acquire(&textureCache, tex->textureHash);
+  if(tex->texture == NULL) {
+    //debugf("Not in cache, load %s (%08lX)\n", tex->texPath, tex->textureHash);
+    tex->texture = sprite_load(tex->texPath);
+    //const char* formatName = tex_format_name(sprite_get_format(mat->texture));
+    //debugf(" -> %s\n", formatName);
+    // sprites are loaded as a single allocation
+    t3d_tex_cache_insert(&textureCache, tex->textureHash, tex->texture, malloc_usable_size(tex->texture));
   }
 }
 
@@ -106,16 +73,7 @@ static void set_texture(T3DMaterial *mat, rdpq_tile_t tile, T3DModelDrawConf *co
   if(tex->texPath || tex->texReference)
   {
     //debugf("Load Texture: %s (%08lX)\n", tex->texPath, tex->textureHash);
-    if(tex->texPath && !tex->texture) {
-      tex->texture = texture_cache_get(tex->textureHash);
-      if(tex->texture == NULL) {
-        //debugf("Not in cache, load %s (%08lX)\n", tex->texPath, tex->textureHash);
-        tex->texture = sprite_load(tex->texPath);
-        //const char* formatName = tex_format_name(sprite_get_format(mat->texture));
-        //debugf(" -> %s\n", formatName);
-        texture_cache_add(tex->textureHash, tex->texture);
-      }
-    }
+    load_texture(tex);
 
     rdpq_texparms_t texParam = (rdpq_texparms_t){};
     texParam.s.translate = tex->s.low;
@@ -182,11 +140,8 @@ static bool handle_bone_matrix(const T3DObjectPart *part, const T3DMat4FP* matSt
   return hadMatrixPush;
 }
 
-T3DModel *t3d_model_load(const char *path) {
-  int size = 0;
-  T3DModel* model = asset_load(path, &size);
-  int32_t ptrOffset = (int32_t)(void*)model;
-
+static void check_header(const T3DModel *model, const char *path) {
+  (void)path; // only used by asserts, which are removed in release builds
   if(memcmp(model->magic, "T3M", 3) != 0) {
     assertf(false, "Invalid T3D model file: %s", path);
   }
@@ -194,6 +149,93 @@ T3DModel *t3d_model_load(const char *path) {
     "Invalid T3D model version: %d != %d\n"
     "Please make a clean build of t3d and your project",
     T3DM_VERSION, model->magic[3]);
+}
+
+// Reads the header and chunk-table first, then only the data of chunks not listed in 'skipChunks'.
+// Kept chunks are moved together but keep their alignment, skipped ones are removed from the table (type 0).
+static T3DModel* load_chunks(const char *path, const char *skipChunks, int *outSize) {
+  int fileSize = 0;
+  FILE *file = asset_fopen(path, &fileSize);
+  assertf(file != NULL, "Failed to open model: %s", path);
+
+  T3DModel header;
+  size_t readCount = fread(&header, sizeof(T3DModel), 1, file);
+  assertf(readCount == 1, "Failed to read model header: %s", path);
+  check_header(&header, path);
+
+  uint32_t headerSize = sizeof(T3DModel) + header.chunkCount * sizeof(T3DChunkOffset);
+  assertf(headerSize <= (uint32_t)fileSize, "Invalid chunk count %lu in model: %s", header.chunkCount, path);
+  T3DChunkOffset *table = malloc(header.chunkCount * sizeof(T3DChunkOffset));
+  assertf(table != NULL, "Failed to allocate chunk table: %s", path);
+  readCount = fread(table, sizeof(T3DChunkOffset), header.chunkCount, file);
+  assertf(readCount == header.chunkCount, "Failed to read chunk table: %s", path);
+
+  // chunks are stored in the order of the table, followed by the string table (as the last range)
+  uint32_t rangeCount = header.chunkCount + 1;
+  uint32_t *ranges = malloc(rangeCount * 3 * sizeof(uint32_t));
+  assertf(ranges != NULL, "Failed to allocate chunk ranges: %s", path);
+  uint32_t *rangeStart = ranges;
+  uint32_t *rangeEnd = ranges + rangeCount;
+  uint32_t *newOffsets = ranges + rangeCount * 2; // 0 if skipped
+
+  uint32_t size = headerSize;
+  for(uint32_t i = 0; i < rangeCount; i++) {
+    rangeStart[i] = i < header.chunkCount ? (table[i].offset & 0x00FFFFFF) : (uint32_t)header.stringTablePtr;
+    if(i > 0)rangeEnd[i-1] = rangeStart[i];
+  }
+  rangeEnd[rangeCount-1] = fileSize;
+
+  for(uint32_t i = 0; i < rangeCount; i++) {
+    assertf(rangeStart[i] >= headerSize && rangeStart[i] <= rangeEnd[i] && rangeEnd[i] <= (uint32_t)fileSize,
+      "Invalid chunk %lu (%08lX - %08lX, file size: %d) in model: %s", i, rangeStart[i], rangeEnd[i], fileSize, path);
+  }
+
+  for(uint32_t i = 0; i < rangeCount; i++) {
+    if(i < header.chunkCount && strchr(skipChunks, table[i].type) != NULL) {
+      newOffsets[i] = 0;
+      continue;
+    }
+    size += (rangeStart[i] - size) & 0xF; // same alignment as in the file
+    newOffsets[i] = size;
+    size += rangeEnd[i] - rangeStart[i];
+  }
+
+  T3DModel *model = memalign(16, size);
+  assertf(model != NULL, "Failed to allocate %lu bytes for model: %s", size, path);
+  memcpy(model, &header, sizeof(T3DModel));
+
+  // adjacent chunks stay adjacent, so they are read at once
+  for(uint32_t i = 0; i < rangeCount; i++) {
+    if(newOffsets[i] == 0)continue;
+    uint32_t first = i;
+    while(i+1 < rangeCount && newOffsets[i+1] != 0)++i;
+    uint32_t readSize = rangeEnd[i] - rangeStart[first];
+    int seekRes = fseek(file, rangeStart[first], SEEK_SET);
+    assertf(seekRes == 0, "Failed to seek to chunk %lu in model: %s", first, path);
+    readCount = fread((char*)model + newOffsets[first], 1, readSize, file);
+    assertf(readCount == readSize, "Failed to read chunk %lu (%u/%lu bytes) in model: %s", first, readCount, readSize, path);
+    (void)seekRes;
+  }
+  (void)readCount;
+  fclose(file);
+
+  for(uint32_t i = 0; i < header.chunkCount; i++) {
+    if(newOffsets[i] == 0) {
+      model->chunkOffsets[i].offset = 0;
+    } else {
+      model->chunkOffsets[i].offset = (table[i].offset & 0xFF000000) | newOffsets[i];
+    }
+  }
+  model->stringTablePtr = (char*)newOffsets[header.chunkCount];
+
+  free(ranges);
+  free(table);
+  *outSize = size;
+  return model;
+}
+
+static T3DModel* patch_model(T3DModel *model, int size) {
+  int32_t ptrOffset = (int32_t)(void*)model;
 
   void* basePtrVertices = (char*)model + (model->chunkOffsets[model->chunkIdxVertices].offset & 0xFFFFFF);
   void* basePtrIndices = (char*)model + (model->chunkOffsets[model->chunkIdxIndices].offset & 0xFFFFFF);
@@ -207,6 +249,7 @@ T3DModel *t3d_model_load(const char *path) {
 
     if(chunkType == T3D_CHUNK_TYPE_OBJECT) {
       T3DObject *obj = (T3DObject*)((char*)model + offset);
+      obj->index = i; // objects are always the first chunks
       if(obj->name != NULL) {
         obj->name = patch_pointer(obj->name, (uint32_t)model->stringTablePtr);
       }
@@ -258,7 +301,7 @@ T3DModel *t3d_model_load(const char *path) {
 
       for(int d=0; d<bvh->dataCount; ++d) {
         T3DObject *obj = t3d_model_get_object_by_index(model, data[d].objectPtr);
-        uint32_t addr = (uint32_t)bvh  - (uint32_t)obj;
+        uintptr_t addr = (uintptr_t)bvh - (uintptr_t)obj;
         assert((addr & 0b11) == 0);
         addr >>= 2;
         assert(addr < 0x10000);
@@ -271,33 +314,214 @@ T3DModel *t3d_model_load(const char *path) {
   return model;
 }
 
+T3DModel *t3d_model_load(const char *path) {
+  int size = 0;
+  T3DModel* model = asset_load(path, &size);
+  check_header(model, path);
+  return patch_model(model, size);
+}
+
+T3DModel *t3d_model_load_custom(const char *path, T3DModelLoadConf conf) {
+  if(conf.skipChunks == NULL || conf.skipChunks[0] == '\0') {
+    return t3d_model_load(path);
+  }
+
+  for(const char *type = conf.skipChunks; *type; ++type) {
+    assertf(*type != T3D_CHUNK_TYPE_OBJECT && *type != T3D_CHUNK_TYPE_MATERIAL
+      && *type != T3D_CHUNK_TYPE_VERTICES && *type != T3D_CHUNK_TYPE_INDICES,
+      "Chunk type '%c' is required and can't be skipped", *type);
+  }
+
+  int size = 0;
+  T3DModel* model = load_chunks(path, conf.skipChunks, &size);
+  return patch_model(model, size);
+}
+
+static inline void draw_object_with_state(T3DObject *obj, T3DModelDrawConf *conf, T3DModelState *state)
+{
+  if(conf->filterCb && !conf->filterCb(conf->userData, obj)) {
+    return;
+  }
+
+  if(obj->material) {
+    t3d_model_state_set_lighting(state, obj->material);
+    t3d_model_draw_material(obj->material, state);
+  }
+  t3d_model_draw_object_culled(obj, conf->matrices, conf->camPos, conf->frustum);
+}
+
 void t3d_model_draw_custom(const T3DModel* model, T3DModelDrawConf conf)
 {
   T3DModelState state = t3d_model_state_create();
   state.drawConf = &conf;
 
   T3DModelIter it = t3d_model_iter_create(model, T3D_CHUNK_TYPE_OBJECT);
-  while(t3d_model_iter_next(&it))
+  while(t3d_model_iter_next(&it)) {
+    draw_object_with_state(it.object, &conf, &state);
+  }
+
+  if(state.lastVertFXFunc != T3D_VERTEX_FX_NONE)t3d_state_set_vertex_fx(T3D_VERTEX_FX_NONE, 0, 0);
+  if(state.lastUnlit)t3d_light_set_enabled(true);
+}
+
+static T3DDrawCache* get_draw_cache(T3DModel *model)
+{
+  if(model->drawCache)return model->drawCache;
+
+  uint32_t objectCount = 0;
+  uint32_t materialCount = 0;
+  for(uint32_t c = 0; c < model->chunkCount; c++) {
+    char chunkType = model->chunkOffsets[c].type;
+    if(chunkType == T3D_CHUNK_TYPE_OBJECT)++objectCount;
+    if(chunkType == T3D_CHUNK_TYPE_MATERIAL)++materialCount;
+  }
+
+  T3DDrawCache *cache = calloc(1, sizeof(T3DDrawCache)
+    + sizeof(T3DCompiledMaterial) * materialCount
+    + sizeof(T3DCompiledObject) * objectCount
+  );
+  cache->objectCount = objectCount;
+  cache->materialCount = materialCount;
+  cache->objects = (T3DCompiledObject*)&cache->materials[materialCount];
+
+  // objects are the first chunks, and materials are stored next to each other
+  for(uint32_t o = 0; o < objectCount; o++) {
+    T3DObject *obj = t3d_model_get_object_by_index(model, o);
+    T3DCompiledObject *entry = &cache->objects[o];
+    for(uint32_t m = 0; m < materialCount; m++) {
+      uint32_t offset = model->chunkOffsets[model->chunkIdxMaterials + m].offset & 0x00FFFFFF;
+      if(obj->material == (T3DMaterial*)((char*)model + offset)) {
+        entry->material = &cache->materials[m];
+        break;
+      }
+    }
+    for(uint32_t p = 0; p < obj->numParts; p++) {
+      if(obj->parts[p].matrixIdx != 0xFFFF)entry->hasBones = true;
+    }
+  }
+
+  model->drawCache = cache;
+  return cache;
+}
+
+static void block_free_cb(void *block) {
+  rspq_block_free((rspq_block_t*)block);
+}
+
+static void draw_material_compiled(T3DCompiledMaterial *entry, T3DMaterial *mat, T3DModelDrawConf *conf, T3DModelState *state)
+{
+  if(entry->block && (entry->tileCb != conf->tileCb || entry->userData != conf->userData
+    || memcmp(&entry->material, mat, sizeof(T3DMaterial)) != 0))
   {
-    if(conf.filterCb && !conf.filterCb(conf.userData, it.object)) {
+    // the RSP may still run the old block from a previous frame
+    rspq_call_deferred(block_free_cb, entry->block);
+    entry->block = NULL;
+  }
+
+  if(!entry->block) {
+    entry->state = t3d_model_state_create();
+    entry->state.drawConf = conf;
+    rspq_block_begin();
+      t3d_model_draw_material(mat, &entry->state);
+    entry->block = rspq_block_end();
+    entry->state.drawConf = NULL;
+
+    // copied after recording, since textures are only loaded there
+    memcpy(&entry->material, mat, sizeof(T3DMaterial));
+    entry->tileCb = conf->tileCb;
+    entry->userData = conf->userData;
+  }
+
+  // lighting is not part of the block, since disabling it there would be undone with the next draw
+  t3d_model_state_set_lighting(state, mat);
+  rspq_block_run(entry->block);
+  bool lastUnlit = state->lastUnlit;
+  *state = entry->state;
+  state->drawConf = conf;
+  state->lastUnlit = lastUnlit;
+}
+
+void t3d_model_draw_compiled(T3DModel* model, T3DModelDrawConf conf)
+{
+  T3DDrawCache *cache = get_draw_cache(model);
+  T3DModelState state = t3d_model_state_create();
+  state.drawConf = &conf;
+  T3DCompiledMaterial *lastMat = NULL;
+
+  for(uint32_t o = 0; o < cache->objectCount; o++) {
+    T3DObject *obj = t3d_model_get_object_by_index(model, o);
+    if(conf.filterCb && !conf.filterCb(conf.userData, obj))continue;
+
+    T3DCompiledObject *entry = &cache->objects[o];
+    T3DMaterial *mat = obj->material;
+    if(mat && (mat->textureA.texReference || mat->textureB.texReference)) {
+      t3d_model_state_set_lighting(&state, mat);
+      t3d_model_draw_material(mat, &state);
+      lastMat = NULL;
+    } else if(mat && entry->material != lastMat) {
+      draw_material_compiled(entry->material, mat, &conf, &state);
+      lastMat = entry->material;
+    }
+
+    if(entry->hasBones && conf.matrices) {
+      t3d_model_draw_object(obj, conf.matrices);
       continue;
     }
 
-    if(it.object->material) {
-      t3d_model_draw_material(it.object->material, &state);
+    if(!entry->block) {
+      rspq_block_begin();
+        t3d_model_draw_object(obj, NULL);
+      entry->block = rspq_block_end();
     }
-    t3d_model_draw_object(it.object, conf.matrices);
+    rspq_block_run(entry->block);
   }
 
   if(state.lastVertFXFunc != T3D_VERTEX_FX_NONE)t3d_state_set_vertex_fx(T3D_VERTEX_FX_NONE, 0, 0);
+  if(state.lastUnlit)t3d_light_set_enabled(true);
+}
+
+void t3d_model_free_compiled(T3DModel* model)
+{
+  T3DDrawCache *cache = model->drawCache;
+  if(!cache)return;
+
+  for(uint32_t m = 0; m < cache->materialCount; m++) {
+    if(cache->materials[m].block)rspq_block_free(cache->materials[m].block);
+  }
+  for(uint32_t o = 0; o < cache->objectCount; o++) {
+    if(cache->objects[o].block)rspq_block_free(cache->objects[o].block);
+  }
+  free(cache);
+  model->drawCache = NULL;
+}
+
+void t3d_model_draw_objects(T3DObject* const* objects, uint32_t count, T3DModelDrawConf conf)
+{
+  T3DModelState state = t3d_model_state_create();
+  state.drawConf = &conf;
+
+  for(uint32_t i = 0; i < count; i++) {
+    draw_object_with_state(objects[i], &conf, &state);
+  }
+
+  if(state.lastVertFXFunc != T3D_VERTEX_FX_NONE)t3d_state_set_vertex_fx(T3D_VERTEX_FX_NONE, 0, 0);
+  if(state.lastUnlit)t3d_light_set_enabled(true);
 }
 
 void t3d_model_draw_object(const T3DObject *object, const T3DMat4FP *boneMatrices)
+{
+  t3d_model_draw_object_culled(object, boneMatrices, NULL, NULL);
+}
+
+void t3d_model_draw_object_culled(const T3DObject *object, const T3DMat4FP *boneMatrices, const T3DVec3 *camPos, const T3DFrustum *frustum)
 {
   bool hadMatrixPush = false;
   for(uint32_t p = 0; p < object->numParts; p++)
   {
     const T3DObjectPart *part = &object->parts[p];
+    if(frustum && !t3d_frustum_vs_aabb_s16(frustum, part->aabbMin, part->aabbMax))continue;
+    if(camPos && t3d_model_part_is_backfacing(part, camPos))continue;
+
     hadMatrixPush = handle_bone_matrix(part, boneMatrices, hadMatrixPush);
 
     // load vertices, this will already do T&L (so matrices/fog/lighting must be set before)
@@ -330,6 +554,12 @@ void t3d_model_draw_object(const T3DObject *object, const T3DMat4FP *boneMatrice
   if(hadMatrixPush)t3d_matrix_pop(1);
 }
 
+static inline bool tile_settings_differ(const T3DMaterial *mat, const T3DModelState *state) {
+  // 's' and 't' are next to each other in both textures
+  return memcmp(&state->lastTileAxis[0], &mat->textureA.s, sizeof(T3DMaterialAxis) * 2) != 0
+      || memcmp(&state->lastTileAxis[2], &mat->textureB.s, sizeof(T3DMaterialAxis) * 2) != 0;
+}
+
 void t3d_model_draw_material(T3DMaterial *mat, T3DModelState *state)
 {
   if(!state) {
@@ -362,7 +592,8 @@ void t3d_model_draw_material(T3DMaterial *mat, T3DModelState *state)
   {
     bool setBlendMode  = state->lastBlendMode != mat->blendMode;
     bool setCC         = mat->colorCombiner != state->lastCC;
-    bool setTexture    = state->lastTextureHashA != mat->textureA.textureHash || state->lastTextureHashB != mat->textureB.textureHash;
+    bool setTexture    = state->lastTextureHashA != mat->textureA.textureHash || state->lastTextureHashB != mat->textureB.textureHash
+                      || tile_settings_differ(mat, state);
     bool setOtherMode  = state->lastOtherMode != mat->otherModeValue || setTexture;
     bool setPrimColor  = (mat->setColorFlags & 0b001) && color_to_packed32(state->lastPrimColor) != color_to_packed32(mat->primColor);
     bool setEnvColor   = (mat->setColorFlags & 0b010) && color_to_packed32(state->lastEnvColor) != color_to_packed32(mat->envColor);
@@ -377,6 +608,8 @@ void t3d_model_draw_material(T3DMaterial *mat, T3DModelState *state)
     {
       state->lastTextureHashA = mat->textureA.textureHash;
       state->lastTextureHashB = mat->textureB.textureHash;
+      memcpy(&state->lastTileAxis[0], &mat->textureA.s, sizeof(T3DMaterialAxis) * 2);
+      memcpy(&state->lastTileAxis[2], &mat->textureB.s, sizeof(T3DMaterialAxis) * 2);
       rdpq_sync_load();
 
       rdpq_tex_multi_begin();
@@ -423,6 +656,7 @@ void t3d_model_free(T3DModel *model) {
   if(model->userBlock) {
     rspq_block_free(model->userBlock);
   }
+  t3d_model_free_compiled(model);
 
   for(uint32_t c = 0; c < model->chunkCount; c++)
   {
@@ -430,11 +664,11 @@ void t3d_model_free(T3DModel *model) {
     if(chunkType == T3D_CHUNK_TYPE_MATERIAL) {
       T3DMaterial *mat = (T3DMaterial*)((char*)model + (model->chunkOffsets[c].offset & 0x00FFFFFF));
       if(mat->textureA.texture) {
-        texture_cache_free(mat->textureA.textureHash);
+        t3d_tex_cache_release(&textureCache, mat->textureA.textureHash);
         txtErased = true;
       }
       if(mat->textureB.texture) {
-        texture_cache_free(mat->textureB.textureHash);
+        t3d_tex_cache_release(&textureCache, mat->textureB.textureHash);
         txtErased = true;
       }
     }
@@ -444,29 +678,36 @@ void t3d_model_free(T3DModel *model) {
     }
   }
   free(model);
-  if(txtErased) texture_cache_free_mem();
+  if(txtErased)t3d_tex_cache_shrink(&textureCache);
 }
 
-T3DChunkAnim *t3d_model_get_animation(const T3DModel *model, const char *name) {
-  for(uint32_t i = 0; i < model->chunkCount; i++) {
-    if(model->chunkOffsets[i].type == T3D_CHUNK_TYPE_ANIM) {
-      uint32_t offset = model->chunkOffsets[i].offset & 0x00FFFFFF;
-      T3DChunkAnim *anim = (T3DChunkAnim*)((char*)model + offset);
-      if(strcmp(anim->name, name) == 0)return anim;
-    }
-  }
-  return NULL;
+void* t3d_tile_load_model(void *userData, const char *path) {
+  (void)userData;
+  return t3d_model_load(path);
 }
 
-T3DObject* t3d_model_get_object(const T3DModel *model, const char *name) {
-  for(uint32_t i = 0; i < model->chunkCount; i++) {
-    if(model->chunkOffsets[i].type == T3D_CHUNK_TYPE_OBJECT) {
-      uint32_t offset = model->chunkOffsets[i].offset & 0x00FFFFFF;
-      T3DObject *obj = (T3DObject*)((char*)model + offset);
-      if(obj->name && strcmp(obj->name, name) == 0)return obj;
+static void model_free_cb(void *model) {
+  t3d_model_free((T3DModel*)model);
+}
+
+void t3d_tile_free_model(void *userData, void *tile) {
+  (void)userData;
+  rspq_call_deferred(model_free_cb, tile);
+}
+
+void t3d_model_preload_textures(T3DModel *model) {
+  for(uint32_t c = 0; c < model->chunkCount; c++) {
+    if(model->chunkOffsets[c].type == T3D_CHUNK_TYPE_MATERIAL) {
+      T3DMaterial *mat = (T3DMaterial*)((char*)model + (model->chunkOffsets[c].offset & 0x00FFFFFF));
+      load_texture(&mat->textureA);
+      load_texture(&mat->textureB);
     }
   }
-  return NULL;
+}
+
+void t3d_model_set_texture_budget(uint32_t budget) {
+  t3d_tex_cache_set_budget(&textureCache, budget);
+  t3d_tex_cache_shrink(&textureCache);
 }
 
 void t3d_model_get_animations(const T3DModel *model, T3DChunkAnim **anims) {
@@ -479,17 +720,68 @@ void t3d_model_get_animations(const T3DModel *model, T3DChunkAnim **anims) {
   }
 }
 
-T3DMaterial *t3d_model_get_material(const T3DModel *model, const char *name) {
+uint32_t t3d_name_index_find(const T3DNameHash *entries, uint32_t count, uint32_t hash) {
+  uint32_t first = 0;
+  while(count > 0) {
+    uint32_t half = count / 2;
+    if(entries[first + half].hash < hash) {
+      first += half + 1;
+      count -= half + 1;
+    } else {
+      count = half;
+    }
+  }
+  return first;
+}
+
+static const char* get_chunk_name(void *chunk, char type) {
+  switch(type) {
+    case T3D_CHUNK_TYPE_OBJECT  : return ((T3DObject*)chunk)->name;
+    case T3D_CHUNK_TYPE_MATERIAL: return ((T3DMaterial*)chunk)->name;
+    case T3D_CHUNK_TYPE_ANIM    : return ((T3DChunkAnim*)chunk)->name;
+    default: return NULL;
+  }
+}
+
+static void* get_chunk_by_name(const T3DModel *model, char type, const char *name) {
+  const T3DChunkNameIndex *index = t3d_model_get_name_index(model);
+  if(index != NULL) {
+    uint32_t hash = t3d_name_hash(name);
+    for(uint32_t i = t3d_name_index_find(index->entries, index->count, hash); i < index->count; ++i) {
+      const T3DNameHash *entry = &index->entries[i];
+      if(entry->hash != hash)break;
+      if(entry->type != type || model->chunkOffsets[entry->index].type != type)continue; // may not be loaded
+
+      void *chunk = (char*)model + (model->chunkOffsets[entry->index].offset & 0x00FFFFFF);
+      const char *chunkName = get_chunk_name(chunk, type);
+      if(chunkName && strcmp(chunkName, name) == 0)return chunk;
+    }
+    return NULL;
+  }
+
+  // older files have no index, fall back to a scan
   for(uint32_t i = 0; i < model->chunkCount; i++) {
-    if(model->chunkOffsets[i].type == T3D_CHUNK_TYPE_MATERIAL) {
-      uint32_t offset = model->chunkOffsets[i].offset & 0x00FFFFFF;
-      T3DMaterial *mat = (T3DMaterial*)((char*)model + offset);
-      if(mat->name && strcmp(mat->name, name) == 0)return mat;
+    if(model->chunkOffsets[i].type == type) {
+      void *chunk = (char*)model + (model->chunkOffsets[i].offset & 0x00FFFFFF);
+      const char *chunkName = get_chunk_name(chunk, type);
+      if(chunkName && strcmp(chunkName, name) == 0)return chunk;
     }
   }
   return NULL;
 }
 
+T3DChunkAnim *t3d_model_get_animation(const T3DModel *model, const char *name) {
+  return get_chunk_by_name(model, T3D_CHUNK_TYPE_ANIM, name);
+}
+
+T3DObject* t3d_model_get_object(const T3DModel *model, const char *name) {
+  return get_chunk_by_name(model, T3D_CHUNK_TYPE_OBJECT, name);
+}
+
+T3DMaterial *t3d_model_get_material(const T3DModel *model, const char *name) {
+  return get_chunk_by_name(model, T3D_CHUNK_TYPE_MATERIAL, name);
+}
+
 bool t3d_model_iter_next(T3DModelIter *iter) {
   for(; iter->_idx < iter->_model->chunkCount; iter->_idx++) {
     if(iter->_model->chunkOffsets[iter->_idx].type == iter->_chunkType) {
@@ -503,36 +795,18 @@ bool t3d_model_iter_next(T3DModelIter *iter) {
   return false;
 }
 
-// context for functions below, this avoids blowing up the stack-sie
-static const T3DFrustum *ctxFrustum;
-static const T3DBvhData *ctxData;
-static uint32_t ctxBasePtr;
-
-static void bvh_query_node(const T3DBvhNode *node) {
-  int dataCount = node->value & 0b1111;
-  int offset = (int16_t)node->value >> 4;
-
-  if(dataCount == 0) {
-    if(t3d_frustum_vs_aabb_s16(ctxFrustum, node->aabbMin, node->aabbMax)) {
-      bvh_query_node(&node[offset]);
-      bvh_query_node(&node[offset + 1]);
-    }
-    return;
-  }
-
-  int offsetEnd = offset + dataCount;
-  while(offset < offsetEnd) {
-    T3DObject* obj = (T3DObject*)(ctxBasePtr - (ctxData[offset++].objectPtr << 2));
-    if(t3d_frustum_vs_aabb_s16(ctxFrustum, obj->aabbMin, obj->aabbMax)) {
-      obj->isVisible = true;
-    }
+const uint32_t* t3d_model_pvs_query(const T3DPvs *pvs, const T3DVec3 *pos)
+{
+  uint32_t cellIdx = 0;
+  uint32_t stride = 1;
+  float invCellSize = 1.0f / pvs->cellSize;
+  for(int i=0; i<3; ++i) {
+    float cellPos = (pos->v[i] - pvs->aabbMin[i]) * invCellSize;
+    if(cellPos < 0.0f || cellPos >= pvs->cellCount[i])return NULL;
+    cellIdx += (uint32_t)cellPos * stride;
+    stride *= pvs->cellCount[i];
   }
-}
 
-void t3d_model_bvh_query_frustum(const T3DBvh *bvh, const T3DFrustum *frustum) {
-  const T3DBvhData *data = (T3DBvhData*)&bvh->nodes[bvh->nodeCount]; // data starts right after nodes
-  ctxFrustum = frustum;
-  ctxData = data;
-  ctxBasePtr = (uint32_t)(char*)bvh;
-  bvh_query_node(bvh->nodes);
+  const uint32_t *rows = (const uint32_t*)((const char*)pvs + pvs->rowOffset);
+  return &rows[pvs->cellRows[cellIdx] * pvs->wordsPerRow];
 }
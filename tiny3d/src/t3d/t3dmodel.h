@@ -51,7 +51,7 @@ typedef struct {
 
   uint8_t _unused00_; // see: T3D_ALPHA_MODE_xxx
   uint8_t fogMode; // see: T3D_FOG_MODE_xxx
-  uint8_t setColorFlags;
+  uint8_t setColorFlags; // set prim/env/blend color, bit 3: unlit (lighting baked into vertex colors)
   uint8_t vertexFxFunc;
 
   color_t primColor;
@@ -73,6 +73,14 @@ typedef struct {
   uint16_t matrixIdx;
   uint8_t numStripIndices[4];
 
+  // normal cone (8-bit SNORM) and bounding sphere, used to cull parts where all triangles face away
+  int8_t coneAxis[3];
+  int8_t coneCutoff; // 127 if the part is never culled
+  int16_t sphereCenter[3];
+  uint16_t sphereRadius;
+  // bounds of the loaded vertices, covers the entire range for skinned parts (never culled)
+  int16_t aabbMin[3];
+  int16_t aabbMax[3];
 } T3DObjectPart;
 
 typedef struct {
@@ -83,7 +91,8 @@ typedef struct {
   // can be used freely by the user for recording, will be freed automatically by t3d
   rspq_block_t *userBlock;
   uint8_t isVisible; // set by culling checks, otherwise no effect on rendering
-  uint8_t _padding[3];
+  uint8_t _padding;
+  uint16_t index; // index of the object in the model, set at load time (e.g. used for PVS lookups)
   int16_t aabbMin[3];
   int16_t aabbMax[3];
 
@@ -100,9 +109,25 @@ typedef struct {
   uint16_t nodeCount;
   uint16_t dataCount;
   T3DBvhNode nodes[];
-  // uint16_t data[]; // T3DObject pointer, shifted by 3, relative to 'objectBasePtr'
+  // T3DBvhData data[]; // directly after the nodes
 } T3DBvh;
 
+typedef struct {
+  uint16_t objectPtr; // offset from the object to the BVH, shifted by 2 (set at load time)
+} T3DBvhData;
+
+typedef struct {
+  int16_t aabbMin[3]; // start of the cell-grid
+  uint16_t cellSize;
+  uint16_t cellCount[3];
+  uint16_t objectCount;
+  uint16_t rowCount;
+  uint16_t wordsPerRow;
+  uint32_t rowOffset; // offset of the visibility bitsets, relative to the start of this struct
+  uint16_t cellRows[]; // per cell, index into the bitsets
+  // uint32_t rows[rowCount][wordsPerRow]; // 1 bit per object
+} T3DPvs;
+
 typedef struct {
   char* name;
   uint16_t parentIdx;
@@ -112,10 +137,25 @@ typedef struct {
   T3DVec3 position;
 } T3DChunkBone;
 
+// Entry of a sorted name-hash index, see 't3d_name_index_find'
+typedef struct {
+  uint32_t hash; // hash of the name, see 't3d_name_hash'
+  uint16_t index; // chunk index, or bone index for skeletons
+  uint8_t type; // chunk type the name belongs to
+  uint8_t _padding;
+} T3DNameHash;
+
+typedef struct {
+  uint32_t count;
+  T3DNameHash entries[]; // sorted by hash
+} T3DChunkNameIndex;
+
 typedef struct {
   uint16_t boneCount;
-  uint16_t _reserved;
+  uint16_t hashCount; // bone-name hashes after the bones, 0 for older files
+  uint32_t signature; // hash of the bone names and hierarchy, independent of the order
   T3DChunkBone bones[];
+  // T3DNameHash hashes[hashCount]; // sorted by hash
 } T3DChunkSkeleton;
 
 typedef struct {
@@ -124,6 +164,8 @@ typedef struct {
   uint8_t attributeIdx;
   float quantScale;
   float quantOffset;
+  float tangentScale; // 0 for linear channels, otherwise scalar keyframes contain a tangent
+  float deltaScale; // scale of 8-bit delta keyframes, 0 if the channel has none
 } T3DAnimChannelMapping;
 
 typedef struct {
@@ -133,6 +175,11 @@ typedef struct {
   uint16_t channelsQuat;
   uint16_t channelsScalar;
   char* filePath;
+  uint32_t fileOffset; // start of the keyframe data in the file, shared by all animations of a model
+  uint32_t fileSize; // size of the keyframe data in bytes
+  uint32_t snapshotOffset; // start of the snapshots in the file, used for seeking
+  uint16_t snapshotCount;
+  uint16_t snapshotTicks; // interval between snapshots, in ticks (1/60s)
   T3DAnimChannelMapping channelMappings[];
 } T3DChunkAnim;
 
@@ -155,6 +202,7 @@ typedef struct {
 
   // can be used freely by the user for recording, will be freed automatically by t3d
   rspq_block_t *userBlock;
+  void* drawCache; // blocks recorded by 't3d_model_draw_compiled', set at runtime
 
   int16_t aabbMin[3];
   int16_t aabbMax[3];
@@ -176,6 +224,8 @@ typedef struct {
   char _chunkType;
 } T3DModelIter;
 
+#define T3D_BVH_MAX_FRUSTUMS 4
+
 // Types of chunks contained in T3DModel.
 enum T3DModelChunkType {
   T3D_CHUNK_TYPE_VERTICES = 'V',
@@ -184,7 +234,9 @@ enum T3DModelChunkType {
   T3D_CHUNK_TYPE_OBJECT   = 'O',
   T3D_CHUNK_TYPE_SKELETON = 'S',
   T3D_CHUNK_TYPE_ANIM     = 'A',
-  T3D_CHUNK_TYPE_BVH      = 'B'
+  T3D_CHUNK_TYPE_BVH      = 'B',
+  T3D_CHUNK_TYPE_PVS      = 'P',
+  T3D_CHUNK_TYPE_NAMES    = 'H'
 };
 
 /**
@@ -196,6 +248,27 @@ enum T3DModelChunkType {
  */
 T3DModel* t3d_model_load(const char *path);
 
+// Defines which parts of a model file get loaded, see 't3d_model_load_custom'
+typedef struct {
+  // chunk types to not load, e.g. "AB" for animations and the BVH (see T3D_CHUNK_TYPE_xxx).
+  // Objects, materials, vertices and indices are always needed.
+  // Without the skeleton ('S'), skinned objects can't be animated and are drawn in their resting pose.
+  // Without the name index ('H'), lookups by name fall back to a linear search.
+  const char* skipChunks;
+} T3DModelLoadConf;
+
+/**
+ * Loads a model from a file, but only the chunks needed by the caller.
+ * This first reads the header and chunk-table, and then only the data of the requested chunks,
+ * so unused data (e.g. animations or the BVH) never take up any memory.
+ * Skipped chunks are treated as if the file never contained them.
+ *
+ * @param path FS path
+ * @param conf load settings
+ * @return pointer to the model (that you now own)
+ */
+T3DModel* t3d_model_load_custom(const char *path, T3DModelLoadConf conf);
+
 // callback for custom drawing, this hooks into the tile-setting section
 typedef void (*T3DModelTileCb)(void* userData, rdpq_texparms_t *tileParams, rdpq_tile_t tile);
 typedef bool (*T3DModelFilterCb)(void* userData, const T3DObject *obj);
@@ -210,6 +283,8 @@ typedef struct {
   T3DModelFilterCb filterCb; // callback to filter parts
   T3DModelDynTextureCb dynTextureCb; // callback to set dynamic textures, aka "Texture Reference" in fast64
   const T3DMat4FP *matrices;
+  const T3DVec3 *camPos; // camera position in model space, skips back-facing parts if set (ignored for recorded objects)
+  const T3DFrustum *frustum; // frustum in model space, skips parts outside of it if set (ignored for recorded objects)
 } T3DModelDrawConf;
 
 /**
@@ -219,6 +294,7 @@ typedef struct {
 typedef struct {
   uint32_t lastTextureHashA;
   uint32_t lastTextureHashB;
+  T3DMaterialAxis lastTileAxis[4]; // s/t of both textures, the same texture can be used with different settings
   uint8_t lastFogMode;
   uint32_t lastRenderFlags;
   uint64_t lastCC;
@@ -229,6 +305,7 @@ typedef struct {
   uint16_t lastUvGenParams[2];
   uint64_t lastOtherMode;
   uint32_t lastBlendMode;
+  bool lastUnlit; // lighting is disabled for a material with baked lighting
   T3DModelDrawConf* drawConf; // @TODO: legacy, remove at some point
 } T3DModelState;
 
@@ -252,14 +329,79 @@ static inline T3DModelState t3d_model_state_create() {
  */
 void t3d_model_free(T3DModel* model);
 
+/**
+ * Load callback for 'T3DTileStreamer' (see t3dtiles.h), loads each tile as a model.
+ * @param userData unused
+ * @param path path of the tile
+ * @return model
+ */
+void* t3d_tile_load_model(void *userData, const char *path);
+
+/**
+ * Free callback for 'T3DTileStreamer' (see t3dtiles.h).
+ * Freeing is deferred until the RSP is done with the commands queued so far, since it may still draw the tile.
+ * @param userData unused
+ * @param tile model to free
+ */
+void t3d_tile_free_model(void *userData, void *tile);
+
+/**
+ * Loads all textures of a model now, instead of on the first draw.
+ * This avoids loading files in the middle of a frame, e.g. when a model appears during gameplay.
+ * @param model
+ */
+void t3d_model_preload_textures(T3DModel* model);
+
+/**
+ * Sets the memory budget for textures, which are shared by all models.
+ * By default (0), a texture is freed as soon as no model uses it anymore.
+ * With a budget, unused textures are kept around in case a model using them is loaded again.
+ * Once all textures exceed the budget, the least recently used ones that are unused get freed.
+ * @param budget size in bytes
+ */
+void t3d_model_set_texture_budget(uint32_t budget);
+
 /**
  * Draws a model with a custom configuration.
  * This call can be recorded into a display list.
+ * Note: materials with baked lighting disable lighting while drawn, a recording then restores
+ * the lights set at the time of recording (see 't3d_light_set_enabled').
  * @param model model to draw
  * @param conf custom configuration
  */
 void t3d_model_draw_custom(const T3DModel* model, T3DModelDrawConf conf);
 
+/**
+ * Draws a model like 't3d_model_draw_custom', but re-uses recorded blocks for static objects and materials.\n
+ * On the first draw, the mesh of each object and each material get recorded into their own block.\n
+ * Later draws then only run these blocks instead of emitting all commands again, saving CPU time.\n
+ * Skinned objects (if 'conf.matrices' is set) and materials with dynamic textures are still drawn as usual.\n
+ * A material gets recorded again if any of its settings or the tile callback / user-data of 'conf' changed.\n
+ * Blocks are freed together with the model, see 't3d_model_free_compiled' to free them earlier.\n
+ *
+ * NOTE: this records blocks by itself, so it can't be called while recording a block.
+ * @param model model to draw
+ * @param conf custom configuration
+ */
+void t3d_model_draw_compiled(T3DModel* model, T3DModelDrawConf conf);
+
+/**
+ * Frees all blocks recorded by 't3d_model_draw_compiled', the next draw will record them again.
+ * This is needed after changing vertices or indices of the model.
+ * Make sure the RSP is no longer using them (e.g. via 'rspq_wait').
+ * @param model
+ */
+void t3d_model_free_compiled(T3DModel* model);
+
+/**
+ * Draws a list of objects, e.g. the result of 't3d_model_bvh_query_frustum_list'.
+ * This behaves like 't3d_model_draw_custom', but only for the given objects.
+ * @param objects list of objects to draw
+ * @param count number of objects
+ * @param conf draw configuration
+ */
+void t3d_model_draw_objects(T3DObject* const* objects, uint32_t count, T3DModelDrawConf conf);
+
 /**
  * Draws a model with default settings.
  * This call can be recorded into a display list.
@@ -285,6 +427,65 @@ static inline void t3d_model_draw(const T3DModel* model) {
  */
 void t3d_model_draw_object(const T3DObject *object, const T3DMat4FP *boneMatrices);
 
+/**
+ * Same as 't3d_model_draw_object', but skips parts that are outside the frustum,
+ * or where all triangles face away from the camera.\n
+ * This avoids loading their vertices and indices entirely, which is useful for large objects and closed meshes.\n
+ * Both the camera position and frustum must be in model space (e.g. transformed by the inverse of the model matrix),
+ * and for back-face checks the model matrix must not be mirrored.\n
+ * Skinned parts are never culled.\n
+ * Since the result depends on the camera, this should not be recorded into a block.
+ *
+ * @param object object to draw
+ * @param boneMatrices matrices in the case of skinned meshes, set to NULL for non-skinned
+ * @param camPos camera position in model space, NULL to skip back-face checks
+ * @param frustum frustum in model space, NULL to skip frustum checks
+ */
+void t3d_model_draw_object_culled(const T3DObject *object, const T3DMat4FP *boneMatrices, const T3DVec3 *camPos, const T3DFrustum *frustum);
+
+/**
+ * Checks if all triangles of a part face away from a given position, using the normal cone of the part.
+ * @param part part to check
+ * @param camPos camera position in model space
+ * @return true if the part can be skipped
+ */
+static inline bool t3d_model_part_is_backfacing(const T3DObjectPart *part, const T3DVec3 *camPos) {
+  if(part->coneCutoff == 127)return false;
+
+  T3DVec3 dir = {{
+    part->sphereCenter[0] - camPos->v[0],
+    part->sphereCenter[1] - camPos->v[1],
+    part->sphereCenter[2] - camPos->v[2]
+  }};
+  T3DVec3 axis = {{(float)part->coneAxis[0], (float)part->coneAxis[1], (float)part->coneAxis[2]}};
+  // all values are scaled by 127 here to avoid converting the SNORM values
+  return t3d_vec3_dot(&dir, &axis) >= part->coneCutoff * t3d_vec3_len(&dir) + part->sphereRadius * 127.0f;
+}
+
+/**
+ * Checks if a material has lighting baked into its vertex colors (see '--bake-light' in the importer).
+ * @param mat material to check
+ * @return true if no lights should be applied
+ */
+static inline bool t3d_model_material_is_unlit(const T3DMaterial *mat) {
+  return mat->setColorFlags & 0b1000;
+}
+
+/**
+ * Disables lighting for materials with baked lighting, and enables it again for the next lit one.
+ * This is done by the draw functions between materials, and is never part of a recorded material block.
+ * Once done drawing, lighting must be enabled again if 'state->lastUnlit' is set.
+ * @param state draw state
+ * @param mat material about to be drawn
+ */
+static inline void t3d_model_state_set_lighting(T3DModelState *state, const T3DMaterial *mat) {
+  bool unlit = t3d_model_material_is_unlit(mat);
+  if(unlit != state->lastUnlit) {
+    t3d_light_set_enabled(!unlit);
+    state->lastUnlit = unlit;
+  }
+}
+
 /**
  * Draws/Applies a material of an object. This can be called before 't3d_model_draw_object'.\n
  * This will set up the texture, CC, and other RDP and t3d settings of the material.\n
@@ -332,6 +533,52 @@ static inline const T3DChunkSkeleton* t3d_model_get_skeleton(const T3DModel *mod
   return NULL;
 }
 
+/**
+ * Hashes a name the same way as the model converter does for the name indices.
+ * @param name null-terminated string
+ * @return hash
+ */
+static inline uint32_t t3d_name_hash(const char *name) {
+  uint32_t hash = 0x7E81C0E9;
+  for(; *name; ++name) {
+    hash = (hash >> 8) ^ (hash << 24) ^ (uint32_t)(int32_t)(int8_t)*name;
+  }
+  return hash;
+}
+
+/**
+ * Searches a sorted name-hash index.
+ * Since different names can share a hash, all entries starting at the returned index
+ * with a matching hash need to be checked against the actual name.
+ * @param entries sorted entries
+ * @param count number of entries
+ * @param hash hash to search for
+ * @return index of the first entry with a hash >= 'hash', or 'count' if none
+ */
+uint32_t t3d_name_index_find(const T3DNameHash *entries, uint32_t count, uint32_t hash);
+
+/**
+ * Returns the name index of a model, used to look up objects, materials and animations by name.
+ * This is always the last chunk, so no search is needed.
+ * @param model model
+ * @return pointer to the index or NULL if the model has none (older files)
+ */
+static inline const T3DChunkNameIndex* t3d_model_get_name_index(const T3DModel *model) {
+  if(model->chunkCount == 0)return NULL;
+  const T3DChunkOffset *chunk = &model->chunkOffsets[model->chunkCount - 1];
+  if(chunk->type != T3D_CHUNK_TYPE_NAMES)return NULL;
+  return (const T3DChunkNameIndex*)((char*)model + (chunk->offset & 0x00FFFFFF));
+}
+
+/**
+ * Returns the sorted bone-name hashes of a skeleton, stored after the bones.
+ * @param skel skeleton
+ * @return pointer to 'skel->hashCount' entries
+ */
+static inline const T3DNameHash* t3d_skeleton_chunk_get_hashes(const T3DChunkSkeleton *skel) {
+  return (const T3DNameHash*)&skel->bones[skel->boneCount];
+}
+
 /**
  * Returns the number of animations in the model.
  * @param model
@@ -464,6 +711,136 @@ static inline const T3DBvh* t3d_model_bvh_get(const T3DModel *model) {
  */
 void t3d_model_bvh_query_frustum(const T3DBvh *bvh, const T3DFrustum *frustum);
 
+/**
+ * Queries the BVH of a model with a frustum, writing all visible objects into a list.
+ * In contrast to 't3d_model_bvh_query_frustum', this will not modify the model,
+ * so the same model can be queried multiple times (e.g. for split-screen).
+ * The list is sorted in the same order as objects appear in the model,
+ * and can be drawn via 't3d_model_draw_objects'.
+ *
+ * @param bvh BVH to check
+ * @param frustum frustum to check against
+ * @param objects output list, should be able to hold 'bvh->dataCount' entries
+ * @param maxObjects size of 'objects', any further visible objects are ignored
+ * @return number of objects written to 'objects'
+ */
+uint32_t t3d_model_bvh_query_frustum_list(const T3DBvh *bvh, const T3DFrustum *frustum, T3DObject **objects, uint32_t maxObjects);
+
+/**
+ * Same as 't3d_model_bvh_query_frustum_list', but additionally skips all objects
+ * not set in a visibility set (see 't3d_model_pvs_query').
+ *
+ * @param bvh BVH to check
+ * @param frustum frustum to check against
+ * @param pvsRow visibility set of the current cell, if NULL all objects are considered visible
+ * @param objects output list, should be able to hold 'bvh->dataCount' entries
+ * @param maxObjects size of 'objects', any further visible objects are ignored
+ * @return number of objects written to 'objects'
+ */
+uint32_t t3d_model_bvh_query_frustum_pvs(const T3DBvh *bvh, const T3DFrustum *frustum, const uint32_t *pvsRow, T3DObject **objects, uint32_t maxObjects);
+
+/**
+ * Queries the BVH with multiple frustums at once (e.g. for split-screen).
+ * The tree is only traversed once, and each visible object gets a bitmask of the frustums it is visible in.
+ * The returned list contains every object visible in at least one frustum, sorted like in the model.
+ * Use 't3d_model_objects_filter_viewport' to get the list of a single frustum from it.
+ *
+ * @param bvh BVH to check
+ * @param frustums array of frustums to check against
+ * @param pvsRows optional array of visibility sets per frustum (see 't3d_model_pvs_query'), may be NULL
+ * @param frustumCount number of frustums, up to 'T3D_BVH_MAX_FRUSTUMS'
+ * @param viewportMasks output masks indexed by 'T3DObject.index', bit N is set if visible in frustum N.
+ *                      Should be able to hold 'bvh->dataCount' entries, only entries for returned objects are written.
+ * @param objects output list, should be able to hold 'bvh->dataCount' entries
+ * @param maxObjects size of 'objects', any further visible objects are ignored
+ * @return number of objects written to 'objects'
+ */
+uint32_t t3d_model_bvh_query_frustums(
+  const T3DBvh *bvh, const T3DFrustum *frustums, const uint32_t* const* pvsRows, uint32_t frustumCount,
+  uint8_t *viewportMasks, T3DObject **objects, uint32_t maxObjects
+);
+
+/**
+ * Builds the object list of a single frustum from the result of 't3d_model_bvh_query_frustums'.
+ * This does not traverse the BVH again, and keeps the order of the input list.
+ *
+ * @param objects list of objects returned by 't3d_model_bvh_query_frustums'
+ * @param count number of objects
+ * @param viewportMasks masks returned by 't3d_model_bvh_query_frustums'
+ * @param viewport frustum index to get the list for
+ * @param out output list, must be able to hold 'count' entries
+ * @return number of objects written to 'out'
+ */
+uint32_t t3d_model_objects_filter_viewport(
+  T3DObject* const* objects, uint32_t count, const uint8_t *viewportMasks, uint32_t viewport, T3DObject **out
+);
+
+/**
+ * Checks if a material blends with the framebuffer (e.g. alpha-blending), these must be drawn back-to-front.
+ * @param mat material, can be NULL
+ * @return true if transparent
+ */
+static inline bool t3d_model_material_is_transparent(const T3DMaterial *mat) {
+  return mat && (mat->blendMode & SOM_READ_ENABLE);
+}
+
+/**
+ * Sorts the transparent objects in a list back-to-front, meant to be called each frame before drawing.
+ * The depth is the distance of the AABB center along the view direction, transparent objects are moved
+ * to the end of the list, while opaque ones keep their order (e.g. from 't3d_model_bvh_query_frustum_list').\n
+ * This uses a radix sort on the quantized depth, objects with the same depth keep their order.
+ * No memory is allocated, instead 'tmp' and 'tmpKeys' are used as scratch buffers.
+ *
+ * @param objects list of objects, sorted in place
+ * @param count number of objects, at most 65536
+ * @param camPos camera position in model space
+ * @param camDir normalized view direction in model space
+ * @param tmp scratch buffer, must be able to hold 'count' entries
+ * @param tmpKeys scratch buffer for the depth keys, must be able to hold '2 * count' entries
+ * @return number of opaque objects, aka. the index of the first transparent one
+ */
+uint32_t t3d_model_objects_sort_transparent(
+  T3DObject **objects, uint32_t count, const T3DVec3 *camPos, const T3DVec3 *camDir, T3DObject **tmp, uint32_t *tmpKeys
+);
+
+/**
+ * Returns the potentially-visible-set (PVS) of a model if it has one.
+ * Note that this is optional and may return NULL.
+ * To create one, pass '--pvs' (and optionally '--pvs-cell=<size>') to the gltf importer.
+ * @param model model
+ * @return pointer to the PVS or NULL if not found
+ */
+static inline const T3DPvs* t3d_model_pvs_get(const T3DModel *model) {
+  for(uint32_t i = 0; i < model->chunkCount; i++) {
+    if(model->chunkOffsets[i].type == T3D_CHUNK_TYPE_PVS) {
+      uint32_t offset = model->chunkOffsets[i].offset & 0x00FFFFFF;
+      return (T3DPvs*)((char*)model + offset);
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Looks up the visibility set for a given position (e.g. the camera).
+ * The returned bitset has one bit per object, indexed by 'T3DObject.index'.
+ * If the position is outside the grid, NULL is returned, which should be treated as "all visible".
+ *
+ * @param pvs PVS of the model
+ * @param pos position to check (model space)
+ * @return bitset of potentially visible objects, or NULL
+ */
+const uint32_t* t3d_model_pvs_query(const T3DPvs *pvs, const T3DVec3 *pos);
+
+/**
+ * Checks if an object is set in a visibility set returned by 't3d_model_pvs_query'.
+ * @param pvsRow visibility set, NULL counts as visible
+ * @param object object to check
+ * @return true if potentially visible
+ */
+static inline bool t3d_model_pvs_is_visible(const uint32_t *pvsRow, const T3DObject *object) {
+  return !pvsRow || (pvsRow[object->index >> 5] & (1u << (object->index & 31)));
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,133 @@
+/**
+* @copyright 2024 - Max Bebök
+* @license MIT
+*/
+
+#include <stdlib.h>
+#include "t3dqueue.h"
+
+#define MIN_CAPACITY 32
+
+typedef struct {
+  T3DModelState state;
+  const T3DMaterial *lastMaterial;
+  const T3DMat4FP *lastMatrix;
+  bool hadMatrixPush;
+} T3DQueueDrawState;
+
+// folds a value into the given amount of bits, equal values always give the same result
+static inline uint64_t fold_bits(uint64_t value, int bits) {
+  value ^= value >> 29;
+  value *= 0x9E3779B97F4A7C15ull;
+  return value >> (64 - bits);
+}
+
+uint64_t t3d_render_queue_get_key(const T3DMaterial *mat) {
+  if(!mat)return 0;
+  uint64_t texHashes = ((uint64_t)mat->textureA.textureHash << 32) | mat->textureB.textureHash;
+  return (fold_bits(mat->blendMode, 8) << 56)
+       | (fold_bits(texHashes, 24) << 32)
+       | (fold_bits(mat->colorCombiner, 16) << 16)
+       | fold_bits(mat->otherModeValue, 16);
+}
+
+static T3DRenderItem* push_item(T3DRenderItem **items, uint32_t *count, uint32_t *capacity) {
+  if(*count >= *capacity) {
+    *capacity = *capacity ? (*capacity * 2) : MIN_CAPACITY;
+    T3DRenderItem *newItems = realloc(*items, sizeof(T3DRenderItem) * *capacity);
+    assertf(newItems, "Render queue: out of memory (%lu items)", *capacity);
+    *items = newItems;
+  }
+  return &(*items)[(*count)++];
+}
+
+void t3d_render_queue_init(T3DRenderQueue *queue) {
+  *queue = (T3DRenderQueue){};
+}
+
+void t3d_render_queue_add_object(T3DRenderQueue *queue, T3DObject *object, const T3DMat4FP *matrix, const T3DMat4FP *boneMatrices) {
+  T3DRenderItem *item = t3d_model_material_is_transparent(object->material)
+    ? push_item(&queue->itemsTransp, &queue->countTransp, &queue->capacityTransp)
+    : push_item(&queue->items, &queue->count, &queue->capacity);
+
+  *item = (T3DRenderItem){
+    .sortKey = t3d_render_queue_get_key(object->material),
+    .object = object,
+    .matrix = matrix,
+    .boneMatrices = boneMatrices,
+    .order = queue->count + queue->countTransp,
+  };
+}
+
+void t3d_render_queue_add_model(T3DRenderQueue *queue, const T3DModel *model, const T3DMat4FP *matrix, const T3DMat4FP *boneMatrices) {
+  T3DModelIter it = t3d_model_iter_create(model, T3D_CHUNK_TYPE_OBJECT);
+  while(t3d_model_iter_next(&it)) {
+    t3d_render_queue_add_object(queue, it.object, matrix, boneMatrices);
+  }
+}
+
+static int compare_items(const void *a, const void *b) {
+  const T3DRenderItem *itemA = (const T3DRenderItem*)a;
+  const T3DRenderItem *itemB = (const T3DRenderItem*)b;
+  if(itemA->sortKey != itemB->sortKey)return itemA->sortKey < itemB->sortKey ? -1 : 1;
+  // same key, keep objects of the same material together, then the submission order
+  if(itemA->object->material != itemB->object->material) {
+    return (uintptr_t)itemA->object->material < (uintptr_t)itemB->object->material ? -1 : 1;
+  }
+  return (int)itemA->order - (int)itemB->order;
+}
+
+void t3d_render_queue_sort(T3DRenderQueue *queue) {
+  qsort(queue->items, queue->count, sizeof(T3DRenderItem), compare_items);
+}
+
+static void draw_item(const T3DRenderItem *item, T3DQueueDrawState *drawState) {
+  if(item->matrix != drawState->lastMatrix) {
+    if(item->matrix) {
+      if(drawState->hadMatrixPush) {
+        t3d_matrix_set(item->matrix, true);
+      } else {
+        t3d_matrix_push(item->matrix);
+      }
+      drawState->hadMatrixPush = true;
+    } else if(drawState->hadMatrixPush) {
+      t3d_matrix_pop(1);
+      drawState->hadMatrixPush = false;
+    }
+    drawState->lastMatrix = item->matrix;
+  }
+
+  T3DMaterial *mat = item->object->material;
+  if(mat && mat != drawState->lastMaterial) {
+    t3d_model_state_set_lighting(&drawState->state, mat);
+    t3d_model_draw_material(mat, &drawState->state);
+    drawState->lastMaterial = mat;
+  }
+  t3d_model_draw_object(item->object, item->boneMatrices);
+}
+
+void t3d_render_queue_draw(T3DRenderQueue *queue, T3DModelDrawConf conf) {
+  t3d_render_queue_sort(queue);
+
+  T3DQueueDrawState drawState = {
+    .state = t3d_model_state_create(),
+  };
+  drawState.state.drawConf = &conf;
+
+  for(uint32_t i = 0; i < queue->count; ++i) {
+    draw_item(&queue->items[i], &drawState);
+  }
+  for(uint32_t i = 0; i < queue->countTransp; ++i) {
+    draw_item(&queue->itemsTransp[i], &drawState);
+  }
+
+  if(drawState.hadMatrixPush)t3d_matrix_pop(1);
+  if(drawState.state.lastVertFXFunc != T3D_VERTEX_FX_NONE)t3d_state_set_vertex_fx(T3D_VERTEX_FX_NONE, 0, 0);
+  if(drawState.state.lastUnlit)t3d_light_set_enabled(true);
+}
+
+void t3d_render_queue_destroy(T3DRenderQueue *queue) {
+  free(queue->items);
+  free(queue->itemsTransp);
+  *queue = (T3DRenderQueue){};
+}
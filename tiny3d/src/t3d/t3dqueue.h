@@ -0,0 +1,105 @@
+/**
+* @copyright 2024 - Max Bebök
+* @license MIT
+*/
+#ifndef TINY3D_T3DQUEUE_H
+#define TINY3D_T3DQUEUE_H
+
+#include "t3dmodel.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// Single object submitted to a render queue
+typedef struct {
+  uint64_t sortKey; // see 't3d_render_queue_get_key'
+  T3DObject *object;
+  const T3DMat4FP *matrix; // model matrix, NULL to draw with the current matrix
+  const T3DMat4FP *boneMatrices; // for skinned objects, NULL otherwise
+  uint32_t order; // submission order, keeps sorting stable
+} T3DRenderItem;
+
+/**
+ * Collects objects of many models during a frame, to draw them in an order that minimizes state changes.
+ * Opaque objects are sorted by their material, transparent ones are drawn afterwards in the order they were added.
+ * All objects are drawn with a single state, so textures, combiner etc. are only set if they change between objects.
+ */
+typedef struct {
+  T3DRenderItem *items; // opaque objects
+  T3DRenderItem *itemsTransp; // transparent objects
+  uint32_t count;
+  uint32_t countTransp;
+  uint32_t capacity;
+  uint32_t capacityTransp;
+} T3DRenderQueue;
+
+/**
+ * Initializes an empty queue, memory is allocated as objects are added.
+ * @param queue
+ */
+void t3d_render_queue_init(T3DRenderQueue *queue);
+
+/**
+ * Builds the sort key of a material.
+ * The most expensive state changes are stored in the highest bits (blend mode, then textures, combiner and othermode).
+ * Different materials can end up with the same key, this only affects the order but not the result.
+ * @param mat material, NULL for objects without one
+ * @return sort key
+ */
+uint64_t t3d_render_queue_get_key(const T3DMaterial *mat);
+
+/**
+ * Adds a single object to the queue.
+ * Pointers are only stored, so they must stay valid until the queue is drawn.
+ * @param queue
+ * @param object object to draw
+ * @param matrix model matrix, NULL to use the current matrix
+ * @param boneMatrices bone matrices for skinned objects, NULL otherwise
+ */
+void t3d_render_queue_add_object(T3DRenderQueue *queue, T3DObject *object, const T3DMat4FP *matrix, const T3DMat4FP *boneMatrices);
+
+/**
+ * Adds all objects of a model to the queue.
+ * @param queue
+ * @param model model to draw
+ * @param matrix model matrix, NULL to use the current matrix
+ * @param boneMatrices bone matrices for skinned models, NULL otherwise
+ */
+void t3d_render_queue_add_model(T3DRenderQueue *queue, const T3DModel *model, const T3DMat4FP *matrix, const T3DMat4FP *boneMatrices);
+
+/**
+ * Sorts opaque objects by their key, this is already done by 't3d_render_queue_draw'.
+ * @param queue
+ */
+void t3d_render_queue_sort(T3DRenderQueue *queue);
+
+/**
+ * Sorts and draws all objects, first opaque then transparent ones.
+ * The queue is not cleared, so it can be drawn multiple times (e.g. for split-screen).
+ * @param queue
+ * @param conf draw configuration used for all objects, 'filterCb' and 'matrices' are ignored
+ */
+void t3d_render_queue_draw(T3DRenderQueue *queue, T3DModelDrawConf conf);
+
+/**
+ * Removes all objects, memory is kept for the next frame.
+ * @param queue
+ */
+static inline void t3d_render_queue_clear(T3DRenderQueue *queue) {
+  queue->count = 0;
+  queue->countTransp = 0;
+}
+
+/**
+ * Frees the memory of the queue.
+ * @param queue
+ */
+void t3d_render_queue_destroy(T3DRenderQueue *queue);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TINY3D_T3DQUEUE_H
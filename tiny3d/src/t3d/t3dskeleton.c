@@ -4,6 +4,24 @@
 */
 #include "t3dskeleton.h"
 
+int t3d_skeleton_chunk_find_bone(const T3DChunkSkeleton *skel, const char *name) {
+  if(skel->hashCount != 0) {
+    const T3DNameHash *hashes = t3d_skeleton_chunk_get_hashes(skel);
+    uint32_t hash = t3d_name_hash(name);
+    for(uint32_t i = t3d_name_index_find(hashes, skel->hashCount, hash); i < skel->hashCount; ++i) {
+      if(hashes[i].hash != hash)break;
+      if(strcmp(skel->bones[hashes[i].index].name, name) == 0)return hashes[i].index;
+    }
+    return -1;
+  }
+
+  // older files have no hashes, fall back to a scan
+  for(int i = 0; i < skel->boneCount; i++) {
+    if(strcmp(skel->bones[i].name, name) == 0)return i;
+  }
+  return -1;
+}
+
 T3DSkeleton t3d_skeleton_create_buffered(const T3DModel *model, int bufferCount) {
   const T3DChunkSkeleton *skelRef = t3d_model_get_skeleton(model);
   assert(skelRef != NULL);
@@ -58,6 +76,119 @@ void t3d_skeleton_blend(const T3DSkeleton *skelRes, const T3DSkeleton *skelA, co
   }
 }
 
+// returns the next bone index in a mask after 'idx', or -1 if there is none. A NULL mask contains all bones
+static inline int32_t mask_next_bone(const T3DBoneMask *mask, int32_t idx, int32_t boneCount) {
+  ++idx;
+  if(!mask)return idx < boneCount ? idx : -1;
+
+  while(idx < boneCount) {
+    uint32_t word = mask->bits[idx / 32] >> (idx % 32);
+    if(word)return idx + __builtin_ctz(word);
+    idx = (idx + 32) & ~31;
+  }
+  return -1;
+}
+
+void t3d_skeleton_blend_masked(T3DSkeleton *skelRes, const T3DSkeleton *skelLayer, const T3DBoneMask *mask, float factor) {
+  int32_t boneCount = skelRes->skeletonRef->boneCount;
+  for(int32_t i = mask_next_bone(mask, -1, boneCount); i >= 0; i = mask_next_bone(mask, i, boneCount)) {
+    T3DBone *boneRes = &skelRes->bones[i];
+    const T3DBone *boneLayer = &skelLayer->bones[i];
+
+    t3d_quat_nlerp(&boneRes->rotation, &boneRes->rotation, &boneLayer->rotation, factor);
+    t3d_vec3_lerp(&boneRes->position, &boneRes->position, &boneLayer->position, factor);
+    t3d_vec3_lerp(&boneRes->scale, &boneRes->scale, &boneLayer->scale, factor);
+    boneRes->hasChanged = true;
+  }
+}
+
+void t3d_skeleton_add_masked(T3DSkeleton *skelRes, const T3DSkeleton *skelLayer, const T3DBoneMask *mask, float factor) {
+  int32_t boneCount = skelRes->skeletonRef->boneCount;
+  const T3DQuat quatIdent = {{0, 0, 0, 1}};
+
+  for(int32_t i = mask_next_bone(mask, -1, boneCount); i >= 0; i = mask_next_bone(mask, i, boneCount)) {
+    T3DBone *boneRes = &skelRes->bones[i];
+    const T3DBone *boneLayer = &skelLayer->bones[i];
+    const T3DChunkBone *boneDef = &skelRes->skeletonRef->bones[i];
+
+    // rotation relative to the resting pose, scaled by the factor
+    T3DQuat restInv = {{-boneDef->rotation.v[0], -boneDef->rotation.v[1], -boneDef->rotation.v[2], boneDef->rotation.v[3]}};
+    T3DQuat layerRot = boneLayer->rotation;
+    T3DQuat diff, tmp;
+    t3d_quat_mul(&diff, &restInv, &layerRot);
+    t3d_quat_nlerp(&diff, &quatIdent, &diff, factor);
+    t3d_quat_mul(&tmp, &boneRes->rotation, &diff);
+    boneRes->rotation = tmp;
+
+    for(int a=0; a<3; ++a) {
+      boneRes->position.v[a] += (boneLayer->position.v[a] - boneDef->position.v[a]) * factor;
+      boneRes->scale.v[a] += (boneLayer->scale.v[a] - boneDef->scale.v[a]) * factor;
+    }
+    boneRes->hasChanged = true;
+  }
+}
+
+void t3d_skeleton_apply_layers(T3DSkeleton *skelRes, const T3DPoseLayer *layers, uint32_t layerCount) {
+  for(uint32_t l = 0; l < layerCount; ++l) {
+    const T3DPoseLayer *layer = &layers[l];
+    if(layer->weight == 0.0f)continue;
+
+    if(layer->isAdditive) {
+      t3d_skeleton_add_masked(skelRes, layer->pose, layer->mask, layer->weight);
+    } else {
+      t3d_skeleton_blend_masked(skelRes, layer->pose, layer->mask, layer->weight);
+    }
+  }
+}
+
+T3DBoneMask t3d_bone_mask_create(const T3DSkeleton *skeleton) {
+  uint16_t wordCount = (skeleton->skeletonRef->boneCount + 31) / 32;
+  return (T3DBoneMask){
+    .bits = calloc(wordCount, sizeof(uint32_t)),
+    .boneCount = skeleton->skeletonRef->boneCount,
+    .wordCount = wordCount,
+  };
+}
+
+void t3d_bone_mask_set_subtree(T3DBoneMask *mask, const T3DSkeleton *skeleton, uint32_t boneIdx, bool isSet) {
+  assertf(boneIdx < mask->boneCount, "Invalid bone index: %lu", boneIdx);
+  const T3DChunkBone *bones = skeleton->skeletonRef->bones;
+
+  // bones are stored depth-first, so all children follow their parent until the depth is back at the same level
+  uint32_t depth = bones[boneIdx].depth;
+  for(uint32_t i = boneIdx; i < mask->boneCount; ++i) {
+    if(i != boneIdx && bones[i].depth <= depth)break;
+    if(isSet) {
+      mask->bits[i / 32] |= 1u << (i % 32);
+    } else {
+      mask->bits[i / 32] &= ~(1u << (i % 32));
+    }
+  }
+}
+
+bool t3d_bone_mask_set_subtree_by_name(T3DBoneMask *mask, const T3DSkeleton *skeleton, const char *name, bool isSet) {
+  int idx = t3d_skeleton_chunk_find_bone(skeleton->skeletonRef, name);
+  if(idx < 0)return false;
+  t3d_bone_mask_set_subtree(mask, skeleton, idx, isSet);
+  return true;
+}
+
+void t3d_bone_mask_invert(T3DBoneMask *mask) {
+  for(uint32_t w = 0; w < mask->wordCount; ++w) {
+    mask->bits[w] = ~mask->bits[w];
+  }
+  // keep bits past the last bone cleared, iterating masks relies on that
+  uint32_t lastBits = mask->boneCount % 32;
+  if(lastBits)mask->bits[mask->wordCount - 1] &= (1u << lastBits) - 1;
+}
+
+void t3d_bone_mask_destroy(T3DBoneMask *mask) {
+  if(mask->bits != NULL) {
+    free(mask->bits);
+    mask->bits = NULL;
+  }
+}
+
 void t3d_skeleton_update(T3DSkeleton *skeleton)
 {
   int updateLevel = -1;
@@ -98,12 +229,7 @@ void t3d_skeleton_update(T3DSkeleton *skeleton)
 }
 
 int t3d_skeleton_find_bone(T3DSkeleton *skeleton, const char *name) {
-  for(int i = 0; i < skeleton->skeletonRef->boneCount; i++) {
-    if(strcmp(skeleton->skeletonRef->bones[i].name, name) == 0) {
-      return i;
-    }
-  }
-  return -1;
+  return t3d_skeleton_chunk_find_bone(skeleton->skeletonRef, name);
 }
 
 void t3d_skeleton_destroy(T3DSkeleton *skeleton) {
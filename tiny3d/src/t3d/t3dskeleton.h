@@ -25,6 +25,16 @@ typedef struct {
   int32_t hasChanged;
 } T3DBone;
 
+/**
+ * Set of bones in a skeleton, used to limit blending to parts of it (e.g. upper body).
+ * Stored as a bitmask indexed by the bone index.
+ */
+typedef struct {
+  uint32_t *bits;
+  uint16_t boneCount;
+  uint16_t wordCount;
+} T3DBoneMask;
+
 /**
  * Skeleton instance, can be constructed from a model's skeleton definition.
  * This is used to draw skinned models.
@@ -37,6 +47,16 @@ typedef struct {
   const T3DChunkSkeleton* skeletonRef; // reference to the model, defines skeleton structure
 } T3DSkeleton;
 
+/**
+ * Layer of a pose, see 't3d_skeleton_apply_layers'.
+ */
+typedef struct {
+  const T3DSkeleton *pose; // source pose, e.g. a skeleton driven by an animation
+  const T3DBoneMask *mask; // bones to affect, NULL for all bones
+  float weight;            // blend factor, layers with a weight of 0 are skipped
+  bool isAdditive;         // if true, adds the difference to the resting pose instead of blending
+} T3DPoseLayer;
+
 /**
  * Creates a skeleton instance from a model's skeleton definition.
  * It will internally reserve multiple matrix stacks to allow for buffering.
@@ -97,6 +117,93 @@ void t3d_skeleton_reset(T3DSkeleton *skeleton);
  */
 void t3d_skeleton_blend(const T3DSkeleton *skelRes, const T3DSkeleton *skelA, const T3DSkeleton *skelB, float factor);
 
+/**
+ * Blends the bones inside a mask of a skeleton into another one.
+ * Only bones in the mask are modified and marked as changed.
+ * @param skelRes Skeleton to blend into, this is also the first input
+ * @param skelLayer Skeleton to blend in
+ * @param mask Bones to blend, NULL for all bones
+ * @param factor Blend factor (0.0-1.0)
+ */
+void t3d_skeleton_blend_masked(T3DSkeleton *skelRes, const T3DSkeleton *skelLayer, const T3DBoneMask *mask, float factor);
+
+/**
+ * Adds the difference between a skeleton and its resting pose onto another one.
+ * This can be used for additive animations, e.g. a hit reaction on top of any other animation.
+ * Only bones in the mask are modified and marked as changed.
+ * @param skelRes Skeleton to add to
+ * @param skelLayer Skeleton to take the difference from
+ * @param mask Bones to add, NULL for all bones
+ * @param factor Strength of the difference (0.0-1.0)
+ */
+void t3d_skeleton_add_masked(T3DSkeleton *skelRes, const T3DSkeleton *skelLayer, const T3DBoneMask *mask, float factor);
+
+/**
+ * Applies multiple layers in order to a skeleton.
+ * The skeleton itself acts as the base layer, so it should contain a pose before calling this.
+ * @param skelRes Skeleton to apply the layers to
+ * @param layers Layers, applied in order
+ * @param layerCount Number of layers
+ */
+void t3d_skeleton_apply_layers(T3DSkeleton *skelRes, const T3DPoseLayer *layers, uint32_t layerCount);
+
+/**
+ * Creates an empty bone mask for a skeleton.
+ * @param skeleton skeleton the mask is used with
+ * @return mask, free with 't3d_bone_mask_destroy'
+ */
+T3DBoneMask t3d_bone_mask_create(const T3DSkeleton *skeleton);
+
+/**
+ * Adds a single bone to a mask.
+ * @param mask mask to modify
+ * @param boneIdx index of the bone
+ */
+static inline void t3d_bone_mask_add(T3DBoneMask *mask, uint32_t boneIdx) {
+  mask->bits[boneIdx / 32] |= 1u << (boneIdx % 32);
+}
+
+/**
+ * Checks if a bone is part of a mask.
+ * @param mask mask to check
+ * @param boneIdx index of the bone
+ * @return true if set
+ */
+static inline bool t3d_bone_mask_has(const T3DBoneMask *mask, uint32_t boneIdx) {
+  return (mask->bits[boneIdx / 32] >> (boneIdx % 32)) & 1;
+}
+
+/**
+ * Adds or removes a bone and all of its children to a mask.
+ * @param mask mask to modify
+ * @param skeleton skeleton to take the hierarchy from
+ * @param boneIdx index of the root bone of the subtree
+ * @param isSet true to add, false to remove
+ */
+void t3d_bone_mask_set_subtree(T3DBoneMask *mask, const T3DSkeleton *skeleton, uint32_t boneIdx, bool isSet);
+
+/**
+ * Adds or removes a bone and all of its children to a mask, by the name of the root bone.
+ * @param mask mask to modify
+ * @param skeleton skeleton to take the hierarchy from
+ * @param name name of the root bone of the subtree
+ * @param isSet true to add, false to remove
+ * @return false if the bone was not found
+ */
+bool t3d_bone_mask_set_subtree_by_name(T3DBoneMask *mask, const T3DSkeleton *skeleton, const char *name, bool isSet);
+
+/**
+ * Inverts a mask, e.g. to get the lower body from an upper body mask.
+ * @param mask mask to modify
+ */
+void t3d_bone_mask_invert(T3DBoneMask *mask);
+
+/**
+ * Frees data allocated in the mask.
+ * @param mask
+ */
+void t3d_bone_mask_destroy(T3DBoneMask *mask);
+
 /**
  * Updates the skeleton's bone matrices if data has changed.
  * Call this after making changes to the bones individual properties (pos/rot/scale).
@@ -121,6 +228,14 @@ void t3d_skeleton_destroy(T3DSkeleton* skeleton);
  */
 int t3d_skeleton_find_bone(T3DSkeleton* skeleton, const char* name);
 
+/**
+ * Same as 't3d_skeleton_find_bone', but searches the skeleton data of a model directly.
+ * @param skel Skeleton chunk to search in
+ * @param name Name of the bone to find
+ * @return Index of the bone or -1 if not found
+ */
+int t3d_skeleton_chunk_find_bone(const T3DChunkSkeleton *skel, const char *name);
+
 /**
  * Draws a skinned model with default settings.
  * Alternatively, use 't3d_model_draw_custom' and set 'matrices' in the config.
@@ -0,0 +1,86 @@
+/**
+* @copyright 2024 - Max Bebök
+* @license MIT
+*/
+
+#include <string.h>
+#include "t3dmodel.h"
+
+// depth of the AABB center along the view direction
+static inline float get_object_depth(const T3DObject *obj, const T3DVec3 *camPos, const T3DVec3 *camDir) {
+  T3DVec3 center = {{
+    (obj->aabbMin[0] + obj->aabbMax[0]) * 0.5f - camPos->v[0],
+    (obj->aabbMin[1] + obj->aabbMax[1]) * 0.5f - camPos->v[1],
+    (obj->aabbMin[2] + obj->aabbMax[2]) * 0.5f - camPos->v[2]
+  }};
+  return t3d_vec3_dot(&center, camDir);
+}
+
+uint32_t t3d_model_objects_sort_transparent(
+  T3DObject **objects, uint32_t count, const T3DVec3 *camPos, const T3DVec3 *camDir, T3DObject **tmp, uint32_t *tmpKeys
+) {
+  assertf(count <= 0x10000, "Too many objects to sort: %lu", count);
+
+  // move transparent objects into 'tmp', while compacting opaque ones in place
+  // the depth is stored in the upper half of 'tmpKeys' until the range is known
+  uint32_t opaqueCount = 0;
+  uint32_t transpCount = 0;
+  float depthMin = INFINITY;
+  float depthMax = -INFINITY;
+  for(uint32_t i=0; i<count; ++i) {
+    T3DObject *obj = objects[i];
+    if(!t3d_model_material_is_transparent(obj->material)) {
+      objects[opaqueCount++] = obj;
+      continue;
+    }
+    float depth = get_object_depth(obj, camPos, camDir);
+    depthMin = fminf(depthMin, depth);
+    depthMax = fmaxf(depthMax, depth);
+    memcpy(&tmpKeys[count + transpCount], &depth, sizeof(float));
+    tmp[transpCount++] = obj;
+  }
+
+  T3DObject **transp = &objects[opaqueCount];
+  if(transpCount <= 1 || depthMax <= depthMin) {
+    memcpy(transp, tmp, transpCount * sizeof(T3DObject*));
+    return opaqueCount;
+  }
+
+  // quantize to 16 bits, the furthest object gets 0 to sort back-to-front
+  // each entry is the key in the upper half and the index into 'tmp' in the lower one
+  float depthScale = 65535.0f / (depthMax - depthMin);
+  uint32_t *keys = tmpKeys;
+  uint32_t *keysSorted = &tmpKeys[count];
+
+  uint32_t offsets[2][256] = {};
+  for(uint32_t i=0; i<transpCount; ++i) {
+    float depth;
+    memcpy(&depth, &keysSorted[i], sizeof(float));
+    float keyDepth = (depthMax - depth) * depthScale;
+    uint32_t key = keyDepth < 65535.0f ? (uint32_t)keyDepth : 0xFFFF;
+    keys[i] = (key << 16) | i;
+    ++offsets[0][key & 0xFF];
+    ++offsets[1][key >> 8];
+  }
+  for(int pass=0; pass<2; ++pass) {
+    uint32_t sum = 0;
+    for(int b=0; b<256; ++b) {
+      uint32_t c = offsets[pass][b];
+      offsets[pass][b] = sum;
+      sum += c;
+    }
+  }
+
+  // low byte 'keys' -> 'keysSorted', high byte back again, each pass is stable
+  for(uint32_t i=0; i<transpCount; ++i) {
+    keysSorted[offsets[0][(keys[i] >> 16) & 0xFF]++] = keys[i];
+  }
+  for(uint32_t i=0; i<transpCount; ++i) {
+    keys[offsets[1][keysSorted[i] >> 24]++] = keysSorted[i];
+  }
+
+  for(uint32_t i=0; i<transpCount; ++i) {
+    transp[i] = tmp[keys[i] & 0xFFFF];
+  }
+  return opaqueCount;
+}
@@ -0,0 +1,191 @@
+/**
+* @copyright 2024 - Max Bebök
+* @license MIT
+*/
+
+#include "t3d/t3dtexcache.h"
+#include <stdlib.h>
+
+#define ENTRY_EMPTY   0
+#define ENTRY_USED    1
+#define ENTRY_DELETED 2
+
+#define MIN_CAPACITY 16
+
+static inline uint32_t get_slot(const T3DTexCache *cache, uint32_t hash) {
+  return (hash ^ (hash >> 16)) & (cache->capacity - 1);
+}
+
+static int32_t find_entry(const T3DTexCache *cache, uint32_t hash) {
+  if(cache->capacity == 0)return -1;
+  uint32_t mask = cache->capacity - 1;
+  uint32_t idx = get_slot(cache, hash);
+  for(uint32_t i = 0; i < cache->capacity; ++i) {
+    const T3DTexCacheEntry *entry = &cache->entries[idx];
+    if(entry->state == ENTRY_EMPTY)return -1;
+    if(entry->state == ENTRY_USED && entry->hash == hash)return (int32_t)idx;
+    idx = (idx + 1) & mask;
+  }
+  return -1;
+}
+
+// returns the first slot that can be used for a new entry, the table must not be full
+static int32_t find_free_slot(const T3DTexCache *cache, uint32_t hash) {
+  uint32_t mask = cache->capacity - 1;
+  uint32_t idx = get_slot(cache, hash);
+  while(cache->entries[idx].state == ENTRY_USED) {
+    idx = (idx + 1) & mask;
+  }
+  return (int32_t)idx;
+}
+
+static void lru_remove(T3DTexCache *cache, int32_t idx) {
+  T3DTexCacheEntry *entry = &cache->entries[idx];
+  if(entry->lruPrev >= 0) {
+    cache->entries[entry->lruPrev].lruNext = entry->lruNext;
+  } else {
+    cache->lruHead = entry->lruNext;
+  }
+  if(entry->lruNext >= 0) {
+    cache->entries[entry->lruNext].lruPrev = entry->lruPrev;
+  } else {
+    cache->lruTail = entry->lruPrev;
+  }
+  entry->lruPrev = -1;
+  entry->lruNext = -1;
+}
+
+static void lru_push(T3DTexCache *cache, int32_t idx) {
+  T3DTexCacheEntry *entry = &cache->entries[idx];
+  entry->lruPrev = cache->lruTail;
+  entry->lruNext = -1;
+  if(cache->lruTail >= 0) {
+    cache->entries[cache->lruTail].lruNext = idx;
+  } else {
+    cache->lruHead = idx;
+  }
+  cache->lruTail = idx;
+}
+
+static void resize(T3DTexCache *cache, uint32_t capacity) {
+  T3DTexCacheEntry *oldEntries = cache->entries;
+  uint32_t oldCapacity = cache->capacity;
+  int32_t oldLruHead = cache->lruHead;
+
+  cache->entries = calloc(capacity, sizeof(T3DTexCacheEntry));
+  cache->capacity = capacity;
+  cache->deleted = 0;
+  cache->lruHead = -1;
+  cache->lruTail = -1;
+
+  for(uint32_t i = 0; i < oldCapacity; ++i) {
+    if(oldEntries[i].state != ENTRY_USED)continue;
+    int32_t idx = find_free_slot(cache, oldEntries[i].hash);
+    cache->entries[idx] = oldEntries[i];
+  }
+
+  // entries moved, so the LRU list is rebuilt in the same order
+  for(int32_t i = oldLruHead; i >= 0; i = oldEntries[i].lruNext) {
+    lru_push(cache, find_entry(cache, oldEntries[i].hash));
+  }
+  free(oldEntries);
+}
+
+static void free_entry(T3DTexCache *cache, int32_t idx) {
+  T3DTexCacheEntry *entry = &cache->entries[idx];
+  cache->freeFn(entry->texture);
+  cache->sizeTotal -= entry->size;
+  entry->texture = NULL;
+  entry->state = ENTRY_DELETED;
+  --cache->count;
+  ++cache->deleted;
+}
+
+void t3d_tex_cache_init(T3DTexCache *cache, T3DTexCacheFreeFn freeFn) {
+  *cache = (T3DTexCache){
+    .lruHead = -1,
+    .lruTail = -1,
+    .freeFn = freeFn,
+  };
+}
+
+void* t3d_tex_cache_acquire(T3DTexCache *cache, uint32_t hash) {
+  int32_t idx = find_entry(cache, hash);
+  if(idx < 0)return NULL;
+
+  T3DTexCacheEntry *entry = &cache->entries[idx];
+  if(entry->refCount == 0) {
+    lru_remove(cache, idx);
+    cache->sizeUnused -= entry->size;
+  }
+  ++entry->refCount;
+  return entry->texture;
+}
+
+void t3d_tex_cache_insert(T3DTexCache *cache, uint32_t hash, void *texture, uint32_t size) {
+  // deleted entries still count towards the load, growing also removes them
+  if((cache->count + cache->deleted + 1) * 4 > cache->capacity * 3) {
+    uint32_t capacity = cache->capacity ? cache->capacity : MIN_CAPACITY;
+    while((cache->count + 1) * 2 > capacity)capacity *= 2;
+    resize(cache, capacity);
+  }
+
+  int32_t idx = find_free_slot(cache, hash);
+  T3DTexCacheEntry *entry = &cache->entries[idx];
+  if(entry->state == ENTRY_DELETED)--cache->deleted;
+
+  *entry = (T3DTexCacheEntry){
+    .hash = hash,
+    .size = size,
+    .texture = texture,
+    .refCount = 1,
+    .state = ENTRY_USED,
+    .lruPrev = -1,
+    .lruNext = -1,
+  };
+  ++cache->count;
+  cache->sizeTotal += size;
+
+  if(cache->budget)t3d_tex_cache_evict(cache, cache->budget);
+}
+
+void t3d_tex_cache_release(T3DTexCache *cache, uint32_t hash) {
+  int32_t idx = find_entry(cache, hash);
+  if(idx < 0)return;
+
+  T3DTexCacheEntry *entry = &cache->entries[idx];
+  if(entry->refCount == 0 || --entry->refCount > 0)return;
+
+  if(cache->budget == 0) {
+    free_entry(cache, idx);
+    return;
+  }
+
+  lru_push(cache, idx);
+  cache->sizeUnused += entry->size;
+  t3d_tex_cache_evict(cache, cache->budget);
+}
+
+void t3d_tex_cache_set_budget(T3DTexCache *cache, uint32_t budget) {
+  cache->budget = budget;
+  t3d_tex_cache_evict(cache, budget);
+}
+
+void t3d_tex_cache_evict(T3DTexCache *cache, uint32_t size) {
+  while(cache->lruHead >= 0 && cache->sizeTotal > size) {
+    int32_t idx = cache->lruHead;
+    lru_remove(cache, idx);
+    cache->sizeUnused -= cache->entries[idx].size;
+    free_entry(cache, idx);
+  }
+}
+
+void t3d_tex_cache_shrink(T3DTexCache *cache) {
+  if(cache->count != 0 || cache->entries == NULL)return;
+  free(cache->entries);
+  cache->entries = NULL;
+  cache->capacity = 0;
+  cache->deleted = 0;
+  cache->lruHead = -1;
+  cache->lruTail = -1;
+}
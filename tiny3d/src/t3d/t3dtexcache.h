@@ -0,0 +1,107 @@
+/**
+* @copyright 2024 - Max Bebök
+* @license MIT
+*/
+#ifndef TINY3D_T3DTEXCACHE_H
+#define TINY3D_T3DTEXCACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+typedef void (*T3DTexCacheFreeFn)(void *texture);
+
+typedef struct {
+  uint32_t hash;
+  uint32_t size; // size of the texture in bytes
+  void *texture;
+  uint16_t refCount;
+  uint8_t state; // empty, used or deleted
+  uint8_t _padding;
+  int32_t lruPrev; // neighbors in the LRU list, only used if unreferenced
+  int32_t lruNext;
+} T3DTexCacheEntry;
+
+/**
+ * Cache of textures shared by all models, using their hash as the key.
+ * Textures are reference counted, and can either be freed once unused,
+ * or kept around until the memory budget is exceeded.
+ * In the latter case, the least recently used textures are freed first.
+ * This only depends on the standard library, so it can also be used on a PC.
+ */
+typedef struct {
+  T3DTexCacheEntry *entries; // open-addressing hash table
+  uint32_t capacity; // power of two, 0 if not allocated
+  uint32_t count; // used entries
+  uint32_t deleted; // deleted entries, still part of probe sequences
+  int32_t lruHead; // least recently used (unreferenced) texture, -1 if none
+  int32_t lruTail;
+  uint32_t sizeTotal; // size of all loaded textures
+  uint32_t sizeUnused; // size of all textures without references
+  uint32_t budget; // max. size of all textures before unused ones get freed, 0 frees them immediately
+  T3DTexCacheFreeFn freeFn;
+} T3DTexCache;
+
+/**
+ * Initializes an empty cache, no memory is allocated until textures are inserted.
+ * @param cache
+ * @param freeFn function to free textures
+ */
+void t3d_tex_cache_init(T3DTexCache *cache, T3DTexCacheFreeFn freeFn);
+
+/**
+ * Looks up a texture and adds a reference to it.
+ * @param cache
+ * @param hash hash of the texture, must not be 0
+ * @return texture or NULL if not in the cache
+ */
+void* t3d_tex_cache_acquire(T3DTexCache *cache, uint32_t hash);
+
+/**
+ * Inserts a newly loaded texture with a single reference.
+ * This may free unused textures to stay within the budget.
+ * @param cache
+ * @param hash hash of the texture, must not be in the cache already
+ * @param texture
+ * @param size size in bytes, used for the budget
+ */
+void t3d_tex_cache_insert(T3DTexCache *cache, uint32_t hash, void *texture, uint32_t size);
+
+/**
+ * Removes a reference from a texture.
+ * Without a budget, unused textures are freed immediately, otherwise they are kept until evicted.
+ * @param cache
+ * @param hash
+ */
+void t3d_tex_cache_release(T3DTexCache *cache, uint32_t hash);
+
+/**
+ * Sets the budget and frees unused textures exceeding it.
+ * Note that referenced textures are never freed, so the budget is only a soft limit.
+ * @param cache
+ * @param budget size in bytes, 0 to free unused textures immediately
+ */
+void t3d_tex_cache_set_budget(T3DTexCache *cache, uint32_t budget);
+
+/**
+ * Frees unused textures (least recently used first) until the total size is within the given size.
+ * @param cache
+ * @param size target size in bytes, 0 to free all unused textures
+ */
+void t3d_tex_cache_evict(T3DTexCache *cache, uint32_t size);
+
+/**
+ * Frees the memory of the table itself if no texture is left.
+ * @param cache
+ */
+void t3d_tex_cache_shrink(T3DTexCache *cache);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TINY3D_T3DTEXCACHE_H
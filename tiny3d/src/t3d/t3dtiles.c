@@ -0,0 +1,156 @@
+/**
+* @copyright 2024 - Max Bebök
+* @license MIT
+*/
+
+#include <libdragon.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "t3dtiles.h"
+
+#define T3DT_VERSION 0x01
+#define MANIFEST_HEADER_SIZE 0x10
+#define MANIFEST_TILE_SIZE 0x14
+
+// the manifest is big-endian, read it byte by byte to also work on a PC
+static inline uint32_t read_u32(const uint8_t *data) {
+  return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+}
+
+static inline int16_t read_s16(const uint8_t *data) {
+  return (int16_t)(((uint16_t)data[0] << 8) | data[1]);
+}
+
+static float get_distance(const T3DTile *tile, const float pos[3]) {
+  float distSq = 0.0f;
+  for(int i = 0; i < 3; ++i) {
+    float d = 0.0f;
+    if(pos[i] < tile->aabbMin[i])d = tile->aabbMin[i] - pos[i];
+    if(pos[i] > tile->aabbMax[i])d = pos[i] - tile->aabbMax[i];
+    distSq += d * d;
+  }
+  return sqrtf(distSq);
+}
+
+static void load_tile(T3DTileStreamer *streamer, T3DTile *tile) {
+  tile->data = streamer->loadFn(streamer->userData, tile->path);
+  streamer->sizeLoaded += tile->size;
+}
+
+void t3d_tile_streamer_init(T3DTileStreamer *streamer, const char *path, T3DTileLoadFn loadFn, T3DTileFreeFn freeFn, void *userData) {
+  FILE *file = fopen(path, "rb");
+  assertf(file != NULL, "Failed to open tile manifest: %s", path);
+  int seekRes = fseek(file, 0, SEEK_END);
+  long fileSize = ftell(file);
+  assertf(seekRes == 0 && fileSize >= MANIFEST_HEADER_SIZE, "Invalid tile manifest: %s", path);
+  fseek(file, 0, SEEK_SET);
+  uint32_t size = (uint32_t)fileSize;
+
+  uint8_t *data = malloc(size);
+  assertf(data != NULL, "Failed to allocate %lu bytes for tile manifest: %s", size, path);
+  size_t readSize = fread(data, 1, size, file);
+  fclose(file);
+  assertf(readSize == size, "Failed to read tile manifest (%u/%lu bytes): %s", readSize, size, path);
+  (void)seekRes; (void)readSize; // only used by asserts
+
+  assertf(memcmp(data, "T3T", 3) == 0, "Invalid tile manifest: %s", path);
+  assertf(data[3] == T3DT_VERSION, "Invalid tile manifest version: %d != %d (%s)", data[3], T3DT_VERSION, path);
+
+  uint32_t tileCount = read_u32(data + 0x04);
+  uint32_t tileSizeBits = read_u32(data + 0x08);
+  uint32_t stringTableOffset = read_u32(data + 0x0C);
+  assertf(tileCount <= (size - MANIFEST_HEADER_SIZE) / MANIFEST_TILE_SIZE, "Invalid tile count %lu in manifest: %s", tileCount, path);
+  assertf(stringTableOffset >= MANIFEST_HEADER_SIZE + tileCount * MANIFEST_TILE_SIZE && stringTableOffset < size,
+    "Invalid string table offset %lu in manifest: %s", stringTableOffset, path);
+
+  *streamer = (T3DTileStreamer){
+    .tiles = calloc(tileCount, sizeof(T3DTile)),
+    .tileCount = tileCount,
+    .stringTable = malloc(size - stringTableOffset),
+    .maxLoadsPerUpdate = 1,
+    .loadFn = loadFn,
+    .freeFn = freeFn,
+    .userData = userData,
+  };
+  assertf(streamer->tiles != NULL && streamer->stringTable != NULL, "Failed to allocate %lu tiles: %s", tileCount, path);
+  memcpy(&streamer->tileSize, &tileSizeBits, sizeof(float));
+  streamer->loadDistance = streamer->tileSize * 1.5f;
+  streamer->unloadDistance = streamer->tileSize * 2.0f;
+  memcpy(streamer->stringTable, data + stringTableOffset, size - stringTableOffset);
+
+  for(uint32_t t = 0; t < tileCount; ++t) {
+    const uint8_t *tileData = data + MANIFEST_HEADER_SIZE + t * MANIFEST_TILE_SIZE;
+    T3DTile *tile = &streamer->tiles[t];
+    for(int i = 0; i < 3; ++i) {
+      tile->aabbMin[i] = read_s16(tileData + i*2);
+      tile->aabbMax[i] = read_s16(tileData + 0x06 + i*2);
+    }
+    uint32_t pathOffset = read_u32(tileData + 0x0C);
+    assertf(pathOffset < size - stringTableOffset, "Invalid path of tile %lu in manifest: %s", t, path);
+    tile->path = streamer->stringTable + pathOffset;
+    tile->size = read_u32(tileData + 0x10);
+  }
+  free(data);
+}
+
+uint32_t t3d_tile_streamer_update(T3DTileStreamer *streamer, const float pos[3]) {
+  for(uint32_t t = 0; t < streamer->tileCount; ++t) {
+    T3DTile *tile = &streamer->tiles[t];
+    tile->distance = get_distance(tile, pos);
+    if(tile->data && tile->distance > streamer->unloadDistance) {
+      t3d_tile_streamer_unload(streamer, tile);
+    }
+  }
+
+  uint32_t loadCount = 0;
+  while(streamer->maxLoadsPerUpdate == 0 || loadCount < streamer->maxLoadsPerUpdate) {
+    T3DTile *closest = NULL;
+    for(uint32_t t = 0; t < streamer->tileCount; ++t) {
+      T3DTile *tile = &streamer->tiles[t];
+      if(tile->data || tile->distance > streamer->loadDistance)continue;
+      if(!closest || tile->distance < closest->distance)closest = tile;
+    }
+    if(!closest)break;
+
+    // make room by freeing tiles further away, the closest ones are always kept
+    while(streamer->budget && streamer->sizeLoaded + closest->size > streamer->budget) {
+      T3DTile *furthest = NULL;
+      for(uint32_t t = 0; t < streamer->tileCount; ++t) {
+        T3DTile *tile = &streamer->tiles[t];
+        if(tile->data && (!furthest || tile->distance > furthest->distance))furthest = tile;
+      }
+      if(!furthest || furthest->distance <= closest->distance)break;
+      t3d_tile_streamer_unload(streamer, furthest);
+    }
+    // memory of tiles freed in this update is not available yet, the tile gets loaded in a later one
+    if(streamer->budget && streamer->sizeLoaded + streamer->sizePending + closest->size > streamer->budget)break;
+
+    load_tile(streamer, closest);
+    ++loadCount;
+  }
+
+  // deferred frees are done once the RSP has drawn the frame, which happens before the next update
+  streamer->sizePending = 0;
+  return loadCount;
+}
+
+void t3d_tile_streamer_unload(T3DTileStreamer *streamer, T3DTile *tile) {
+  if(!tile->data)return;
+  streamer->freeFn(streamer->userData, tile->data);
+  tile->data = NULL;
+  streamer->sizeLoaded -= tile->size;
+  streamer->sizePending += tile->size;
+}
+
+void t3d_tile_streamer_destroy(T3DTileStreamer *streamer) {
+  for(uint32_t t = 0; t < streamer->tileCount; ++t) {
+    t3d_tile_streamer_unload(streamer, &streamer->tiles[t]);
+  }
+  free(streamer->tiles);
+  free(streamer->stringTable);
+  streamer->tiles = NULL;
+  streamer->stringTable = NULL;
+  streamer->tileCount = 0;
+}
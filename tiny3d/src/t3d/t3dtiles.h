@@ -0,0 +1,92 @@
+/**
+* @copyright 2024 - Max Bebök
+* @license MIT
+*/
+#ifndef TINY3D_T3DTILES_H
+#define TINY3D_T3DTILES_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// callbacks to load/free a single tile, by default these are 't3d_tile_load_model' and 't3d_tile_free_model'
+typedef void* (*T3DTileLoadFn)(void *userData, const char *path);
+typedef void (*T3DTileFreeFn)(void *userData, void *tile);
+
+typedef struct {
+  int16_t aabbMin[3];
+  int16_t aabbMax[3];
+  uint32_t size; // memory needed once loaded, in bytes
+  char *path;
+  void *data; // loaded tile (e.g. a T3DModel), NULL if not loaded
+  float distance; // distance to the camera in the last update, 0 if inside
+} T3DTile;
+
+/**
+ * Streams in tiles of a level created with '--tiles', based on the distance to the camera.
+ * Tiles are loaded once closer than 'loadDistance', and freed again once further away than 'unloadDistance'.
+ * The difference between both avoids loading and freeing the same tile over and over at the border.
+ * If loading a tile would exceed the budget, tiles further away than it get freed first.
+ * Frees can be deferred (see 't3d_tile_free_model'), so their memory only counts as available in the next update.
+ * Loading itself is done via callbacks, the manifest is read with stdio, so it can also be used on a PC.
+ */
+typedef struct {
+  T3DTile *tiles;
+  uint32_t tileCount;
+  float tileSize;
+  char *stringTable;
+
+  float loadDistance;
+  float unloadDistance; // should be larger than 'loadDistance'
+  uint32_t budget; // max. size of all loaded tiles in bytes, 0 for no limit
+  uint32_t sizeLoaded;
+  uint32_t sizePending; // freed since the last update, may still be in use until the RSP is done with it
+  uint32_t maxLoadsPerUpdate; // limits hitches when moving fast, 0 for no limit
+
+  T3DTileLoadFn loadFn;
+  T3DTileFreeFn freeFn;
+  void *userData;
+} T3DTileStreamer;
+
+/**
+ * Loads the manifest of a tiled level, no tiles are loaded yet.
+ * Distances default to 1.5x and 2x the tile size, with one load per update and no budget.
+ * @param streamer
+ * @param path path to the manifest
+ * @param loadFn callback to load a tile
+ * @param freeFn callback to free a tile
+ * @param userData passed to the callbacks
+ */
+void t3d_tile_streamer_init(T3DTileStreamer *streamer, const char *path, T3DTileLoadFn loadFn, T3DTileFreeFn freeFn, void *userData);
+
+/**
+ * Loads and frees tiles based on the camera position, should be called once per frame.
+ * The closest tiles are loaded first.
+ * @param streamer
+ * @param pos camera position, in the same space as the tiles (model space)
+ * @return number of tiles loaded
+ */
+uint32_t t3d_tile_streamer_update(T3DTileStreamer *streamer, const float pos[3]);
+
+/**
+ * Frees a loaded tile, it may get loaded again in the next update.
+ * @param streamer
+ * @param tile
+ */
+void t3d_tile_streamer_unload(T3DTileStreamer *streamer, T3DTile *tile);
+
+/**
+ * Frees all tiles and the manifest.
+ * @param streamer
+ */
+void t3d_tile_streamer_destroy(T3DTileStreamer *streamer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TINY3D_T3DTILES_H
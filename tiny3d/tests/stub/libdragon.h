@@ -0,0 +1,111 @@
+/**
+* @copyright 2024 - Max Bebök
+* @license MIT
+*/
+#ifndef TINY3D_TEST_LIBDRAGON_STUB_H
+#define TINY3D_TEST_LIBDRAGON_STUB_H
+
+// Minimal stand-in for libdragon, allows building parts of tiny3d on the host.
+// Only types and functions referenced by the headers are declared here,
+// tests that call into libdragon (e.g. rdpq) have to provide their own mocks.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#ifdef __cplusplus
+#define _Static_assert static_assert
+extern "C"
+{
+#endif
+
+#define assertf(cond, ...) assert(cond)
+#define debugf(...) printf(__VA_ARGS__)
+
+typedef struct { uint8_t r, g, b, a; } color_t;
+#define RGBA32(rx, gx, bx, ax) ((color_t){rx, gx, bx, ax})
+static inline uint32_t color_to_packed32(color_t c) {
+  return ((uint32_t)c.r << 24) | ((uint32_t)c.g << 16) | ((uint32_t)c.b << 8) | c.a;
+}
+
+typedef struct sprite_s sprite_t;
+typedef struct surface_s surface_t;
+typedef struct rspq_block_s rspq_block_t;
+typedef enum { TILE0 = 0, TILE1 = 1 } rdpq_tile_t;
+typedef struct {
+  struct { float translate; int scale_log; float repeats; bool mirror; } s, t;
+  int palette;
+  int tmem_addr;
+} rdpq_texparms_t;
+typedef uint32_t rdpq_blender_t;
+typedef uint64_t rdpq_combiner_t;
+
+#define REPEAT_INFINITE 2048
+#define SOM_ALPHACOMPARE_THRESHOLD (1ull << 0)
+#define SOM_READ_ENABLE (1ull << 6)
+
+#define UncachedAddr(x) (x)
+#define PhysicalAddr(x) ((uint32_t)(uintptr_t)(x))
+
+// there is no cache to manage on the host
+static inline void data_cache_hit_writeback_invalidate(volatile void *addr, unsigned long size) { (void)addr; (void)size; }
+static inline void data_cache_hit_writeback(volatile const void *addr, unsigned long size) { (void)addr; (void)size; }
+
+static inline float fm_sinf(float x) { return sinf(x); }
+static inline float fm_cosf(float x) { return cosf(x); }
+static inline float fm_atan2f(float y, float x) { return atan2f(y, x); }
+static inline void fm_sincosf(float x, float *s, float *c) { *s = sinf(x); *c = cosf(x); }
+
+// files are loaded from the host filesystem, without the "rom:/" prefix
+static inline FILE *asset_fopen(const char *fn, int *sz) {
+  if(strncmp(fn, "rom:/", 5) == 0)fn += 5;
+  FILE *f = fopen(fn, "rb");
+  if(f && sz) {
+    fseek(f, 0, SEEK_END);
+    *sz = (int)ftell(f);
+    fseek(f, 0, SEEK_SET);
+  }
+  return f;
+}
+
+void *asset_load(const char *fn, int *sz);
+void *malloc_uncached(size_t size);
+void free_uncached(void *ptr);
+uint64_t get_ticks(void);
+
+sprite_t *sprite_load(const char *fn);
+void sprite_free(sprite_t *sprite);
+
+void rdpq_sync_tile(void);
+void rdpq_sync_pipe(void);
+void rdpq_sync_load(void);
+void rdpq_tex_reuse(rdpq_tile_t tile, const rdpq_texparms_t *parms);
+int rdpq_sprite_upload(rdpq_tile_t tile, sprite_t *sprite, const rdpq_texparms_t *parms);
+void rdpq_tex_multi_begin(void);
+int rdpq_tex_multi_end(void);
+void rdpq_mode_combiner(rdpq_combiner_t comb);
+void rdpq_mode_blender(rdpq_blender_t blend);
+void rdpq_set_prim_color(color_t color);
+void rdpq_set_env_color(color_t color);
+void rdpq_set_blend_color(color_t color);
+void __rdpq_mode_change_som(uint64_t mask, uint64_t val);
+
+void rspq_call_deferred(void (*func)(void*), void *arg);
+void rspq_block_begin(void);
+rspq_block_t* rspq_block_end(void);
+void rspq_block_run(rspq_block_t *block);
+void rspq_block_free(rspq_block_t *block);
+void rspq_write(uint32_t ovl, uint32_t cmd, ...);
+
+uint32_t display_get_width(void);
+uint32_t display_get_height(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,46 @@
+/**
+* @copyright 2024 - Max Bebök
+* @license MIT
+*/
+#ifndef TINY3D_TEST_H
+#define TINY3D_TEST_H
+
+// Minimal helpers shared by all host tests, each test is its own executable.
+// A failed check is reported but the test keeps running, 'test_result' returns the exit code.
+
+#include <stdio.h>
+#include <stdint.h>
+
+static int testFailCount = 0;
+static int testCheckCount = 0;
+
+#define TEST_CHECK(cond, ...) do { \
+  ++testCheckCount; \
+  if(!(cond)) { \
+    ++testFailCount; \
+    fprintf(stderr, "%s:%d: check failed: %s\n  ", __FILE__, __LINE__, #cond); \
+    fprintf(stderr, __VA_ARGS__); \
+    fprintf(stderr, "\n"); \
+  } \
+} while(0)
+
+// deterministic xorshift, so failures can be reproduced
+static uint32_t testRandState = 0x12345678;
+
+static inline uint32_t test_rand(void) {
+  testRandState ^= testRandState << 13;
+  testRandState ^= testRandState >> 17;
+  testRandState ^= testRandState << 5;
+  return testRandState;
+}
+
+static inline float test_randf(float min, float max) {
+  return min + (max - min) * (float)(test_rand() & 0xFFFFFF) / (float)0xFFFFFF;
+}
+
+static inline int test_result(const char *name) {
+  printf("[%s] %d checks, %d failed\n", name, testCheckCount, testFailCount);
+  return testFailCount == 0 ? 0 : 1;
+}
+
+#endif
@@ -0,0 +1,466 @@
+/**
+* @copyright 2024 - Max Bebök
+* @license MIT
+*/
+
+// Round-trip of animations: keyframes are encoded by the importer (reduction, quantization and stream layout),
+// then played back by the runtime and compared against the source samples they were created from.
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "converter/converter.h"
+#include <t3d/t3danim.h>
+#include "test.h"
+
+Config config;
+
+namespace {
+  constexpr float DURATION = 4.0f;
+  constexpr float SAMPLE_RATE = 60.0f;
+  constexpr uint32_t BONE_COUNT = 2;
+  constexpr float BONE_REACH = 40.0f;
+  constexpr uint32_t BONE_CHAIN = 2;
+  constexpr float ANIM_ERROR = 2.0f;
+
+  const char *STREAM_PATH = "build/test_anim.sdata";
+  const char *CHANNEL_PATH = "build/test_anim.channels";
+
+  T3DChunkAnim *currentAnim = nullptr;
+  Bone bones[BONE_COUNT];
+
+  struct ErrorMax {
+    float pos{}, rot{}, scale{};
+  };
+
+  Quat axisAngle(Vec3 axis, float angle) {
+    axis = axis.normalize();
+    float s = sinf(angle * 0.5f);
+    return Quat{axis[0] * s, axis[1] * s, axis[2] * s, cosf(angle * 0.5f)};
+  }
+
+  float curveValue(const AnimChannelMapping &ch, float t) {
+    switch(ch.targetType) {
+      case AnimChannelTarget::TRANSLATION:
+        if(ch.attributeIdx == 0)return 120.0f * sinf(t * (float)M_PI);
+        if(ch.attributeIdx == 1)return 10.0f * t; // slow ramp, mostly delta-coded
+        return 0.0f; // identity, removed by the importer
+      case AnimChannelTarget::SCALE:
+        return 1.0f + 0.2f * sinf(t * 3.0f + (float)ch.attributeIdx);
+      default: return 0.0f;
+    }
+  }
+
+  // source as it comes out of the glTF parser: channels sampled at a fixed rate
+  // 'holdTime' keeps the last pose for that long, so all keyframes are needed before the end
+  Anim createSourceAnim(float holdTime = 0.0f) {
+    Anim anim{.name = "test", .duration = DURATION};
+    auto addChannel = [&](const char *bone, AnimChannelTarget type, uint8_t attr) {
+      anim.channelMap.push_back({.targetName = bone, .targetType = type, .attributeIdx = attr});
+    };
+    addChannel("arm", AnimChannelTarget::ROTATION, 0);
+    addChannel("root", AnimChannelTarget::TRANSLATION, 0);
+    addChannel("root", AnimChannelTarget::TRANSLATION, 1);
+    addChannel("root", AnimChannelTarget::TRANSLATION, 2);
+    addChannel("arm", AnimChannelTarget::SCALE, 0);
+    addChannel("arm", AnimChannelTarget::SCALE, 1);
+
+    uint32_t sampleCount = (uint32_t)(DURATION * SAMPLE_RATE) + 1;
+    for(uint32_t c=0; c<anim.channelMap.size(); ++c) {
+      auto &ch = anim.channelMap[c];
+      for(uint32_t s=0; s<sampleCount; ++s) {
+        float t = (float)s / SAMPLE_RATE;
+        Keyframe kf{.time = t, .chanelIdx = c};
+        t = std::min(t, DURATION - holdTime);
+        if(ch.isRotation()) {
+          kf.valQuat = axisAngle({0.3f, 1.0f, 0.2f}, 1.5f * sinf(t * 4.4f));
+        } else {
+          kf.valScalar = curveValue(ch, t);
+          ch.valueMin = std::min(ch.valueMin, kf.valScalar);
+          ch.valueMax = std::max(ch.valueMax, kf.valScalar);
+        }
+        ch.keyframes.push_back(kf);
+      }
+    }
+    return anim;
+  }
+
+  // linear interpolation of the source samples, same as the importer uses as a reference
+  Keyframe sampleSource(const AnimChannelMapping &ch, float t) {
+    const auto &kfs = ch.keyframes;
+    float pos = std::clamp(t * SAMPLE_RATE, 0.0f, (float)(kfs.size() - 1));
+    uint32_t idx = std::min((uint32_t)pos, (uint32_t)kfs.size() - 2);
+    float interp = pos - (float)idx;
+    Keyframe res{};
+    res.valQuat = kfs[idx].valQuat.slerp(kfs[idx+1].valQuat, interp);
+    res.valScalar = kfs[idx].valScalar + (kfs[idx+1].valScalar - kfs[idx].valScalar) * interp;
+    return res;
+  }
+
+  float readFloatBE(const uint8_t *data) {
+    uint32_t val = ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+    float res;
+    memcpy(&res, &val, sizeof(res));
+    return res;
+  }
+
+  /**
+   * Converts and writes an animation with the importer, the channel mappings are loaded back
+   * into a runtime animation chunk, the keyframes are streamed from the written file.
+   */
+  T3DChunkAnim* encodeAnim(Anim &anim, AnimStreamInfo &info)
+  {
+    std::unordered_map<std::string, const Bone*> nodeMap{};
+    for(const auto &bone : bones)nodeMap[bone.name] = &bone;
+    std::vector<BoneReach> boneReach(BONE_COUNT, BoneReach{.reach = BONE_REACH, .chainLength = BONE_CHAIN});
+    convertAnimation(anim, nodeMap, boneReach);
+
+    BinaryFile streamFile{};
+    BinaryFile channelFile{};
+    info = writeAnimStream(anim, streamFile);
+    writeAnimChannels(anim, channelFile);
+    streamFile.writeToFile(STREAM_PATH);
+    channelFile.writeToFile(CHANNEL_PATH);
+
+    uint32_t channelCount = anim.channelMap.size();
+    auto *chunk = (T3DChunkAnim*)calloc(1, sizeof(T3DChunkAnim) + sizeof(T3DAnimChannelMapping) * channelCount);
+    *chunk = (T3DChunkAnim){
+      .name = (char*)"test",
+      .duration = anim.duration,
+      .keyframeCount = (uint32_t)anim.keyframes.size(),
+      .channelsQuat = (uint16_t)anim.channelCountQuat,
+      .channelsScalar = (uint16_t)anim.channelCountScalar,
+      .filePath = (char*)STREAM_PATH,
+      .fileOffset = info.offset,
+      .fileSize = info.size,
+      .snapshotOffset = info.snapshotOffset,
+      .snapshotCount = (uint16_t)anim.snapshots.size(),
+      .snapshotTicks = (uint16_t)config.animSnapshotTicks,
+    };
+
+    FILE *f = fopen(CHANNEL_PATH, "rb");
+    for(uint32_t c=0; c<channelCount; ++c) {
+      uint8_t data[20];
+      TEST_CHECK(fread(data, 1, sizeof(data), f) == sizeof(data), "channel %d: short read", c);
+      auto &map = chunk->channelMappings[c];
+      map.targetIdx = (data[0] << 8) | data[1];
+      map.targetType = data[2];
+      map.attributeIdx = data[3];
+      map.quantScale = readFloatBE(&data[4]);
+      map.quantOffset = readFloatBE(&data[8]);
+      map.tangentScale = readFloatBE(&data[12]);
+      map.deltaScale = readFloatBE(&data[16]);
+    }
+    fclose(f);
+    return chunk;
+  }
+
+  // error limits of a channel, see 'getChannelThreshold' in the importer
+  ErrorMax getThreshold() {
+    float budget = ANIM_ERROR / (float)BONE_CHAIN;
+    return {
+      .pos = budget / sqrtf(3.0f),
+      .rot = budget / (2.0f * BONE_REACH),
+      .scale = budget / BONE_REACH / sqrtf(3.0f)
+    };
+  }
+
+  void resetBones(T3DBone *tBones) {
+    for(uint32_t b=0; b<BONE_COUNT; ++b) {
+      tBones[b] = (T3DBone){};
+      tBones[b].scale = (T3DVec3){{1.0f, 1.0f, 1.0f}};
+      tBones[b].rotation = (T3DQuat){{0.0f, 0.0f, 0.0f, 1.0f}};
+    }
+  }
+
+  // compares the state of all bones against the source at the current time of the animation
+  void compareToSource(const T3DAnim &anim, const T3DBone *tBones, const Anim &src, ErrorMax &err) {
+    for(const auto &ch : src.channelMap) {
+      const T3DBone &bone = tBones[ch.targetName == "root" ? 0 : 1];
+      Keyframe ref = sampleSource(ch, anim.time);
+      switch(ch.targetType) {
+        case AnimChannelTarget::ROTATION: {
+          Vec4 q{bone.rotation.v[0], bone.rotation.v[1], bone.rotation.v[2], bone.rotation.v[3]};
+          Vec4 r = ref.valQuat.toVec4();
+          err.rot = std::max(err.rot, sqrtf(std::min((q - r).length2(), (q + r).length2())));
+        } break;
+        case AnimChannelTarget::TRANSLATION:
+          err.pos = std::max(err.pos, fabsf(bone.position.v[ch.attributeIdx] - ref.valScalar));
+        break;
+        default:
+          err.scale = std::max(err.scale, fabsf(bone.scale.v[ch.attributeIdx] - ref.valScalar));
+        break;
+      }
+    }
+  }
+
+  // plays the animation twice (to include the rewind), returns the largest error of any frame
+  ErrorMax playAndCompare(T3DChunkAnim *chunk, const Anim &src) {
+    alignas(8) static uint8_t modelBuffer[sizeof(T3DModel)]{}; // no chunks, only used to find the animation
+    currentAnim = chunk;
+    T3DAnim anim = t3d_anim_create((T3DModel*)modelBuffer, "test");
+
+    T3DBone tBones[BONE_COUNT];
+    resetBones(tBones);
+    T3DSkeleton skel{.bones = tBones};
+    t3d_anim_attach(&anim, &skel);
+
+    ErrorMax err{};
+    uint32_t frames = (uint32_t)(DURATION * SAMPLE_RATE * 2.0f) - 2;
+    for(uint32_t f=0; f<frames; ++f) {
+      t3d_anim_update(&anim, 1.0f / SAMPLE_RATE);
+      compareToSource(anim, tBones, src, err);
+    }
+    t3d_anim_destroy(&anim);
+    return err;
+  }
+
+  void checkErrors(const char *name, const ErrorMax &err, const ErrorMax &limit) {
+    printf("  %-8s error pos: %.4f (max %.4f), rot: %.5f (max %.5f), scale: %.5f (max %.5f)\n",
+      name, err.pos, limit.pos, err.rot, limit.rot, err.scale, limit.scale);
+    TEST_CHECK(err.pos <= limit.pos, "%s: translation error %f > %f", name, err.pos, limit.pos);
+    TEST_CHECK(err.rot <= limit.rot, "%s: rotation error %f > %f", name, err.rot, limit.rot);
+    TEST_CHECK(err.scale <= limit.scale, "%s: scale error %f > %f", name, err.scale, limit.scale);
+  }
+
+  // encodes the source with the current config and plays it back
+  uint32_t testRoundTrip(const char *name, const ErrorMax &limit) {
+    Anim src = createSourceAnim();
+    Anim anim = src;
+    AnimStreamInfo info{};
+    T3DChunkAnim *chunk = encodeAnim(anim, info);
+    checkErrors(name, playAndCompare(chunk, src), limit);
+    free(chunk);
+    return info.size;
+  }
+
+  void testDefault() {
+    config = Config{};
+    // without an explicit error, only the quantization is lossy
+    testRoundTrip("default", {.pos = 0.01f, .rot = 0.003f, .scale = 0.001f});
+  }
+
+  void testErrorLimit() {
+    ErrorMax threshold = getThreshold();
+    // reduction and quantization share the threshold, the runtime only adds float precision
+    ErrorMax limit{
+      .pos = threshold.pos + 0.001f,
+      .rot = threshold.rot + 0.0001f,
+      .scale = threshold.scale + 0.0001f,
+    };
+
+    config = Config{.animError = ANIM_ERROR};
+    uint32_t sizeLinear = testRoundTrip("linear", limit);
+
+    config = Config{.animError = ANIM_ERROR, .animCubic = true};
+    uint32_t sizeCubic = testRoundTrip("cubic", limit);
+
+    printf("  stream size: linear %d bytes, cubic %d bytes\n", sizeLinear, sizeCubic);
+    TEST_CHECK(sizeCubic < sizeLinear, "cubic (%d) is not smaller than linear (%d)", sizeCubic, sizeLinear);
+  }
+
+  // state of all bones after playing from the start to 'time', without using snapshots
+  void playTo(float time, T3DBone *tBones) {
+    alignas(8) static uint8_t modelBuffer[sizeof(T3DModel)]{};
+    T3DAnim anim = t3d_anim_create((T3DModel*)modelBuffer, "test");
+    T3DSkeleton skel{.bones = tBones};
+    resetBones(tBones);
+    t3d_anim_attach(&anim, &skel);
+    t3d_anim_update(&anim, time);
+    t3d_anim_destroy(&anim);
+  }
+
+  float compareBones(const T3DBone *a, const T3DBone *b) {
+    float err = 0.0f;
+    for(uint32_t i=0; i<BONE_COUNT; ++i) {
+      for(int v=0; v<3; ++v) {
+        err = std::max(err, fabsf(a[i].position.v[v] - b[i].position.v[v]));
+        err = std::max(err, fabsf(a[i].scale.v[v] - b[i].scale.v[v]));
+      }
+      for(int v=0; v<4; ++v)err = std::max(err, fabsf(a[i].rotation.v[v] - b[i].rotation.v[v]));
+    }
+    return err;
+  }
+
+  // seeking (with snapshots) has to end up in the same state as playing up to that time
+  void testSeek(const char *name, const Config &cfg) {
+    config = cfg;
+    Anim anim = createSourceAnim(0.5f);
+    anim.duration += 0.108f; // not a multiple of the tick, channels end slightly before the animation does
+    AnimStreamInfo info{};
+    T3DChunkAnim *chunk = encodeAnim(anim, info);
+    currentAnim = chunk;
+    TEST_CHECK(!anim.snapshots.empty(), "%s: no snapshots created", name);
+    TEST_CHECK(anim.snapshots.back().kfIndex < anim.keyframes.size(), "%s: snapshot after the last keyframe", name);
+
+    alignas(8) static uint8_t modelBuffer[sizeof(T3DModel)]{};
+    T3DAnim animSeek = t3d_anim_create((T3DModel*)modelBuffer, "test");
+    T3DBone bonesSeek[BONE_COUNT], bonesRef[BONE_COUNT];
+    resetBones(bonesSeek);
+    T3DSkeleton skel{.bones = bonesSeek};
+    t3d_anim_attach(&animSeek, &skel);
+
+    float errMax = 0.0f;
+    for(uint32_t i=0; i<200; ++i) {
+      // random times forwards and backwards, including the very end after the last keyframe
+      float time = (i % 5 == 0) ? (chunk->duration - test_randf(0.001f, 0.2f)) : test_randf(0.0f, chunk->duration);
+      t3d_anim_set_time(&animSeek, time);
+      t3d_anim_update(&animSeek, 0.0f);
+      playTo(time, bonesRef);
+
+      // snapshots store decoded values, delta-coded channels may round differently when replayed
+      float err = compareBones(bonesSeek, bonesRef);
+      TEST_CHECK(err < 0.002f, "%s: seek to %f differs by %f", name, time, err);
+      errMax = std::max(errMax, err);
+    }
+    printf("  %-8s seek error: %.6f, snapshots: %d\n", name, errMax, (int)anim.snapshots.size());
+
+    t3d_anim_destroy(&animSeek);
+    free(chunk);
+  }
+
+  // a straight line only needs its two end keyframes, the gap between them has to fit into the time field
+  bool convertsRamp(float duration) {
+    config = Config{};
+    Anim anim{.name = "ramp", .duration = duration};
+    anim.channelMap.push_back({.targetName = "root", .targetType = AnimChannelTarget::TRANSLATION, .attributeIdx = 0});
+    auto &ch = anim.channelMap.back();
+    for(uint32_t s=0; s<=(uint32_t)duration; ++s) {
+      ch.keyframes.push_back({.time = (float)s, .chanelIdx = 0, .valScalar = (float)s});
+    }
+    ch.valueMin = 0.0f;
+    ch.valueMax = (float)(ch.keyframes.size() - 1);
+
+    std::unordered_map<std::string, const Bone*> nodeMap{};
+    for(const auto &bone : bones)nodeMap[bone.name] = &bone;
+    try {
+      convertAnimation(anim, nodeMap, {});
+    } catch(const std::runtime_error&) {
+      return false;
+    }
+    return true;
+  }
+
+  void testLongGap() {
+    TEST_CHECK(convertsRamp(270.0f), "gap of 270s was rejected");
+    TEST_CHECK(!convertsRamp(300.0f), "gap of 300s was accepted");
+  }
+
+  // skeleton data as stored in a model, 'names' sets the bone order
+  T3DChunkSkeleton* createSkeletonChunk(const std::vector<const char*> &names, bool withHashes) {
+    uint32_t count = names.size();
+    auto *skel = (T3DChunkSkeleton*)calloc(1, sizeof(T3DChunkSkeleton) + (sizeof(T3DChunkBone) + sizeof(T3DNameHash)) * count);
+    skel->boneCount = count;
+    skel->hashCount = withHashes ? count : 0;
+    skel->signature = 0x1234;
+    for(uint32_t b=0; b<count; ++b)skel->bones[b].name = (char*)names[b];
+
+    auto *hashes = (T3DNameHash*)t3d_skeleton_chunk_get_hashes(skel);
+    for(uint32_t b=0; b<skel->hashCount; ++b)hashes[b] = T3DNameHash{.hash = t3d_name_hash(names[b]), .index = (uint16_t)b};
+    std::sort(hashes, hashes + skel->hashCount, [](const T3DNameHash &x, const T3DNameHash &y) { return x.hash < y.hash; });
+    return skel;
+  }
+
+  // animations of another model with the same bones have to end up on the bones with the same name
+  void testRemap() {
+    config = Config{};
+    Anim anim = createSourceAnim();
+    AnimStreamInfo info{};
+    T3DChunkAnim *chunk = encodeAnim(anim, info);
+    currentAnim = chunk;
+
+    T3DChunkSkeleton *skelSrc = createSkeletonChunk({"root", "arm"}, true);
+    struct Target {
+      T3DChunkSkeleton *skel;
+      uint32_t rootIdx;
+    } targets[] = {
+      {createSkeletonChunk({"root", "arm"}, true), 0}, // same order, no remap
+      {createSkeletonChunk({"arm", "root"}, true), 1},
+      {createSkeletonChunk({"arm", "root"}, false), 1}, // older file without hashes
+    };
+
+    alignas(8) static uint8_t modelBuffer[sizeof(T3DModel)]{};
+    for(const auto &target : targets) {
+      T3DBone bonesRef[BONE_COUNT], bonesDst[BONE_COUNT];
+      T3DAnim animDst = t3d_anim_create((T3DModel*)modelBuffer, "test");
+      animDst.skeletonRef = skelSrc;
+      T3DSkeleton skel{.bones = bonesDst, .skeletonRef = target.skel};
+      resetBones(bonesDst);
+      t3d_anim_attach(&animDst, &skel);
+
+      float time = test_randf(0.0f, chunk->duration);
+      t3d_anim_update(&animDst, time);
+      playTo(time, bonesRef);
+      T3DBone bonesRemapped[BONE_COUNT] = {bonesDst[target.rootIdx], bonesDst[1 - target.rootIdx]};
+      float err = compareBones(bonesRemapped, bonesRef);
+      TEST_CHECK(err == 0.0f, "remap (root at %d): bones differ by %f", target.rootIdx, err);
+
+      t3d_anim_destroy(&animDst);
+      free(target.skel);
+    }
+    free(skelSrc);
+    free(chunk);
+  }
+
+  // animations of different models share the file, which has to outlive the model it was opened by
+  void testSharedFile() {
+    config = Config{};
+    Anim anim = createSourceAnim();
+    AnimStreamInfo info{};
+    T3DChunkAnim *chunk = encodeAnim(anim, info);
+    alignas(8) static uint8_t modelBuffer[sizeof(T3DModel)]{};
+
+    char *pathA = strdup(STREAM_PATH); // string tables of two models
+    char *pathB = strdup(STREAM_PATH);
+
+    currentAnim = chunk;
+    chunk->filePath = pathA;
+    T3DAnim animA = t3d_anim_create((T3DModel*)modelBuffer, "test");
+    chunk->filePath = pathB;
+    T3DAnim animB = t3d_anim_create((T3DModel*)modelBuffer, "test");
+    TEST_CHECK(animA.file == animB.file, "file is not shared");
+
+    // free the first model, the file is still open for the second one
+    t3d_anim_destroy(&animA);
+    free(pathA);
+    T3DAnim animC = t3d_anim_create((T3DModel*)modelBuffer, "test");
+    TEST_CHECK(animB.file == animC.file, "file is not shared after releasing the first user");
+
+    t3d_anim_destroy(&animB);
+    t3d_anim_destroy(&animC);
+    free(pathB);
+    free(chunk);
+  }
+}
+
+// the index search lives in t3dmodel.c together with the draw code, which can't be linked here
+extern "C" uint32_t t3d_name_index_find(const T3DNameHash *entries, uint32_t count, uint32_t hash) {
+  return std::lower_bound(entries, entries + count, hash, [](const T3DNameHash &e, uint32_t h) { return e.hash < h; }) - entries;
+}
+
+extern "C" void *malloc_uncached(size_t size) { return malloc(size); }
+extern "C" void free_uncached(void *ptr) { free(ptr); }
+
+// the test only contains a single animation, so there is no actual model to look it up in
+extern "C" T3DChunkAnim *t3d_model_get_animation(const T3DModel *model, const char *name) {
+  (void)model; (void)name;
+  return currentAnim;
+}
+
+int main()
+{
+  bones[0] = Bone{.name = "root", .scale = {1.0f, 1.0f, 1.0f}, .index = 0, .parentIndex = 0xFFFF};
+  bones[1] = Bone{.name = "arm", .scale = {1.0f, 1.0f, 1.0f}, .index = 1, .parentIndex = 0};
+
+  testDefault();
+  testErrorLimit();
+  testSharedFile();
+  testLongGap();
+  testRemap();
+  testSeek("seek", Config{.animSnapshotTicks = 7});
+  testSeek("seek-err", Config{.animError = ANIM_ERROR, .animSnapshotTicks = 5});
+  return test_result("anim");
+}
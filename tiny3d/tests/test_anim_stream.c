@@ -0,0 +1,130 @@
+/**
+* @copyright 2024 - Max Bebök
+* @license MIT
+*/
+
+// Checks the animation ring-buffer against reading a plain file directly.
+// Sections start at unaligned offsets and use various buffer sizes, two streams share the same file.
+
+#include <t3d/t3danimstream.h>
+#include <string.h>
+#include "test.h"
+
+#define FILE_PATH "build/test_anim_stream.bin"
+#define FILE_SIZE (1024 * 16)
+#define ITERATIONS 300
+#define OPS_PER_ITERATION 400
+
+static uint8_t fileData[FILE_SIZE];
+
+typedef struct {
+  T3DAnimStream stream;
+  uint32_t readPos; // expected position
+} TestStream;
+
+static void create_file(void) {
+  for(uint32_t i=0; i<FILE_SIZE; ++i)fileData[i] = (uint8_t)(test_rand() >> 7);
+  FILE *f = fopen(FILE_PATH, "wb");
+  TEST_CHECK(f && fwrite(fileData, 1, FILE_SIZE, f) == FILE_SIZE, "failed to write '%s'", FILE_PATH);
+  fclose(f);
+}
+
+static void test_stream_init(TestStream *ts, T3DAnimStreamFile *file) {
+  static const uint32_t BUFFER_SIZES[] = {0, 1, 256, 300, 512, 1024, 1500, 4096, FILE_SIZE};
+  uint32_t offset = test_rand() % (FILE_SIZE / 2);
+  uint32_t size = test_rand() % (FILE_SIZE - offset);
+  uint32_t bufferSize = BUFFER_SIZES[test_rand() % (sizeof(BUFFER_SIZES) / sizeof(BUFFER_SIZES[0]))];
+
+  t3d_anim_stream_init(&ts->stream, file, offset, size, bufferSize);
+  TEST_CHECK(ts->stream.bufferSize % T3D_ANIM_STREAM_BLOCK_SIZE == 0, "buffer size %d is not a multiple of blocks", ts->stream.bufferSize);
+  ts->readPos = 0;
+  TEST_CHECK(!t3d_anim_stream_read(&ts->stream, NULL, 0), "empty read succeeded");
+  if(test_rand() % 2)t3d_anim_stream_prefetch(&ts->stream);
+}
+
+static void test_stream_step(TestStream *ts) {
+  T3DAnimStream *stream = &ts->stream;
+  uint32_t op = test_rand() % 16;
+
+  if(op == 0) {
+    t3d_anim_stream_rewind(stream);
+    ts->readPos = 0;
+  } else if(op == 1) {
+    ts->readPos = stream->dataSize ? (test_rand() % stream->dataSize) : 0;
+    t3d_anim_stream_seek(stream, ts->readPos);
+  } else if(op < 4) {
+    t3d_anim_stream_prefetch(stream);
+  } else {
+    // mostly small reads like keyframes, sometimes up to a full block
+    uint32_t size = (op < 14) ? (1 + test_rand() % 10) : (1 + test_rand() % T3D_ANIM_STREAM_BLOCK_SIZE);
+    uint8_t buff[T3D_ANIM_STREAM_BLOCK_SIZE];
+    bool expectRead = ts->readPos + size <= stream->dataSize;
+    bool res = t3d_anim_stream_read(stream, buff, size);
+
+    TEST_CHECK(res == expectRead, "read %d bytes at %d/%d: returned %d", size, ts->readPos, stream->dataSize, res);
+    if(res && expectRead) {
+      const uint8_t *ref = &fileData[stream->dataOffset + ts->readPos];
+      TEST_CHECK(memcmp(buff, ref, size) == 0, "read %d bytes at %d (offset: %d, buffer: %d): data mismatch",
+        size, ts->readPos, stream->dataOffset, stream->bufferSize);
+      ts->readPos += size;
+    } else if(!expectRead) {
+      // stay at the end, a rewind or seek is needed to continue
+      TEST_CHECK(stream->readPos == ts->readPos, "position changed by a failed read");
+    }
+  }
+}
+
+// reads a section from start to end in small steps, as done for keyframes during playback
+static void test_sequential(T3DAnimStreamFile *file) {
+  for(uint32_t i=0; i<ITERATIONS; ++i) {
+    TestStream ts;
+    test_stream_init(&ts, file);
+    uint32_t loops = 1 + test_rand() % 3;
+    for(uint32_t l=0; l<loops; ++l) {
+      uint8_t buff[6];
+      uint32_t pos = 0;
+      for(;;) {
+        uint32_t size = 1 + test_rand() % sizeof(buff);
+        if(!t3d_anim_stream_read(&ts.stream, buff, size))break;
+        TEST_CHECK(memcmp(buff, &fileData[ts.stream.dataOffset + pos], size) == 0, "data mismatch at %d", pos);
+        pos += size;
+        t3d_anim_stream_prefetch(&ts.stream);
+      }
+      TEST_CHECK(pos + sizeof(buff) > ts.stream.dataSize, "stopped at %d/%d", pos, ts.stream.dataSize);
+      t3d_anim_stream_rewind(&ts.stream);
+    }
+    t3d_anim_stream_destroy(&ts.stream);
+  }
+}
+
+// two streams on the same file interleaving random operations
+static void test_random(T3DAnimStreamFile *file) {
+  for(uint32_t i=0; i<ITERATIONS; ++i) {
+    TestStream ts[2];
+    test_stream_init(&ts[0], file);
+    test_stream_init(&ts[1], file);
+    for(uint32_t o=0; o<OPS_PER_ITERATION; ++o) {
+      test_stream_step(&ts[test_rand() % 2]);
+    }
+    t3d_anim_stream_destroy(&ts[0].stream);
+    t3d_anim_stream_destroy(&ts[1].stream);
+  }
+}
+
+int main(void)
+{
+  create_file();
+  T3DAnimStreamFile file = {
+    .path = FILE_PATH,
+    .file = fopen(FILE_PATH, "rb"),
+    .refCount = 1,
+    .pos = 0
+  };
+  TEST_CHECK(file.file, "failed to open '%s'", FILE_PATH);
+
+  test_sequential(&file);
+  test_random(&file);
+
+  fclose(file.file);
+  return test_result("anim_stream");
+}
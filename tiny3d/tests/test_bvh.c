@@ -0,0 +1,283 @@
+/**
+* @copyright 2024 - Max Bebök
+* @license MIT
+*/
+
+// Checks BVH queries against testing each object individually.
+// The BVH is built in memory in the same layout the model loader produces (after patching).
+
+#include <t3d/t3dmodel.h>
+#include "test.h"
+
+#define OBJECT_COUNT 300
+#define LEAF_SIZE 3
+#define ITERATIONS 200
+
+typedef struct {
+  uint8_t *buffer;
+  T3DObject *objects; // all objects are right before the BVH
+  T3DBvh *bvh;
+  T3DBvhData *data;
+} TestScene;
+
+static uint32_t order[OBJECT_COUNT];
+static const T3DObject *sortObjects;
+static int sortAxis;
+
+static int compare_center(const void *a, const void *b) {
+  const T3DObject *objA = &sortObjects[*(const uint32_t*)a];
+  const T3DObject *objB = &sortObjects[*(const uint32_t*)b];
+  int centerA = objA->aabbMin[sortAxis] + objA->aabbMax[sortAxis];
+  int centerB = objB->aabbMin[sortAxis] + objB->aabbMax[sortAxis];
+  return (centerA > centerB) - (centerA < centerB);
+}
+
+static void build_node(TestScene *scene, uint32_t nodeIdx, uint32_t *idx, uint32_t count)
+{
+  T3DBvhNode *node = &scene->bvh->nodes[nodeIdx];
+  for(int i=0; i<3; ++i) {
+    node->aabbMin[i] = INT16_MAX;
+    node->aabbMax[i] = INT16_MIN;
+  }
+  for(uint32_t o=0; o<count; ++o) {
+    const T3DObject *obj = &scene->objects[idx[o]];
+    for(int i=0; i<3; ++i) {
+      if(obj->aabbMin[i] < node->aabbMin[i])node->aabbMin[i] = obj->aabbMin[i];
+      if(obj->aabbMax[i] > node->aabbMax[i])node->aabbMax[i] = obj->aabbMax[i];
+    }
+  }
+
+  if(count <= LEAF_SIZE) {
+    uint32_t dataOffset = scene->bvh->dataCount;
+    for(uint32_t o=0; o<count; ++o) {
+      uintptr_t addr = (uintptr_t)scene->bvh - (uintptr_t)&scene->objects[idx[o]];
+      scene->data[scene->bvh->dataCount++].objectPtr = addr >> 2;
+    }
+    node->value = (dataOffset << 4) | count;
+    return;
+  }
+
+  // median split along the longest axis, children are stored next to each other
+  int extent[3];
+  for(int i=0; i<3; ++i)extent[i] = node->aabbMax[i] - node->aabbMin[i];
+  sortAxis = extent[0] > extent[1] ? (extent[0] > extent[2] ? 0 : 2) : (extent[1] > extent[2] ? 1 : 2);
+  sortObjects = scene->objects;
+  qsort(idx, count, sizeof(uint32_t), compare_center);
+
+  uint32_t childIdx = scene->bvh->nodeCount;
+  scene->bvh->nodeCount += 2;
+  node->value = (childIdx - nodeIdx) << 4;
+
+  uint32_t half = count / 2;
+  build_node(scene, childIdx, idx, half);
+  build_node(scene, childIdx + 1, idx + half, count - half);
+}
+
+static TestScene scene_create(void)
+{
+  TestScene scene = {};
+  // BVH offsets are 16bit and shifted by 2, so objects must be within 256KiB before the BVH
+  size_t objectsSize = sizeof(T3DObject) * OBJECT_COUNT;
+  size_t bvhSize = sizeof(T3DBvh) + sizeof(T3DBvhNode) * OBJECT_COUNT * 2 + sizeof(T3DBvhData) * OBJECT_COUNT;
+  TEST_CHECK(objectsSize < 0x40000, "too many objects: %zu bytes", objectsSize);
+
+  scene.buffer = malloc(objectsSize + bvhSize);
+  memset(scene.buffer, 0, objectsSize + bvhSize);
+  scene.objects = (T3DObject*)scene.buffer;
+  scene.bvh = (T3DBvh*)(scene.buffer + objectsSize);
+
+  for(uint32_t o=0; o<OBJECT_COUNT; ++o) {
+    T3DObject *obj = &scene.objects[o];
+    obj->index = o;
+    for(int i=0; i<3; ++i) {
+      int16_t size = (int16_t)test_randf(10.0f, 300.0f);
+      obj->aabbMin[i] = (int16_t)test_randf(-2000.0f, 2000.0f);
+      obj->aabbMax[i] = obj->aabbMin[i] + size;
+    }
+    order[o] = o;
+  }
+
+  // the data is only known after the nodes, build into a temporary list and move it after
+  T3DBvhData *data = malloc(sizeof(T3DBvhData) * OBJECT_COUNT);
+  scene.data = data;
+  scene.bvh->nodeCount = 1;
+  build_node(&scene, 0, order, OBJECT_COUNT);
+
+  scene.data = (T3DBvhData*)&scene.bvh->nodes[scene.bvh->nodeCount];
+  memcpy(scene.data, data, sizeof(T3DBvhData) * scene.bvh->dataCount);
+  free(data);
+
+  // the data offsets are relative to the BVH, so moving the data does not invalidate them
+  TEST_CHECK(scene.bvh->dataCount == OBJECT_COUNT, "data count: %d", scene.bvh->dataCount);
+  return scene;
+}
+
+static void random_frustum(T3DFrustum *frustum)
+{
+  T3DVec3 eye = {{test_randf(-2500.0f, 2500.0f), test_randf(-2500.0f, 2500.0f), test_randf(-2500.0f, 2500.0f)}};
+  T3DVec3 target = {{test_randf(-1000.0f, 1000.0f), test_randf(-1000.0f, 1000.0f), test_randf(-1000.0f, 1000.0f)}};
+  T3DVec3 up = {{0.0f, 1.0f, 0.0f}};
+
+  T3DMat4 matProj, matCam, matCamProj;
+  t3d_mat4_perspective(&matProj, T3D_DEG_TO_RAD(test_randf(30.0f, 90.0f)), 4.0f / 3.0f, 10.0f, test_randf(500.0f, 4000.0f));
+  t3d_mat4_look_at(&matCam, &eye, &target, &up);
+  t3d_mat4_mul(&matCamProj, &matProj, &matCam);
+  t3d_mat4_to_frustum(frustum, &matCamProj);
+}
+
+// reference: test each object on its own, the result is in file order
+static uint32_t query_brute_force(const TestScene *scene, const T3DFrustum *frustum, const uint32_t *pvsRow, T3DObject **out)
+{
+  uint32_t count = 0;
+  for(uint32_t o=0; o<OBJECT_COUNT; ++o) {
+    T3DObject *obj = &scene->objects[o];
+    if(!t3d_model_pvs_is_visible(pvsRow, obj))continue;
+    if(t3d_frustum_vs_aabb_s16(frustum, obj->aabbMin, obj->aabbMax))out[count++] = obj;
+  }
+  return count;
+}
+
+static void check_same_list(T3DObject **res, uint32_t count, T3DObject **ref, uint32_t countRef, const char *name)
+{
+  TEST_CHECK(count == countRef, "%s: count %d, expected %d", name, count, countRef);
+  if(count != countRef)return;
+  for(uint32_t i=0; i<count; ++i) {
+    TEST_CHECK(res[i] == ref[i], "%s: object %d is %d, expected %d", name, i, res[i]->index, ref[i]->index);
+  }
+}
+
+static void test_query_list(const TestScene *scene)
+{
+  T3DObject *res[OBJECT_COUNT];
+  T3DObject *ref[OBJECT_COUNT];
+  uint32_t visibleTotal = 0;
+
+  for(int it=0; it<ITERATIONS; ++it) {
+    T3DFrustum frustum;
+    random_frustum(&frustum);
+
+    uint32_t countRef = query_brute_force(scene, &frustum, NULL, ref);
+    uint32_t count = t3d_model_bvh_query_frustum_list(scene->bvh, &frustum, res, OBJECT_COUNT);
+    check_same_list(res, count, ref, countRef, "list");
+    visibleTotal += countRef;
+
+    // output is limited to 'maxObjects', but must still be sorted
+    uint32_t maxObjects = countRef / 2;
+    count = t3d_model_bvh_query_frustum_list(scene->bvh, &frustum, res, maxObjects);
+    TEST_CHECK(count == maxObjects, "limited: count %d, expected %d", count, maxObjects);
+    for(uint32_t i=1; i<count; ++i) {
+      TEST_CHECK(res[i-1]->index < res[i]->index, "limited: not sorted at %d", i);
+    }
+  }
+
+  // make sure the random frustums actually test something
+  TEST_CHECK(visibleTotal > 0 && visibleTotal < OBJECT_COUNT * ITERATIONS, "visible: %d", visibleTotal);
+}
+
+static void test_query_flags(const TestScene *scene)
+{
+  T3DObject *ref[OBJECT_COUNT];
+  for(int it=0; it<ITERATIONS; ++it) {
+    T3DFrustum frustum;
+    random_frustum(&frustum);
+
+    for(uint32_t o=0; o<OBJECT_COUNT; ++o)scene->objects[o].isVisible = false;
+    uint32_t countRef = query_brute_force(scene, &frustum, NULL, ref);
+    t3d_model_bvh_query_frustum(scene->bvh, &frustum);
+
+    uint32_t r = 0;
+    for(uint32_t o=0; o<OBJECT_COUNT; ++o) {
+      bool isVisibleRef = r < countRef && ref[r] == &scene->objects[o];
+      if(isVisibleRef)++r;
+      TEST_CHECK(scene->objects[o].isVisible == isVisibleRef, "flags: object %d visible: %d", o, scene->objects[o].isVisible);
+    }
+  }
+}
+
+static void test_query_pvs(const TestScene *scene)
+{
+  T3DObject *res[OBJECT_COUNT];
+  T3DObject *ref[OBJECT_COUNT];
+  uint32_t pvsRow[(OBJECT_COUNT + 31) / 32];
+
+  for(int it=0; it<ITERATIONS; ++it) {
+    T3DFrustum frustum;
+    random_frustum(&frustum);
+    for(uint32_t w=0; w<sizeof(pvsRow)/sizeof(pvsRow[0]); ++w)pvsRow[w] = test_rand();
+
+    uint32_t countRef = query_brute_force(scene, &frustum, pvsRow, ref);
+    uint32_t count = t3d_model_bvh_query_frustum_pvs(scene->bvh, &frustum, pvsRow, res, OBJECT_COUNT);
+    check_same_list(res, count, ref, countRef, "pvs");
+
+    // no PVS row (e.g. outside the grid) means everything is potentially visible
+    countRef = query_brute_force(scene, &frustum, NULL, ref);
+    count = t3d_model_bvh_query_frustum_pvs(scene->bvh, &frustum, NULL, res, OBJECT_COUNT);
+    check_same_list(res, count, ref, countRef, "pvs-null");
+  }
+}
+
+static void test_query_frustums(const TestScene *scene)
+{
+  T3DObject *res[OBJECT_COUNT];
+  T3DObject *resViewport[OBJECT_COUNT];
+  T3DObject *ref[T3D_BVH_MAX_FRUSTUMS][OBJECT_COUNT];
+  uint32_t countRef[T3D_BVH_MAX_FRUSTUMS];
+  uint32_t pvsData[T3D_BVH_MAX_FRUSTUMS][(OBJECT_COUNT + 31) / 32];
+  uint8_t viewportMasks[OBJECT_COUNT];
+
+  for(int it=0; it<ITERATIONS; ++it) {
+    uint32_t frustumCount = 1 + (it % T3D_BVH_MAX_FRUSTUMS);
+    T3DFrustum frustums[T3D_BVH_MAX_FRUSTUMS];
+    const uint32_t *pvsRows[T3D_BVH_MAX_FRUSTUMS];
+    bool usePvs = (it & 4) != 0;
+
+    // each frustum gets its own single query as the reference
+    uint8_t maskRef[OBJECT_COUNT] = {};
+    for(uint32_t f=0; f<frustumCount; ++f) {
+      random_frustum(&frustums[f]);
+      for(uint32_t w=0; w<sizeof(pvsData[f])/sizeof(pvsData[f][0]); ++w)pvsData[f][w] = test_rand();
+      pvsRows[f] = (f & 1) ? NULL : pvsData[f]; // mix in viewports outside the PVS grid
+
+      if(usePvs) {
+        countRef[f] = t3d_model_bvh_query_frustum_pvs(scene->bvh, &frustums[f], pvsRows[f], ref[f], OBJECT_COUNT);
+      } else {
+        countRef[f] = t3d_model_bvh_query_frustum_list(scene->bvh, &frustums[f], ref[f], OBJECT_COUNT);
+      }
+      for(uint32_t i=0; i<countRef[f]; ++i)maskRef[ref[f][i]->index] |= 1 << f;
+    }
+
+    memset(viewportMasks, 0xFF, sizeof(viewportMasks));
+    uint32_t count = t3d_model_bvh_query_frustums(
+      scene->bvh, frustums, usePvs ? pvsRows : NULL, frustumCount, viewportMasks, res, OBJECT_COUNT
+    );
+
+    // result is the union of all single queries in file order, masks tell which frustum saw an object
+    uint32_t r = 0;
+    for(uint32_t o=0; o<OBJECT_COUNT; ++o) {
+      if(!maskRef[o])continue;
+      TEST_CHECK(r < count && res[r] == &scene->objects[o], "frustums: missing object %d", o);
+      if(r < count && res[r] == &scene->objects[o]) {
+        TEST_CHECK(viewportMasks[o] == maskRef[o], "frustums: object %d mask %02X, expected %02X", o, viewportMasks[o], maskRef[o]);
+      }
+      ++r;
+    }
+    TEST_CHECK(count == r, "frustums: count %d, expected %d", count, r);
+    if(count != r)continue;
+
+    for(uint32_t f=0; f<frustumCount; ++f) {
+      uint32_t countViewport = t3d_model_objects_filter_viewport(res, count, viewportMasks, f, resViewport);
+      check_same_list(resViewport, countViewport, ref[f], countRef[f], "filter-viewport");
+    }
+  }
+}
+
+int main(void)
+{
+  TestScene scene = scene_create();
+  test_query_list(&scene);
+  test_query_flags(&scene);
+  test_query_pvs(&scene);
+  test_query_frustums(&scene);
+  free(scene.buffer);
+  return test_result("bvh");
+}
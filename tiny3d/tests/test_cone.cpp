@@ -0,0 +1,177 @@
+/**
+* @copyright 2024 - Max Bebök
+* @license MIT
+*/
+
+// Checks the normal cones created by the importer against culling each triangle on its own.
+// Parts are culled at runtime if all triangles face away from the camera, a cone must never cull a part
+// with a visible triangle. Parts range from flat to bumpy patches, and random triangle soups.
+
+#include <cmath>
+#include <random>
+#include <vector>
+#include "structs.h"
+#include "optimizer/optimizer.h"
+#include <t3d/t3dmodel.h>
+#include "test.h"
+
+Config config;
+
+namespace {
+  constexpr int ITERATIONS = 2000;
+  constexpr int CAMERAS_PER_PART = 50;
+  constexpr int GRID_SIZE = 5;
+  constexpr float GRID_SPACING = 100.0f;
+
+  std::mt19937 rng{1};
+  std::uniform_real_distribution<float> randf{-1.0f, 1.0f};
+
+  Vec3 randomDir() {
+    for(;;) {
+      Vec3 dir{randf(rng), randf(rng), randf(rng)};
+      if(dir.length() > 0.01f)return dir.normalize();
+    }
+  }
+
+  void addVertex(ModelChunked &model, const Vec3 &pos) {
+    VertexT3D v{};
+    for(int i=0; i<3; ++i)v.pos[i] = (int16_t)roundf(pos[i]);
+    model.vertices.push_back(v);
+  }
+
+  // grid of quads around a random plane, 'bump' moves vertices along the normal
+  void addPatch(ModelChunked &model, MeshChunk &chunk, float bump) {
+    Vec3 normal = randomDir();
+    Vec3 tangent = (fabsf(normal.y()) < 0.9f ? Vec3{0, 1, 0} : Vec3{1, 0, 0}).cross(normal).normalize();
+    Vec3 bitangent = normal.cross(tangent);
+    Vec3 origin{randf(rng) * 3000.0f, randf(rng) * 3000.0f, randf(rng) * 3000.0f};
+
+    chunk.vertexOffset = model.vertices.size();
+    for(int y=0; y<GRID_SIZE; ++y) {
+      for(int x=0; x<GRID_SIZE; ++x) {
+        addVertex(model, origin + tangent * (x * GRID_SPACING) + bitangent * (y * GRID_SPACING)
+          + normal * (randf(rng) * GRID_SPACING * bump));
+      }
+    }
+    for(int y=0; y<GRID_SIZE-1; ++y) {
+      for(int x=0; x<GRID_SIZE-1; ++x) {
+        int i = y * GRID_SIZE + x;
+        int8_t tris[6] = {(int8_t)i, (int8_t)(i+1), (int8_t)(i+GRID_SIZE), (int8_t)(i+1), (int8_t)(i+GRID_SIZE+1), (int8_t)(i+GRID_SIZE)};
+        chunk.indices.insert(chunk.indices.end(), tris, tris + 6);
+      }
+    }
+  }
+
+  // a few triangles with mostly similar normals, but random positions
+  void addSoup(ModelChunked &model, MeshChunk &chunk) {
+    Vec3 normal = randomDir();
+    Vec3 origin{randf(rng) * 3000.0f, randf(rng) * 3000.0f, randf(rng) * 3000.0f};
+    int triCount = 1 + (int)(rng() % 16);
+
+    chunk.vertexOffset = model.vertices.size();
+    for(int t=0; t<triCount; ++t) {
+      Vec3 triNormal = (normal + randomDir() * 0.4f).normalize();
+      Vec3 tangent = randomDir().cross(triNormal).normalize();
+      Vec3 bitangent = triNormal.cross(tangent);
+      Vec3 pos = origin + randomDir() * (randf(rng) * 500.0f);
+      addVertex(model, pos);
+      addVertex(model, pos + tangent * 80.0f);
+      addVertex(model, pos + bitangent * 80.0f);
+      chunk.indices.insert(chunk.indices.end(), {(int8_t)(t*3), (int8_t)(t*3+1), (int8_t)(t*3+2)});
+    }
+  }
+
+  Vec3 getPos(const ModelChunked &model, const MeshChunk &chunk, int idx) {
+    const auto &v = model.vertices[chunk.vertexOffset + chunk.indices[idx]];
+    return {(float)v.pos[0], (float)v.pos[1], (float)v.pos[2]};
+  }
+
+  // counter-clockwise triangles face the camera, as in glTF
+  bool isPartCulled(const ModelChunked &model, const MeshChunk &chunk, const Vec3 &camPos) {
+    uint32_t cullFlags = chunk.material.drawFlags & (DrawFlags::CULL_BACK | DrawFlags::CULL_FRONT);
+    if(cullFlags == 0)return false;
+
+    for(size_t i=0; i<chunk.indices.size(); i+=3) {
+      Vec3 p0 = getPos(model, chunk, i);
+      Vec3 normal = (getPos(model, chunk, i+1) - p0).cross(getPos(model, chunk, i+2) - p0);
+      float side = (p0 - camPos).dot(normal);
+      bool culled = cullFlags == DrawFlags::CULL_BACK ? side >= 0.0f : side <= 0.0f;
+      if(!culled)return false;
+    }
+    return true;
+  }
+
+  T3DObjectPart toRuntimePart(const MeshChunk &chunk) {
+    T3DObjectPart part{};
+    for(int i=0; i<3; ++i) {
+      part.coneAxis[i] = chunk.coneAxis[i];
+      part.sphereCenter[i] = chunk.sphereCenter[i];
+    }
+    part.coneCutoff = chunk.coneCutoff;
+    part.sphereRadius = chunk.sphereRadius;
+    return part;
+  }
+}
+
+int main()
+{
+  int partCount = 0, coneCount = 0;
+  int testCount = 0, cullCount = 0, cullExpected = 0;
+
+  for(int iter=0; iter<ITERATIONS; ++iter)
+  {
+    // multiple parts in one model, each with its own vertex range
+    ModelChunked model{};
+    static const uint32_t CULL_FLAGS[] = {DrawFlags::CULL_BACK, DrawFlags::CULL_FRONT, 0};
+    for(int c=0; c<3; ++c) {
+      MeshChunk chunk{};
+      chunk.boneIndex = 0xFFFFFFFF;
+      chunk.material.drawFlags = DrawFlags::DEPTH | CULL_FLAGS[(iter + c) % 3];
+      if(c == 2) {
+        addSoup(model, chunk);
+      } else {
+        addPatch(model, chunk, (float)(iter % 4) * 0.2f);
+      }
+      chunk.vertexCount = model.vertices.size() - chunk.vertexOffset;
+      model.chunks.push_back(chunk);
+    }
+    createChunkCones(model);
+
+    for(const auto &chunk : model.chunks) {
+      ++partCount;
+      if(chunk.coneCutoff != 127)++coneCount;
+      if((chunk.material.drawFlags & (DrawFlags::CULL_BACK | DrawFlags::CULL_FRONT)) == 0) {
+        TEST_CHECK(chunk.coneCutoff == 127, "part without culling has a cone (cutoff: %d)", chunk.coneCutoff);
+        continue;
+      }
+
+      // the sphere has to enclose all vertices, even after rounding
+      for(size_t i=0; i<chunk.indices.size(); ++i) {
+        Vec3 center{(float)chunk.sphereCenter[0], (float)chunk.sphereCenter[1], (float)chunk.sphereCenter[2]};
+        float dist = (getPos(model, chunk, i) - center).length();
+        TEST_CHECK(dist <= chunk.sphereRadius, "vertex outside of the sphere: %f > %d", dist, chunk.sphereRadius);
+      }
+
+      T3DObjectPart part = toRuntimePart(chunk);
+      for(int s=0; s<CAMERAS_PER_PART; ++s) {
+        // cameras anywhere in the level, and close to the part
+        Vec3 camPos = (s % 2)
+          ? Vec3{randf(rng) * 8000.0f, randf(rng) * 8000.0f, randf(rng) * 8000.0f}
+          : getPos(model, chunk, 0) + randomDir() * (randf(rng) * 600.0f + 600.0f);
+        T3DVec3 camPosT3D{{camPos[0], camPos[1], camPos[2]}};
+
+        bool culled = t3d_model_part_is_backfacing(&part, &camPosT3D);
+        bool expected = isPartCulled(model, chunk, camPos);
+        TEST_CHECK(!culled || expected, "part culled with visible triangles (camera: %.1f %.1f %.1f)", camPos[0], camPos[1], camPos[2]);
+
+        ++testCount;
+        if(culled)++cullCount;
+        if(expected)++cullExpected;
+      }
+    }
+  }
+
+  printf("  %d/%d parts with a cone, %d/%d culled (brute-force: %d)\n", coneCount, partCount, cullCount, testCount, cullExpected);
+  TEST_CHECK(cullCount > cullExpected / 4, "cones are too conservative: %d/%d culled", cullCount, cullExpected);
+  return test_result("cone");
+}
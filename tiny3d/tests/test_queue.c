@@ -0,0 +1,380 @@
+/**
+* @copyright 2024 - Max Bebök
+* @license MIT
+*/
+
+// Checks the render queue against the state each material requires.
+// rdpq and the t3d commands are mocked to track the resulting state instead of emitting commands,
+// at every object drawn, that state has to match its material regardless of what was skipped as redundant.
+// Lighting is switched for materials with baked lighting, but never inside a recorded block.
+
+#include <t3d/t3dqueue.h>
+#include <stdarg.h>
+#include "test.h"
+
+#define MATERIAL_COUNT 12
+#define OBJECT_COUNT 120
+#define TEXTURE_COUNT 4
+#define MATRIX_COUNT 3
+#define ITERATIONS 50
+
+// state as seen by the hardware, changed by the mocks below
+typedef struct {
+  uint64_t combiner;
+  uint32_t blender;
+  uint64_t som;
+  color_t primColor, envColor, blendColor;
+  const sprite_t *tiles[2];
+  float tileTranslate[2];
+  uint32_t drawFlags;
+  uint8_t vertexFx;
+  int16_t vertexFxArgs[2];
+  bool fogEnabled;
+  bool lightDisabled;
+  uint32_t lightChanges;
+  uint32_t texUploads;
+  const T3DMat4FP *matrixStack[8];
+  int matrixDepth;
+} MockState;
+
+typedef struct {
+  const T3DObject *object;
+  const T3DMat4FP *matrix;
+  MockState state;
+} DrawCall;
+
+uint32_t T3D_RSP_ID = 0;
+
+static MockState mock;
+static bool isRecording;
+static DrawCall drawCalls[OBJECT_COUNT * 2];
+static uint32_t drawCount;
+static T3DObject *drawObjects[OBJECT_COUNT]; // maps vertex pointers back to objects
+static T3DVertPacked verts[OBJECT_COUNT];
+static void *sprites[TEXTURE_COUNT];
+
+static T3DMaterial materials[MATERIAL_COUNT];
+static T3DObject *objects[OBJECT_COUNT];
+static T3DMat4FP matrices[MATRIX_COUNT];
+static const char* const TEXTURE_PATHS[TEXTURE_COUNT] = {"rom:/a.sprite", "rom:/b.sprite", "rom:/c.sprite", "rom:/d.sprite"};
+
+/* ---- rdpq ---- */
+
+void rdpq_sync_tile(void) {}
+void rdpq_sync_pipe(void) {}
+void rdpq_sync_load(void) {}
+void rdpq_tex_multi_begin(void) {}
+int rdpq_tex_multi_end(void) { return 0; }
+void rdpq_mode_combiner(rdpq_combiner_t comb) { mock.combiner = comb; }
+void rdpq_mode_blender(rdpq_blender_t blend) { mock.blender = blend; }
+void rdpq_set_prim_color(color_t color) { mock.primColor = color; }
+void rdpq_set_env_color(color_t color) { mock.envColor = color; }
+void rdpq_set_blend_color(color_t color) { mock.blendColor = color; }
+void __rdpq_mode_change_som(uint64_t mask, uint64_t val) { mock.som = (mock.som & ~mask) | (val & mask); }
+
+void rdpq_tex_reuse(rdpq_tile_t tile, const rdpq_texparms_t *parms) {
+  mock.tiles[tile] = mock.tiles[TILE0];
+  mock.tileTranslate[tile] = parms->s.translate;
+}
+
+int rdpq_sprite_upload(rdpq_tile_t tile, sprite_t *sprite, const rdpq_texparms_t *parms) {
+  mock.tiles[tile] = sprite;
+  mock.tileTranslate[tile] = parms->s.translate;
+  ++mock.texUploads;
+  return 0;
+}
+
+/* ---- rspq & assets ---- */
+
+void rspq_call_deferred(void (*func)(void*), void *arg) { func(arg); }
+void rspq_block_begin(void) { isRecording = true; }
+rspq_block_t* rspq_block_end(void) { isRecording = false; return NULL; }
+void rspq_block_run(rspq_block_t *block) { (void)block; }
+void rspq_block_free(rspq_block_t *block) { (void)block; }
+
+void rspq_write(uint32_t ovl, uint32_t cmd, ...) {
+  (void)ovl;
+  if(cmd == T3D_CMD_FOG_STATE) {
+    va_list args;
+    va_start(args, cmd);
+    mock.fogEnabled = va_arg(args, uint32_t) == 0x08;
+    va_end(args);
+  }
+}
+
+void* asset_load(const char *fn, int *sz) { (void)fn; (void)sz; return NULL; }
+
+sprite_t *sprite_load(const char *fn) {
+  for(int i=0; i<TEXTURE_COUNT; ++i) {
+    if(strcmp(fn, TEXTURE_PATHS[i]) == 0) {
+      TEST_CHECK(sprites[i] == NULL, "texture '%s' loaded twice", fn);
+      sprites[i] = malloc(64);
+      return (sprite_t*)sprites[i];
+    }
+  }
+  TEST_CHECK(false, "unknown texture '%s'", fn);
+  return NULL;
+}
+void sprite_free(sprite_t *sprite) { (void)sprite; }
+
+/* ---- t3d ---- */
+
+void t3d_light_set_enabled(bool enabled) {
+  TEST_CHECK(!isRecording, "lighting changed inside a block");
+  TEST_CHECK(mock.lightDisabled == enabled, "lighting set to the same state");
+  mock.lightDisabled = !enabled;
+  ++mock.lightChanges;
+}
+void t3d_state_set_drawflags(enum T3DDrawFlags drawFlags) { mock.drawFlags = drawFlags; }
+void t3d_state_set_vertex_fx(enum T3DVertexFX func, int16_t arg0, int16_t arg1) {
+  mock.vertexFx = func;
+  mock.vertexFxArgs[0] = arg0;
+  mock.vertexFxArgs[1] = arg1;
+}
+
+void t3d_matrix_push(const T3DMat4FP *mat) { mock.matrixStack[++mock.matrixDepth] = mat; }
+void t3d_matrix_set(const T3DMat4FP *mat, bool doMultiply) { (void)doMultiply; mock.matrixStack[mock.matrixDepth] = mat; }
+void t3d_matrix_pop(int count) {
+  mock.matrixDepth -= count;
+  TEST_CHECK(mock.matrixDepth >= 0, "matrix stack underflow");
+}
+
+void t3d_vert_load(const T3DVertPacked *vertices, uint32_t offset, uint32_t count) {
+  (void)offset; (void)count;
+  drawCalls[drawCount++] = (DrawCall){
+    .object = drawObjects[vertices - verts],
+    .matrix = mock.matrixStack[mock.matrixDepth],
+    .state = mock,
+  };
+}
+
+void t3d_tri_draw(uint32_t v0, uint32_t v1, uint32_t v2) { (void)v0; (void)v1; (void)v2; }
+void t3d_tri_draw_strip(int16_t* indexBuff, int count) { (void)indexBuff; (void)count; }
+void t3d_indexbuffer_convert(int16_t indices[], int count) { (void)indices; (void)count; }
+
+/* ---- test ---- */
+
+static void create_scene(void) {
+  static const uint64_t COMBINERS[] = {0x11, 0x22, 0x33};
+  static const uint32_t BLENDERS[] = {0x100, 0x200, 0x300 | SOM_READ_ENABLE};
+  static const uint64_t OTHER_MODES[] = {0x1000, 0x2000 | SOM_ALPHACOMPARE_THRESHOLD, 0x4000};
+
+  for(int m=0; m<MATERIAL_COUNT; ++m) {
+    T3DMaterial *mat = &materials[m];
+    *mat = (T3DMaterial){
+      .colorCombiner = COMBINERS[test_rand() % 3],
+      .otherModeValue = OTHER_MODES[test_rand() % 3],
+      .otherModeMask = 0xFFFF,
+      .blendMode = BLENDERS[test_rand() % 3],
+      .renderFlags = T3D_FLAG_DEPTH | T3D_FLAG_SHADED | ((test_rand() % 2) ? T3D_FLAG_TEXTURED : 0),
+      .fogMode = test_rand() % 3,
+      .setColorFlags = test_rand() % 16,
+      .vertexFxFunc = (test_rand() % 4 == 0) ? T3D_VERTEX_FX_SPHERICAL_UV : T3D_VERTEX_FX_NONE,
+      .primColor = RGBA32(test_rand() % 2, 0x10, 0x20, 0xFF),
+      .envColor = RGBA32(test_rand() % 2, 0x30, 0x40, 0xFF),
+      .blendColor = RGBA32(test_rand() % 2, 0x50, 0x60, 0xFF),
+    };
+
+    // some materials share textures (with the same or other tile settings), or use the same one in both tiles
+    uint32_t texA = test_rand() % (TEXTURE_COUNT + 1);
+    uint32_t texB = (test_rand() % 3 == 0) ? texA : (test_rand() % (TEXTURE_COUNT + 1));
+    if(texA < TEXTURE_COUNT) {
+      mat->textureA = (T3DMaterialTexture){.texPath = (char*)TEXTURE_PATHS[texA], .textureHash = 0x1000 + texA,
+        .texWidth = 32, .texHeight = (uint16_t)(16 << texA), .s = {.low = (float)(test_rand() % 2)}};
+    }
+    if(texB < TEXTURE_COUNT) {
+      mat->textureB = (T3DMaterialTexture){.texPath = (char*)TEXTURE_PATHS[texB], .textureHash = 0x1000 + texB,
+        .texWidth = 32, .texHeight = (uint16_t)(16 << texB), .s = {.low = (float)(test_rand() % 2)}};
+    }
+  }
+
+  for(int o=0; o<OBJECT_COUNT; ++o) {
+    T3DObject *obj = calloc(1, sizeof(T3DObject) + sizeof(T3DObjectPart));
+    obj->numParts = 1;
+    obj->material = (o % 40 == 39) ? NULL : &materials[test_rand() % MATERIAL_COUNT];
+    obj->parts[0] = (T3DObjectPart){.vert = &verts[o], .vertLoadCount = 3, .matrixIdx = 0xFFFF};
+    objects[o] = obj;
+    drawObjects[o] = obj;
+  }
+}
+
+static void check_material_state(const DrawCall *call) {
+  const T3DMaterial *mat = call->object->material;
+  const MockState *s = &call->state;
+  int idx = (int)(mat - materials);
+
+  TEST_CHECK(s->drawFlags == mat->renderFlags, "mat %d: draw flags %08X, expected %08X", idx, s->drawFlags, mat->renderFlags);
+  TEST_CHECK(s->lightDisabled == t3d_model_material_is_unlit(mat), "mat %d: lighting %d", idx, !s->lightDisabled);
+  TEST_CHECK(s->vertexFx == mat->vertexFxFunc, "mat %d: vertex-fx %d, expected %d", idx, s->vertexFx, mat->vertexFxFunc);
+  if(mat->vertexFxFunc) {
+    TEST_CHECK(s->vertexFxArgs[0] == mat->textureA.texWidth && s->vertexFxArgs[1] == mat->textureA.texHeight,
+      "mat %d: vertex-fx args %d %d", idx, s->vertexFxArgs[0], s->vertexFxArgs[1]);
+  }
+  if(mat->fogMode != T3D_FOG_MODE_DEFAULT) {
+    TEST_CHECK(s->fogEnabled == (mat->fogMode == T3D_FOG_MODE_ACTIVE), "mat %d: fog %d", idx, s->fogEnabled);
+  }
+
+  TEST_CHECK(s->combiner == mat->colorCombiner, "mat %d: combiner %lX", idx, (unsigned long)s->combiner);
+  TEST_CHECK(s->blender == mat->blendMode, "mat %d: blender %X", idx, s->blender);
+  TEST_CHECK((s->som & mat->otherModeMask) == (mat->otherModeValue & mat->otherModeMask), "mat %d: othermode %lX", idx, (unsigned long)s->som);
+
+  if(mat->setColorFlags & 0b001)TEST_CHECK(color_to_packed32(s->primColor) == color_to_packed32(mat->primColor), "mat %d: prim color", idx);
+  if(mat->setColorFlags & 0b010)TEST_CHECK(color_to_packed32(s->envColor) == color_to_packed32(mat->envColor), "mat %d: env color", idx);
+  if((mat->setColorFlags & 0b100) || (mat->otherModeValue & SOM_ALPHACOMPARE_THRESHOLD)) {
+    TEST_CHECK(color_to_packed32(s->blendColor) == color_to_packed32(mat->blendColor), "mat %d: blend color", idx);
+  }
+
+  const T3DMaterialTexture *tex[2] = {&mat->textureA, &mat->textureB};
+  for(int t=0; t<2; ++t) {
+    if(!tex[t]->texPath)continue;
+    TEST_CHECK(s->tiles[t] == (const sprite_t*)sprites[tex[t]->textureHash - 0x1000], "mat %d: wrong texture in tile %d", idx, t);
+    TEST_CHECK(s->tileTranslate[t] == tex[t]->s.low, "mat %d: wrong settings in tile %d", idx, t);
+  }
+}
+
+// lighting is only switched when an unlit material follows a lit one or vice versa, and enabled again at the end
+static void check_lighting(void) {
+  uint32_t expectedChanges = 0;
+  bool lastUnlit = false;
+  for(uint32_t i=0; i<drawCount; ++i) {
+    const T3DMaterial *mat = drawCalls[i].object->material;
+    if(!mat)continue;
+    if(t3d_model_material_is_unlit(mat) != lastUnlit)++expectedChanges;
+    lastUnlit = t3d_model_material_is_unlit(mat);
+  }
+  if(lastUnlit)++expectedChanges;
+
+  TEST_CHECK(mock.lightChanges == expectedChanges, "lighting changed %d times, expected %d", mock.lightChanges, expectedChanges);
+  TEST_CHECK(!mock.lightDisabled, "lighting not enabled again");
+}
+
+static void check_draw(const T3DRenderQueue *queue) {
+  // opaque objects first, transparent ones in the order they were added
+  bool isDrawn[OBJECT_COUNT] = {};
+  uint32_t lastOrder = 0;
+
+  TEST_CHECK(drawCount == queue->count + queue->countTransp, "%d objects drawn, expected %d", drawCount, queue->count + queue->countTransp);
+  for(uint32_t i=0; i<drawCount; ++i) {
+    const DrawCall *call = &drawCalls[i];
+    const T3DRenderItem *item = (i < queue->count) ? &queue->items[i] : &queue->itemsTransp[i - queue->count];
+    bool isTransp = i >= queue->count;
+
+    TEST_CHECK(call->object == item->object, "draw %d: wrong object", i);
+    TEST_CHECK(call->matrix == item->matrix, "draw %d: wrong matrix", i);
+    TEST_CHECK(t3d_model_material_is_transparent(call->object->material) == isTransp, "draw %d: transparency", i);
+
+    uint32_t objIdx = (uint32_t)(call->object->parts[0].vert - verts);
+    TEST_CHECK(!isDrawn[objIdx], "object %d drawn twice", objIdx);
+    isDrawn[objIdx] = true;
+
+    if(call->object->material)check_material_state(call);
+
+    if(!isTransp && i > 0) {
+      const T3DRenderItem *prev = &queue->items[i-1];
+      TEST_CHECK(prev->sortKey <= item->sortKey, "draw %d: not sorted by key", i);
+      // objects of a material are drawn together, in the order they were added
+      if(prev->object->material == item->object->material) {
+        TEST_CHECK(prev->order < item->order, "draw %d: order not stable", i);
+      } else {
+        for(uint32_t j=0; j<i; ++j) {
+          TEST_CHECK(queue->items[j].object->material != item->object->material, "draw %d: material split up", i);
+        }
+      }
+    }
+    if(isTransp) {
+      TEST_CHECK(i == queue->count || item->order > lastOrder, "draw %d: transparent objects reordered", i);
+      lastOrder = item->order;
+    }
+  }
+
+  // textures are only uploaded if they or their settings change between objects
+  uint32_t opaqueUploads = queue->count ? drawCalls[queue->count - 1].state.texUploads : 0;
+  uint32_t expectedUploads = 0;
+  const T3DMaterial *lastMat = NULL;
+  for(uint32_t i=0; i<queue->count; ++i) {
+    const T3DMaterial *mat = queue->items[i].object->material;
+    if(!mat)continue;
+    bool isSame = lastMat
+      && lastMat->textureA.textureHash == mat->textureA.textureHash && lastMat->textureB.textureHash == mat->textureB.textureHash
+      && lastMat->textureA.s.low == mat->textureA.s.low && lastMat->textureB.s.low == mat->textureB.s.low;
+    if(!isSame) {
+      // the same texture in both tiles is only uploaded once
+      if(mat->textureA.texPath)++expectedUploads;
+      if(mat->textureB.texPath && mat->textureB.textureHash != mat->textureA.textureHash)++expectedUploads;
+    }
+    lastMat = mat;
+  }
+  TEST_CHECK(opaqueUploads == expectedUploads, "%d texture uploads, expected %d", opaqueUploads, expectedUploads);
+
+  TEST_CHECK(mock.matrixDepth == 0, "matrix stack not restored: %d", mock.matrixDepth);
+  TEST_CHECK(mock.vertexFx == T3D_VERTEX_FX_NONE, "vertex-fx not reset");
+  check_lighting();
+}
+
+// same objects without the queue, this goes through the path of 't3d_model_draw_custom'
+static void check_draw_objects(T3DObject **list, uint32_t count) {
+  mock = (MockState){.som = ~0ull};
+  drawCount = 0;
+  t3d_model_draw_objects(list, count, (T3DModelDrawConf){});
+
+  TEST_CHECK(drawCount == count, "%d objects drawn, expected %d", drawCount, count);
+  for(uint32_t i=0; i<drawCount; ++i) {
+    TEST_CHECK(drawCalls[i].object == list[i], "draw %d: wrong object", i);
+    if(list[i]->material)check_material_state(&drawCalls[i]);
+  }
+  check_lighting();
+}
+
+// 't3d_model_draw_compiled' records materials into blocks, switching the lighting there would be replayed as is
+static void check_material_blocks(void) {
+  for(int m=0; m<MATERIAL_COUNT; ++m) {
+    mock = (MockState){.som = ~0ull};
+    T3DModelState state = t3d_model_state_create();
+    rspq_block_begin();
+      t3d_model_draw_material(&materials[m], &state);
+    rspq_block_end();
+    TEST_CHECK(mock.lightChanges == 0, "mat %d: lighting changed while recording", m);
+  }
+}
+
+int main(void)
+{
+  create_scene();
+  check_material_blocks();
+
+  T3DRenderQueue queue;
+  t3d_render_queue_init(&queue);
+
+  for(uint32_t it=0; it<ITERATIONS; ++it) {
+    t3d_render_queue_clear(&queue);
+    // random subset of objects in a random order, each object once since draws are identified by the object
+    uint32_t order[OBJECT_COUNT];
+    for(uint32_t o=0; o<OBJECT_COUNT; ++o)order[o] = o;
+    for(uint32_t o=OBJECT_COUNT-1; o>0; --o) {
+      uint32_t r = test_rand() % (o + 1);
+      uint32_t tmp = order[o]; order[o] = order[r]; order[r] = tmp;
+    }
+    uint32_t count = test_rand() % OBJECT_COUNT;
+    for(uint32_t i=0; i<count; ++i) {
+      uint32_t m = test_rand() % (MATRIX_COUNT + 1);
+      t3d_render_queue_add_object(&queue, objects[order[i]], m < MATRIX_COUNT ? &matrices[m] : NULL, NULL);
+    }
+
+    // draw twice, e.g. for split-screen, each with a fresh state on the hardware side
+    for(int d=0; d<2; ++d) {
+      mock = (MockState){.som = ~0ull};
+      drawCount = 0;
+      t3d_render_queue_draw(&queue, (T3DModelDrawConf){});
+      check_draw(&queue);
+    }
+
+    T3DObject *list[OBJECT_COUNT];
+    for(uint32_t i=0; i<count; ++i)list[i] = objects[order[i]];
+    check_draw_objects(list, count);
+  }
+
+  t3d_render_queue_destroy(&queue);
+  for(int o=0; o<OBJECT_COUNT; ++o)free(objects[o]);
+  for(int t=0; t<TEXTURE_COUNT; ++t)free(sprites[t]); // still referenced by the global texture cache
+  return test_result("queue");
+}
@@ -0,0 +1,123 @@
+/**
+* @copyright 2024 - Max Bebök
+* @license MIT
+*/
+
+// Checks the radix sort of transparent objects against a stable insertion sort of the same depth keys.
+// Opaque objects have to keep their order, transparent ones are sorted back-to-front,
+// with objects of the same (quantized) depth staying in the order they were passed in.
+
+#include <t3d/t3dmodel.h>
+#include "test.h"
+
+#define OBJECT_COUNT 600
+#define ITERATIONS 500
+
+static T3DObject objects[OBJECT_COUNT];
+static T3DMaterial matOpaque, matTransp;
+
+static float get_depth(const T3DObject *obj, const T3DVec3 *camPos, const T3DVec3 *camDir) {
+  float depth = 0.0f;
+  for(int i=0; i<3; ++i) {
+    depth += ((obj->aabbMin[i] + obj->aabbMax[i]) * 0.5f - camPos->v[i]) * camDir->v[i];
+  }
+  return depth;
+}
+
+// stable sort by the same 16-bit key the runtime uses, the furthest object gets 0
+static uint32_t sort_brute_force(T3DObject **list, uint32_t count, const T3DVec3 *camPos, const T3DVec3 *camDir) {
+  uint32_t opaqueCount = 0;
+  T3DObject *transp[OBJECT_COUNT];
+  uint32_t keys[OBJECT_COUNT];
+  uint32_t transpCount = 0;
+  float depthMin = INFINITY, depthMax = -INFINITY;
+
+  for(uint32_t i=0; i<count; ++i) {
+    if(!t3d_model_material_is_transparent(list[i]->material)) {
+      list[opaqueCount++] = list[i];
+      continue;
+    }
+    float depth = get_depth(list[i], camPos, camDir);
+    depthMin = fminf(depthMin, depth);
+    depthMax = fmaxf(depthMax, depth);
+    transp[transpCount++] = list[i];
+  }
+
+  float depthScale = depthMax > depthMin ? 65535.0f / (depthMax - depthMin) : 0.0f;
+  for(uint32_t i=0; i<transpCount; ++i) {
+    float key = (depthMax - get_depth(transp[i], camPos, camDir)) * depthScale;
+    keys[i] = key < 65535.0f ? (uint32_t)key : 0xFFFF;
+  }
+
+  for(uint32_t i=1; i<transpCount; ++i) {
+    T3DObject *obj = transp[i];
+    uint32_t key = keys[i];
+    uint32_t j = i;
+    for(; j>0 && keys[j-1] > key; --j) {
+      transp[j] = transp[j-1];
+      keys[j] = keys[j-1];
+    }
+    transp[j] = obj;
+    keys[j] = key;
+  }
+
+  memcpy(&list[opaqueCount], transp, transpCount * sizeof(T3DObject*));
+  return opaqueCount;
+}
+
+static void randomize_objects(uint32_t count, uint32_t iter) {
+  for(uint32_t i=0; i<count; ++i) {
+    T3DObject *obj = &objects[i];
+    uint32_t type = test_rand() % 8;
+    obj->material = type < 2 ? &matOpaque : (type < 3 ? NULL : &matTransp);
+    obj->index = i;
+
+    // small objects on a coarse grid, to get many objects with the same depth
+    bool coarse = iter % 3 == 0;
+    for(int a=0; a<3; ++a) {
+      obj->aabbMin[a] = coarse ? (int16_t)((test_rand() % 8) * 100) : (int16_t)(test_rand() % 2000 - 1000);
+      obj->aabbMax[a] = obj->aabbMin[a] + (coarse ? 10 : (int16_t)(test_rand() % ((iter % 2) ? 5 : 500)));
+    }
+  }
+}
+
+int main(void)
+{
+  matOpaque.blendMode = 0;
+  matTransp.blendMode = SOM_READ_ENABLE;
+
+  for(uint32_t iter=0; iter<ITERATIONS; ++iter) {
+    uint32_t count = test_rand() % OBJECT_COUNT;
+    randomize_objects(count, iter);
+
+    T3DVec3 camPos = {{test_randf(-1000.0f, 1000.0f), test_randf(-1000.0f, 1000.0f), test_randf(-1000.0f, 1000.0f)}};
+    T3DVec3 camDir = {{test_randf(-1.0f, 1.0f), test_randf(-1.0f, 1.0f), test_randf(0.01f, 1.0f)}};
+    t3d_vec3_norm(&camDir);
+    if(iter % 5 == 0)camDir = (T3DVec3){{0.0f, 0.0f, 1.0f}}; // axis aligned, many equal depths
+
+    T3DObject *list[OBJECT_COUNT], *expected[OBJECT_COUNT], *tmp[OBJECT_COUNT];
+    uint32_t tmpKeys[OBJECT_COUNT * 2];
+    for(uint32_t i=0; i<count; ++i)list[i] = expected[i] = &objects[i];
+
+    uint32_t opaqueCount = t3d_model_objects_sort_transparent(list, count, &camPos, &camDir, tmp, tmpKeys);
+    uint32_t expectedOpaque = sort_brute_force(expected, count, &camPos, &camDir);
+
+    TEST_CHECK(opaqueCount == expectedOpaque, "opaque count %d, expected %d", opaqueCount, expectedOpaque);
+    for(uint32_t i=0; i<count; ++i) {
+      TEST_CHECK(list[i] == expected[i], "iteration %d, object %d: got %d, expected %d (opaque: %d)",
+        iter, i, list[i]->index, expected[i]->index, expectedOpaque);
+    }
+
+    // independent of the keys, depth may only increase within the quantization error
+    float depthRange = 0.0f;
+    for(uint32_t i=opaqueCount; i<count; ++i) {
+      depthRange = fmaxf(depthRange, fabsf(get_depth(list[i], &camPos, &camDir) - get_depth(list[opaqueCount], &camPos, &camDir)));
+    }
+    for(uint32_t i=opaqueCount+1; i<count; ++i) {
+      float depthA = get_depth(list[i-1], &camPos, &camDir);
+      float depthB = get_depth(list[i], &camPos, &camDir);
+      TEST_CHECK(depthB <= depthA + depthRange / 65535.0f * 2.0f + 0.001f, "object %d: depth %f after %f", i, depthB, depthA);
+    }
+  }
+  return test_result("sort");
+}
@@ -0,0 +1,133 @@
+/**
+* @copyright 2024 - Max Bebök
+* @license MIT
+*/
+
+// Checks the texture cache against a simple model of it.
+// Random acquires, releases and budget changes are applied to both,
+// every texture freed by the cache has to be the least recently used one without references.
+
+#include <t3d/t3dtexcache.h>
+#include "test.h"
+
+#define TEXTURE_COUNT 96
+#define ITERATIONS 20000
+
+typedef struct {
+  uint32_t hash;
+  uint32_t size;
+  uint32_t refCount;
+  uint64_t releaseTime; // time the last reference was removed, defines the LRU order
+  bool isLoaded;
+} TestTexture;
+
+static TestTexture textures[TEXTURE_COUNT];
+static uint64_t currTime = 0;
+static uint32_t freeCount = 0;
+
+static int32_t find_lru(void) {
+  int32_t res = -1;
+  for(int32_t i=0; i<TEXTURE_COUNT; ++i) {
+    if(!textures[i].isLoaded || textures[i].refCount > 0)continue;
+    if(res < 0 || textures[i].releaseTime < textures[res].releaseTime)res = i;
+  }
+  return res;
+}
+
+static void free_texture(void *texture) {
+  TestTexture *tex = (TestTexture*)texture;
+  int32_t idx = (int32_t)(tex - textures);
+  TEST_CHECK(idx >= 0 && idx < TEXTURE_COUNT, "freed unknown texture %p", texture);
+  TEST_CHECK(tex->isLoaded, "texture %d freed twice", idx);
+  TEST_CHECK(tex->refCount == 0, "texture %d freed with %d references", idx, tex->refCount);
+  TEST_CHECK(find_lru() == idx, "texture %d freed, least recently used is %d", idx, find_lru());
+  tex->isLoaded = false;
+  ++freeCount;
+}
+
+static void check_state(const T3DTexCache *cache) {
+  uint32_t sizeTotal = 0, sizeUnused = 0, count = 0;
+  for(int i=0; i<TEXTURE_COUNT; ++i) {
+    if(!textures[i].isLoaded)continue;
+    ++count;
+    sizeTotal += textures[i].size;
+    if(textures[i].refCount == 0)sizeUnused += textures[i].size;
+  }
+  TEST_CHECK(cache->count == count, "count: %d, expected %d", cache->count, count);
+  TEST_CHECK(cache->sizeTotal == sizeTotal, "total size: %d, expected %d", cache->sizeTotal, sizeTotal);
+  TEST_CHECK(cache->sizeUnused == sizeUnused, "unused size: %d, expected %d", cache->sizeUnused, sizeUnused);
+
+  // unused textures may only be kept if they fit into the budget
+  if(cache->budget == 0) {
+    TEST_CHECK(sizeUnused == 0, "unused textures kept without a budget: %d", sizeUnused);
+  } else {
+    TEST_CHECK(sizeTotal <= cache->budget || sizeUnused == 0, "over budget: %d > %d, unused: %d", sizeTotal, cache->budget, sizeUnused);
+  }
+}
+
+static void test_acquire(T3DTexCache *cache, int32_t idx) {
+  TestTexture *tex = &textures[idx];
+  void *res = t3d_tex_cache_acquire(cache, tex->hash);
+  TEST_CHECK(res == (tex->isLoaded ? tex : NULL), "acquire %d: %p, loaded: %d", idx, res, tex->isLoaded);
+
+  if(res) {
+    ++tex->refCount;
+  } else {
+    // miss, same as a model loading the texture
+    *tex = (TestTexture){.hash = tex->hash, .size = 1 + test_rand() % 1000, .refCount = 1, .isLoaded = true};
+    t3d_tex_cache_insert(cache, tex->hash, tex, tex->size);
+  }
+}
+
+static void test_release(T3DTexCache *cache, int32_t idx) {
+  TestTexture *tex = &textures[idx];
+  if(tex->refCount == 0) {
+    // unknown or unreferenced textures are ignored
+    t3d_tex_cache_release(cache, tex->hash);
+    return;
+  }
+  if(--tex->refCount == 0)tex->releaseTime = ++currTime;
+  t3d_tex_cache_release(cache, tex->hash);
+}
+
+int main(void)
+{
+  // half of the hashes end up in the same slot to test probing
+  for(uint32_t i=0; i<TEXTURE_COUNT; ++i) {
+    textures[i].hash = (i % 2) ? ((i + 1) << 24) : (test_rand() | 1);
+  }
+
+  T3DTexCache cache;
+  t3d_tex_cache_init(&cache, free_texture);
+
+  for(uint32_t i=0; i<ITERATIONS; ++i) {
+    uint32_t op = test_rand() % 100;
+    int32_t idx = test_rand() % TEXTURE_COUNT;
+    if(op < 50) {
+      test_acquire(&cache, idx);
+    } else if(op < 96) {
+      test_release(&cache, idx);
+    } else if(op < 98) {
+      static const uint32_t BUDGETS[] = {0, 500, 4000, 20000};
+      t3d_tex_cache_set_budget(&cache, BUDGETS[test_rand() % 4]);
+    } else if(op < 99) {
+      t3d_tex_cache_evict(&cache, test_rand() % 10000);
+    } else {
+      t3d_tex_cache_shrink(&cache);
+    }
+    check_state(&cache);
+  }
+
+  // with everything released and no budget, all textures get freed
+  for(int32_t i=0; i<TEXTURE_COUNT; ++i) {
+    while(textures[i].refCount > 0)test_release(&cache, i);
+  }
+  t3d_tex_cache_set_budget(&cache, 0);
+  check_state(&cache);
+  TEST_CHECK(cache.count == 0, "%d textures left", cache.count);
+
+  t3d_tex_cache_shrink(&cache);
+  TEST_CHECK(cache.entries == NULL && cache.capacity == 0, "table not freed");
+  printf("  %d textures freed\n", freeCount);
+  return test_result("texcache");
+}
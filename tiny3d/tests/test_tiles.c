@@ -0,0 +1,264 @@
+/**
+* @copyright 2024 - Max Bebök
+* @license MIT
+*/
+
+// Checks the tile streamer with a manifest and tiles written as plain files.
+// The camera moves randomly through the level, after each update the loaded tiles are checked
+// against the distances, budget and load limits, tiles are loaded and freed via the callbacks.
+// Frees are either done right away, or deferred to the end of the frame like 't3d_tile_free_model' does.
+
+#include <t3d/t3dtiles.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "test.h"
+
+#define MANIFEST_PATH "build/test_tiles.t3dt"
+#define GRID_SIZE 8
+#define TILE_COUNT (GRID_SIZE * GRID_SIZE)
+#define TILE_SIZE 100.0f
+#define ITERATIONS 4000
+
+typedef struct {
+  int16_t aabbMin[3];
+  int16_t aabbMax[3];
+  uint32_t size;
+  char path[64];
+} TestTile;
+
+typedef struct {
+  uint32_t tileIdx;
+  uint32_t size;
+} TestTileData; // followed by the file data
+
+static TestTile testTiles[TILE_COUNT];
+static uint32_t loadCount = 0;
+static uint32_t freeCount = 0;
+static uint32_t sizeAllocated = 0; // loaded tiles and the ones waiting to be freed
+
+static bool deferFrees = false;
+static TestTileData *pendingFrees[TILE_COUNT];
+static uint32_t pendingCount = 0;
+
+static void write_u32(FILE *f, uint32_t v) {
+  uint8_t data[4] = {v >> 24, v >> 16, v >> 8, v};
+  fwrite(data, 1, 4, f);
+}
+
+static void write_s16(FILE *f, int16_t v) {
+  uint8_t data[2] = {(uint16_t)v >> 8, (uint16_t)v};
+  fwrite(data, 1, 2, f);
+}
+
+// each tile file is filled with its index, so a load of the wrong file is noticed
+static void create_files(void) {
+  for(uint32_t t=0; t<TILE_COUNT; ++t) {
+    TestTile *tile = &testTiles[t];
+    int16_t x = (int16_t)((t % GRID_SIZE) * TILE_SIZE);
+    int16_t z = (int16_t)((t / GRID_SIZE) * TILE_SIZE);
+    *tile = (TestTile){
+      .aabbMin = {x, (int16_t)(test_rand() % 50), z},
+      .aabbMax = {(int16_t)(x + TILE_SIZE), (int16_t)(50 + test_rand() % 100), (int16_t)(z + TILE_SIZE)},
+      .size = 16 + test_rand() % 2000,
+    };
+    sprintf(tile->path, "build/test_tiles.%d.t3dm", t);
+
+    FILE *f = fopen(tile->path, "wb");
+    TEST_CHECK(f, "failed to write '%s'", tile->path);
+    for(uint32_t i=0; i<tile->size; ++i)fputc((int)t, f);
+    fclose(f);
+  }
+
+  FILE *f = fopen(MANIFEST_PATH, "wb");
+  TEST_CHECK(f, "failed to write '%s'", MANIFEST_PATH);
+  fwrite("T3T\x01", 1, 4, f);
+  write_u32(f, TILE_COUNT);
+  float tileSize = TILE_SIZE;
+  uint32_t tileSizeBits;
+  memcpy(&tileSizeBits, &tileSize, sizeof(float));
+  write_u32(f, tileSizeBits);
+  write_u32(f, 0x10 + TILE_COUNT * 0x14);
+
+  // string table starts with a dummy entry, same as in the importer
+  uint32_t strOffset = 2;
+  for(uint32_t t=0; t<TILE_COUNT; ++t) {
+    for(int i=0; i<3; ++i)write_s16(f, testTiles[t].aabbMin[i]);
+    for(int i=0; i<3; ++i)write_s16(f, testTiles[t].aabbMax[i]);
+    write_u32(f, strOffset);
+    write_u32(f, testTiles[t].size);
+    strOffset += strlen(testTiles[t].path) + 1;
+  }
+  fwrite("S", 1, 2, f);
+  for(uint32_t t=0; t<TILE_COUNT; ++t) {
+    fwrite(testTiles[t].path, 1, strlen(testTiles[t].path) + 1, f);
+  }
+  fclose(f);
+}
+
+static void* load_tile(void *userData, const char *path) {
+  TEST_CHECK(userData == testTiles, "wrong user data: %p", userData);
+  FILE *f = fopen(path, "rb");
+  TEST_CHECK(f, "failed to open tile '%s'", path);
+  if(!f)return NULL;
+
+  fseek(f, 0, SEEK_END);
+  uint32_t size = (uint32_t)ftell(f);
+  fseek(f, 0, SEEK_SET);
+  TestTileData *tile = malloc(sizeof(TestTileData) + size);
+  uint8_t *data = (uint8_t*)(tile + 1);
+  TEST_CHECK(fread(data, 1, size, f) == size, "failed to read tile '%s'", path);
+  fclose(f);
+
+  tile->tileIdx = data[0];
+  tile->size = size;
+  ++loadCount;
+  sizeAllocated += size;
+  return tile;
+}
+
+static void free_tile_now(TestTileData *tile) {
+  sizeAllocated -= tile->size;
+  free(tile);
+  ++freeCount;
+}
+
+static void free_tile(void *userData, void *tile) {
+  TEST_CHECK(userData == testTiles, "wrong user data: %p", userData);
+  TEST_CHECK(tile != NULL, "freed empty tile");
+  if(!tile)return;
+  if(deferFrees) {
+    TEST_CHECK(pendingCount < TILE_COUNT, "tile freed twice");
+    pendingFrees[pendingCount++] = tile;
+  } else {
+    free_tile_now(tile);
+  }
+}
+
+// end of the frame, the RSP is done with the tiles
+static void flush_frees(void) {
+  for(uint32_t i=0; i<pendingCount; ++i)free_tile_now(pendingFrees[i]);
+  pendingCount = 0;
+}
+
+static float get_distance(const TestTile *tile, const float pos[3]) {
+  float distSq = 0.0f;
+  for(int i=0; i<3; ++i) {
+    float d = fmaxf(fmaxf(tile->aabbMin[i] - pos[i], pos[i] - tile->aabbMax[i]), 0.0f);
+    distSq += d * d;
+  }
+  return sqrtf(distSq);
+}
+
+static void check_manifest(const T3DTileStreamer *streamer) {
+  TEST_CHECK(streamer->tileCount == TILE_COUNT, "tile count: %d", streamer->tileCount);
+  TEST_CHECK(streamer->tileSize == TILE_SIZE, "tile size: %f", streamer->tileSize);
+  TEST_CHECK(streamer->sizeLoaded == 0, "size loaded: %d", streamer->sizeLoaded);
+  for(uint32_t t=0; t<streamer->tileCount && t<TILE_COUNT; ++t) {
+    const T3DTile *tile = &streamer->tiles[t];
+    TEST_CHECK(memcmp(tile->aabbMin, testTiles[t].aabbMin, sizeof(tile->aabbMin)) == 0, "tile %d: AABB min differs", t);
+    TEST_CHECK(memcmp(tile->aabbMax, testTiles[t].aabbMax, sizeof(tile->aabbMax)) == 0, "tile %d: AABB max differs", t);
+    TEST_CHECK(strcmp(tile->path, testTiles[t].path) == 0, "tile %d: path '%s'", t, tile->path);
+    TEST_CHECK(tile->size == testTiles[t].size, "tile %d: size %d", t, tile->size);
+    TEST_CHECK(tile->data == NULL, "tile %d loaded after init", t);
+  }
+}
+
+static void test_update(T3DTileStreamer *streamer, const float pos[3]) {
+  bool wasLoaded[TILE_COUNT];
+  for(uint32_t t=0; t<TILE_COUNT; ++t)wasLoaded[t] = streamer->tiles[t].data != NULL;
+
+  uint32_t res = t3d_tile_streamer_update(streamer, pos);
+
+  uint32_t newCount = 0, sizeLoaded = 0;
+  float maxNewDist = 0.0f; // furthest newly loaded tile
+  float minMissingDist = INFINITY; // closest tile in range that was not loaded before
+  for(uint32_t t=0; t<TILE_COUNT; ++t) {
+    const T3DTile *tile = &streamer->tiles[t];
+    float dist = get_distance(&testTiles[t], pos);
+    TEST_CHECK(fabsf(tile->distance - dist) < 0.01f, "tile %d: distance %f, expected %f", t, tile->distance, dist);
+    if(!wasLoaded[t] && dist <= streamer->loadDistance)minMissingDist = fminf(minMissingDist, dist);
+
+    if(!tile->data)continue;
+    const TestTileData *data = tile->data;
+    TEST_CHECK(data->tileIdx == t && data->size == tile->size, "tile %d: loaded the data of tile %d (%d bytes)", t, data->tileIdx, data->size);
+    TEST_CHECK(dist <= streamer->unloadDistance, "tile %d: kept at distance %f", t, dist);
+    sizeLoaded += tile->size;
+    if(!wasLoaded[t]) {
+      TEST_CHECK(dist <= streamer->loadDistance, "tile %d: loaded at distance %f", t, dist);
+      maxNewDist = fmaxf(maxNewDist, dist);
+      ++newCount;
+    }
+  }
+
+  TEST_CHECK(res == newCount, "returned %d, loaded %d", res, newCount);
+  TEST_CHECK(streamer->maxLoadsPerUpdate == 0 || newCount <= streamer->maxLoadsPerUpdate, "loaded %d tiles", newCount);
+  TEST_CHECK(streamer->sizeLoaded == sizeLoaded, "size loaded: %d, expected %d", streamer->sizeLoaded, sizeLoaded);
+  if(newCount > 0 && streamer->budget) {
+    TEST_CHECK(sizeLoaded <= streamer->budget, "over budget: %d > %d", sizeLoaded, streamer->budget);
+    TEST_CHECK(sizeAllocated <= streamer->budget, "over budget with pending frees: %d > %d", sizeAllocated, streamer->budget);
+  }
+
+  bool limitReached = streamer->maxLoadsPerUpdate && newCount == streamer->maxLoadsPerUpdate;
+  for(uint32_t t=0; t<TILE_COUNT; ++t) {
+    const T3DTile *tile = &streamer->tiles[t];
+    if(tile->data)continue;
+    if(wasLoaded[t] && tile->distance <= streamer->unloadDistance) {
+      // only freed to make room for closer tiles
+      TEST_CHECK(streamer->budget && tile->distance > minMissingDist, "tile %d: freed at distance %f", t, tile->distance);
+    }
+    if(tile->distance <= streamer->loadDistance) {
+      TEST_CHECK(tile->distance >= maxNewDist, "tile %d: not loaded at distance %f, but one at %f", t, tile->distance, maxNewDist);
+      TEST_CHECK(limitReached || streamer->budget, "tile %d: not loaded at distance %f", t, tile->distance);
+    }
+  }
+}
+
+static void test_streamer(bool deferred)
+{
+  deferFrees = deferred;
+  loadCount = freeCount = 0;
+
+  T3DTileStreamer streamer;
+  t3d_tile_streamer_init(&streamer, MANIFEST_PATH, load_tile, free_tile, testTiles);
+  check_manifest(&streamer);
+  TEST_CHECK(streamer.loadDistance == TILE_SIZE * 1.5f && streamer.unloadDistance == TILE_SIZE * 2.0f, "default distances");
+  TEST_CHECK(streamer.maxLoadsPerUpdate == 1 && streamer.budget == 0, "default limits");
+
+  float pos[3] = {0.0f, 0.0f, 0.0f};
+  for(uint32_t i=0; i<ITERATIONS; ++i) {
+    uint32_t op = test_rand() % 100;
+    if(op < 2) {
+      static const uint32_t BUDGETS[] = {0, 1000, 4000, 10000};
+      streamer.budget = BUDGETS[test_rand() % 4];
+    } else if(op < 4) {
+      streamer.maxLoadsPerUpdate = test_rand() % 4;
+    } else if(op < 5) {
+      streamer.loadDistance = test_randf(0.0f, TILE_SIZE * 2.0f);
+      streamer.unloadDistance = streamer.loadDistance + test_randf(0.0f, TILE_SIZE);
+    } else if(op < 6) {
+      t3d_tile_streamer_unload(&streamer, &streamer.tiles[test_rand() % TILE_COUNT]);
+    } else if(op < 8) {
+      // teleport, outside of the level in some cases
+      for(int c=0; c<3; ++c)pos[c] = test_randf(-TILE_SIZE, (GRID_SIZE + 1) * TILE_SIZE);
+    } else {
+      for(int c=0; c<3; ++c)pos[c] += test_randf(-TILE_SIZE * 0.2f, TILE_SIZE * 0.2f);
+    }
+    test_update(&streamer, pos);
+    flush_frees();
+  }
+
+  t3d_tile_streamer_destroy(&streamer);
+  flush_frees();
+  TEST_CHECK(streamer.tiles == NULL && streamer.tileCount == 0, "streamer not cleared");
+  TEST_CHECK(loadCount == freeCount && sizeAllocated == 0, "%d tiles loaded, %d freed", loadCount, freeCount);
+  printf("  %-9s %d tiles loaded\n", deferred ? "deferred" : "direct", loadCount);
+}
+
+int main(void)
+{
+  create_files();
+  test_streamer(false);
+  test_streamer(true);
+  return test_result("tiles");
+}
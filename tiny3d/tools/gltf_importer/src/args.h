@@ -50,6 +50,13 @@ class EnvArgs
       return fallback;
     }
 
+    float getFloatArg(const std::string &argName, float fallback = 0.0f) {
+      if(argMap.contains(argName)) {
+        return std::stof(argMap[argName]);
+      }
+      return fallback;
+    }
+
     std::string getFilenameArg(uint32_t index) {
       if(index < fileArgs.size()) {
         return fileArgs[index];
@@ -5,9 +5,12 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cfloat>
+#include <queue>
+#include <stdexcept>
+#include "bvh/v2/thread_pool.h"
 #include "converter.h"
 #include "../math/quantizer.h"
-#include "mse.h"
 
 namespace {
   constexpr float MIN_VALUE_DELTA = 0.00001f;
@@ -50,51 +53,499 @@ namespace {
     return false;
   }
 
+  const Keyframe& safeKf(const std::vector<Keyframe> &kfs, int idx) {
+    if(idx < 0)return kfs[0];
+    if(idx >= kfs.size())return kfs.back();
+    return kfs[idx];
+  }
+
+  // keyframe times are accumulated floats, this avoids samples landing right before a keyframe
+  constexpr float SAMPLE_TIME_EPSILON = 0.0001f;
+
+  /**
+   * Samples a channel at a fixed rate, the result can be used as a reference for 'calcSegmentError'.
+   * The returned keyframes are not interpolated, but contain the interpolated value at their time.
+   */
+  std::vector<Keyframe> sampleChannel(const std::vector<Keyframe> &kfs, float timeEnd, bool isRotation) {
+    float sampleRate = 60.0f;
+    uint32_t sampleCount = std::max(1, (int)ceilf(timeEnd * sampleRate - 0.0001f));
+
+    std::vector<Keyframe> samples{};
+    samples.reserve(sampleCount);
+    int idx = 0;
+    for(uint32_t s=0; s<sampleCount; ++s)
+    {
+      float t = (float)s / sampleRate;
+      while((t + SAMPLE_TIME_EPSILON) >= safeKf(kfs, idx+1).time) {
+        ++idx; if(idx >= kfs.size())break;
+      }
+      const Keyframe &kf = safeKf(kfs, idx);
+      const Keyframe &kfNext = safeKf(kfs, idx + 1);
+      if(fabsf(t - kf.time) < SAMPLE_TIME_EPSILON)t = kf.time;
+
+      float tDiff = kfNext.time - kf.time;
+      float interp = (tDiff > 0.00001f) ? std::max(0.0f, (t - kf.time) / tDiff) : 0.0f;
+
+      auto &sample = samples.emplace_back();
+      sample.time = t;
+      if(isRotation) {
+        sample.valQuat = kf.valQuat.slerp(kfNext.valQuat, interp);
+      } else {
+        sample.valScalar = kf.valScalar + (kfNext.valScalar - kf.valScalar) * interp;
+      }
+    }
+    return samples;
+  }
+
+  // cubic hermite interpolation, tangents are expected to be scaled by the segment duration already
+  double hermite(double p0, double m0, double p1, double m1, double t) {
+    double t2 = t * t;
+    double t3 = t2 * t;
+    return (2*t3 - 3*t2 + 1) * p0 + (t3 - 2*t2 + t) * m0 + (-2*t3 + 3*t2) * p1 + (t3 - t2) * m1;
+  }
+
+  /**
+   * Calculates the squared error of a single segment (kfA -> kfB) against reference samples.
+   * Only samples inside [kfA.time, kfB.time) are checked, the amount of them is written to 'sampleCount'.
+   * If 'isCubic' is set, scalars are interpolated with the tangents of the keyframes instead of linearly.
+   * If 'errorMax' is set, it receives the largest squared error of any single sample.
+   */
+  float calcSegmentError(const Keyframe &kfA, const Keyframe &kfB, const std::vector<Keyframe> &samples, bool isRotation, uint32_t &sampleCount, bool isCubic = false, float *errorMax = nullptr) {
+    auto it = std::lower_bound(samples.begin(), samples.end(), kfA.time, [](const Keyframe &kf, float t) {
+      return (kf.time + SAMPLE_TIME_EPSILON) < t;
+    });
+
+    // scalars are compared in double precision, and differences below float precision are ignored.
+    // Otherwise rounding of large values (e.g. translations) alone can exceed the error thresholds
+    double tDiff = (double)kfB.time - (double)kfA.time;
+    double error = 0.0;
+    double errorSampleMax = 0.0;
+    sampleCount = 0;
+    for(; it != samples.end() && (it->time + SAMPLE_TIME_EPSILON) < kfB.time; ++it)
+    {
+      double interp = (tDiff > 0.00001) ? std::max(0.0, (it->time - (double)kfA.time) / tDiff) : 0.0;
+      if(isRotation) {
+        Vec4 quat = kfA.valQuat.slerp(kfB.valQuat, (float)interp).toVec4();
+        double errorSample = (it->valQuat.toVec4() - quat).length2();
+        error += errorSample;
+        errorSampleMax = std::max(errorSampleMax, errorSample);
+      } else {
+        double val = isCubic
+          ? hermite(kfA.valScalar, kfA.tangent * tDiff, kfB.valScalar, kfB.tangent * tDiff, interp)
+          : kfA.valScalar + ((double)kfB.valScalar - (double)kfA.valScalar) * interp;
+        double diff = fabs(it->valScalar - val);
+        if(diff <= fabs(val) * FLT_EPSILON)diff = 0.0; // below what the input can represent
+        error += diff * diff;
+        errorSampleMax = std::max(errorSampleMax, diff * diff);
+      }
+      ++sampleCount;
+    }
+    if(errorMax)*errorMax = (float)errorSampleMax;
+    return (float)error;
+  }
+
+  // max. error when removing keyframes, for the entire channel and the segment around a removed keyframe
+  constexpr float MSE_THRESHOLD       = 0.000001f;
+  constexpr float MSE_THRESHOLD_LOCAL = 0.0000001f;
+
+  // part of an explicit error ('--anim-error') reserved for quantization, the rest is used to remove keyframes.
+  // Both add up in the worst case, so neither of them can use the full threshold.
+  constexpr float QUANT_ERROR_SHARE = 0.25f;
+
+  // lower limit for the reach of a bone, avoids bones without vertices losing all keyframes
+  // (those may still be used to attach objects at runtime)
+  constexpr float MIN_BONE_REACH = 4.0f;
+
+  // bytes per keyframe in the stream (header + data)
+  constexpr uint32_t KF_SIZE_SCALAR = 6;
+  constexpr uint32_t KF_SIZE_CUBIC  = 8;
+  constexpr uint32_t KF_SIZE_QUAT   = 8;
+
+  struct ErrorThreshold {
+    float total{MSE_THRESHOLD};
+    float local{MSE_THRESHOLD_LOCAL};
+    bool perFrame{false}; // if set, 'local' limits the squared error of every frame instead of the mean of a segment
+    float quant{sqrtf(MSE_THRESHOLD_LOCAL)}; // max. (absolute) error added by quantization
+  };
+
+  /**
+   * Converts the max. displacement of a bone (in model units) into a threshold for the value of a channel.
+   * The allowed error ('--anim-error') is split evenly across the longest bone-chain the bone is part of,
+   * so that errors accumulating along the hierarchy still stay within that limit.
+   * Since this is a limit for the displacement in any frame, it is checked against the error of each frame.
+   * A share of it is kept for quantization, which adds to the error of the reduced keyframes.
+   */
+  ErrorThreshold getChannelThreshold(const AnimChannelMapping &channel, const BoneReach &bone) {
+    if(config.animError <= 0.0f)return {};
+
+    float budget = config.animError / (float)std::max(bone.chainLength, 1u);
+    float reach = std::max(bone.reach, MIN_BONE_REACH);
+    float error = 0.0f;
+    switch(channel.targetType) {
+      // for small angles, the distance of two unit-quaternions is about half the angle between them
+      case AnimChannelTarget::ROTATION     : error = budget / (2.0f * reach); break;
+      // scalar channels are one axis each, so the displacement is split across all three
+      case AnimChannelTarget::TRANSLATION  : error = budget / sqrtf(3.0f); break;
+      case AnimChannelTarget::SCALE        : error = budget / reach / sqrtf(3.0f); break;
+      case AnimChannelTarget::SCALE_UNIFORM: error = budget / reach; break;
+    }
+    float errorReduce = error * (1.0f - QUANT_ERROR_SHARE);
+    return {
+      .total = errorReduce * errorReduce,
+      .local = errorReduce * errorReduce,
+      .perFrame = true,
+      .quant = error * QUANT_ERROR_SHARE
+    };
+  }
+
+  /**
+   * Removes keyframes from a channel while tracking the error against the original.
+   * Keyframes form a linked list, where each one stores the error of the segment to its next keyframe.
+   * This means that removing a keyframe only needs to evaluate the new merged segment,
+   * instead of the entire animation.
+   */
+  struct ChannelReducer {
+    const std::vector<Keyframe> &kfs;
+    const std::vector<Keyframe> &samples;
+    bool isRotation;
+    bool isCubic;
+    ErrorThreshold threshold;
+
+    std::vector<uint32_t> prev{}, next{}, version{};
+    std::vector<float> segError{};
+    std::vector<bool> removed{};
+    float totalError{0.0f};
+
+    ChannelReducer(const std::vector<Keyframe> &kfs, const std::vector<Keyframe> &samples, bool isRotation, bool isCubic, ErrorThreshold threshold)
+      : kfs{kfs}, samples{samples}, isRotation{isRotation}, isCubic{isCubic}, threshold{threshold}
+    {
+      uint32_t kfCount = kfs.size();
+      prev.resize(kfCount);
+      next.resize(kfCount);
+      version.resize(kfCount, 0);
+      segError.resize(kfCount, 0.0f);
+      removed.resize(kfCount, false);
+
+      uint32_t sampleCount;
+      for(uint32_t i=0; i<kfCount; ++i) {
+        prev[i] = i - 1;
+        next[i] = i + 1;
+        if(i < kfCount-1) {
+          segError[i] = calcSegmentError(kfs[i], kfs[i+1], samples, isRotation, sampleCount, isCubic);
+          totalError += segError[i];
+        }
+      }
+    }
+
+    [[nodiscard]] bool isInner(uint32_t i) const { return i > 0 && i < kfs.size()-1; }
+
+    // returns the local error (MSE or per-frame max.) of the merged segment, and the change in total error if 'i' would be removed
+    float getRemovalError(uint32_t i, float &errorDelta) const {
+      uint32_t sampleCount;
+      float errorMax;
+      float error = calcSegmentError(kfs[prev[i]], kfs[next[i]], samples, isRotation, sampleCount, isCubic, &errorMax);
+      errorDelta = error - segError[prev[i]] - segError[i];
+      if(threshold.perFrame)return errorMax;
+      return sampleCount == 0 ? 0.0f : (error / (float)sampleCount);
+    }
+
+    [[nodiscard]] bool isWithinThreshold(float errorLocal, float errorDelta) const {
+      return errorLocal <= threshold.local
+        && ((totalError + errorDelta) / (float)samples.size()) <= threshold.total;
+    }
+
+    void remove(uint32_t i, float errorDelta) {
+      uint32_t p = prev[i];
+      uint32_t n = next[i];
+      removed[i] = true;
+      segError[p] += segError[i] + errorDelta;
+      totalError += errorDelta;
+      next[p] = n;
+      prev[n] = p;
+      ++version[p];
+      ++version[n];
+    }
+
+    [[nodiscard]] std::vector<Keyframe> getKeyframes() const {
+      std::vector<Keyframe> res{};
+      for(uint32_t i=0; i<kfs.size(); ++i) {
+        if(!removed[i])res.push_back(kfs[i]);
+      }
+      return res;
+    }
+  };
+
+  struct ReduceCandidate {
+    float errorLocal{};
+    float errorDelta{};
+    uint32_t idx{};
+    uint32_t version{};
+
+    bool operator<(const ReduceCandidate &other) const {
+      return errorLocal > other.errorLocal; // min-heap
+    }
+  };
+
+  // tries to remove each keyframe in order, from start to end
+  std::vector<Keyframe> reduceSequential(ChannelReducer &reducer) {
+    for(uint32_t i=1; reducer.isInner(i); i = reducer.next[i]) {
+      float errorDelta;
+      float errorLocal = reducer.getRemovalError(i, errorDelta);
+      if(reducer.isWithinThreshold(errorLocal, errorDelta)) {
+        reducer.remove(i, errorDelta);
+      }
+    }
+    return reducer.getKeyframes();
+  }
+
+  // removes the keyframe with the smallest error first, using a heap
+  std::vector<Keyframe> reduceByError(ChannelReducer &reducer) {
+    std::priority_queue<ReduceCandidate> queue{};
+    auto pushCandidate = [&](uint32_t i) {
+      ReduceCandidate cand{.idx = i, .version = reducer.version[i]};
+      cand.errorLocal = reducer.getRemovalError(i, cand.errorDelta);
+      queue.push(cand);
+    };
+
+    for(uint32_t i=1; reducer.isInner(i); ++i)pushCandidate(i);
+
+    while(!queue.empty())
+    {
+      auto cand = queue.top();
+      queue.pop();
+      if(reducer.removed[cand.idx] || cand.version != reducer.version[cand.idx])continue; // outdated entry
+      if(cand.errorLocal > reducer.threshold.local)break; // all remaining candidates are worse
+
+      // the total error only grows, so a rejected keyframe can never be removed later on
+      if(!reducer.isWithinThreshold(cand.errorLocal, cand.errorDelta))continue;
+
+      uint32_t p = reducer.prev[cand.idx];
+      uint32_t n = reducer.next[cand.idx];
+      reducer.remove(cand.idx, cand.errorDelta);
+      if(reducer.isInner(p))pushCandidate(p);
+      if(reducer.isInner(n))pushCandidate(n);
+    }
+    return reducer.getKeyframes();
+  }
+
+  std::vector<Keyframe> reduceChannel(const std::vector<Keyframe> &kfs, const std::vector<Keyframe> &samples, bool isRotation, bool isCubic, ErrorThreshold threshold) {
+    ChannelReducer reducerSeq{kfs, samples, isRotation, isCubic, threshold};
+    ChannelReducer reducerHeap{kfs, samples, isRotation, isCubic, threshold};
+    auto kfsSeq = reduceSequential(reducerSeq);
+    auto kfsHeap = reduceByError(reducerHeap);
+    return kfsHeap.size() <= kfsSeq.size() ? std::move(kfsHeap) : std::move(kfsSeq);
+  }
+
+  // sets the tangent of each keyframe to the slope of its neighbors, input is expected to be densely sampled
+  void calcTangents(std::vector<Keyframe> &kfs) {
+    for(uint32_t i=0; i<kfs.size(); ++i) {
+      const auto &kfA = kfs[i == 0 ? i : i-1];
+      const auto &kfB = kfs[i == kfs.size()-1 ? i : i+1];
+      float tDiff = kfB.time - kfA.time;
+      kfs[i].tangent = tDiff > 0.00001f ? ((kfB.valScalar - kfA.valScalar) / tDiff) : 0.0f;
+    }
+  }
+
   /**
    * Optimizes the keyframes of a channel.
    * This will attempt to remove keyframes while staying within a certain error threshold.
+   * Both a sequential and a smallest-error-first order are tried, and the one with fewer keyframes is kept.
+   * Neither is optimal in every case, but each only evaluates the segments affected by a removal.
+   *
+   * If enabled, scalar channels are also reduced as cubic curves (value + tangent per keyframe).
+   * Those are only used if they result in less data than the linear version.
+   * Returns the stream size of the linear version, used for stats.
    */
-  void optimizeChannel(AnimChannelMapping &channel, float time) {
-    if(channel.keyframes.size() < 2)return;
-    auto channelOrg = channel;
-    float mse = calcMSE(channel.keyframes, channelOrg.keyframes, 0, time, channel.isRotation());
-    assert(mse < 0.00001f); //  initial MSE must be zero
-    //printf("  - Channel %s %d: %d keyframes, MSE: %f\n", channel.targetName.c_str(), channel.targetType, channel.keyframes.size(), mse);
-
-    // now remove keyframes and keep the error below a certain threshold
-    float threshold      = 0.000001f;
-    float thresholdLocal = 0.0000001f;
-
-    for(int i=1;; ++i) {
-      if(i >= channel.keyframes.size()-1)break;
-      float timeStart = channel.keyframes[i-1].time;
-      auto kf = channel.keyframes[i];
-      float timeEnd = channel.keyframes[i+1].time;
-
-      channel.keyframes.erase(channel.keyframes.begin() + i);
-      float newMSELocal = calcMSE(channel.keyframes, channelOrg.keyframes, timeStart, timeEnd, channel.isRotation());
-      float newMSE = calcMSE(channel.keyframes, channelOrg.keyframes, 0, time, channel.isRotation());
-      if(newMSE > threshold || newMSELocal > thresholdLocal) {
-        channel.keyframes.insert(channel.keyframes.begin() + i, kf);
-      } else {
-        --i;
+  uint32_t optimizeChannel(AnimChannelMapping &channel, float time, ErrorThreshold threshold) {
+    uint32_t kfSize = channel.isRotation() ? KF_SIZE_QUAT : KF_SIZE_SCALAR;
+    if(channel.keyframes.size() < 3)return channel.keyframes.size() * kfSize;
+    auto samples = sampleChannel(channel.keyframes, time, channel.isRotation());
+
+    auto kfsLinear = reduceChannel(channel.keyframes, samples, channel.isRotation(), false, threshold);
+    uint32_t sizeLinear = kfsLinear.size() * kfSize;
+
+    if(config.animCubic && !channel.isRotation() && kfsLinear.size() > 2) {
+      auto kfsDense = channel.keyframes;
+      calcTangents(kfsDense);
+      auto kfsCubic = reduceChannel(kfsDense, samples, false, true, threshold);
+
+      float tangentMax = 0.0f;
+      for(const auto &kf : kfsCubic)tangentMax = std::max(tangentMax, fabsf(kf.tangent));
+
+      // a scale of zero marks linear channels, so flat tangents can't be used here
+      if(tangentMax > 0.0f && (kfsCubic.size() * KF_SIZE_CUBIC) < sizeLinear) {
+        channel.tangentScale = tangentMax / (float)0x7FFF;
+        channel.keyframes = std::move(kfsCubic);
+        return sizeLinear;
       }
     }
+
+    channel.keyframes = std::move(kfsLinear);
+    return sizeLinear;
+  }
+
+  // max. step of delta-coded values, as a power of two
+  constexpr int32_t MAX_DELTA_SHIFT = 8;
+
+  void setQuantU16(Keyframe &kf, uint32_t idx, uint16_t value) {
+    kf.valQuant[idx*2 + 0] = value >> 8;
+    kf.valQuant[idx*2 + 1] = value & 0xFF;
+  }
+
+  void setStateQuat48(Keyframe &kf, uint64_t quatQuant) {
+    kf.valState[0] = quatQuant >> 32;
+    kf.valState[1] = quatQuant >> 16;
+    kf.valState[2] = quatQuant;
   }
 
-  void quantizeRotation(Keyframe &kf)
+  void quantizeRotation(Keyframe &kf, bool isPrecise)
   {
+    if(isPrecise) {
+      uint64_t quatQuant = Quantizer::quatTo48Bit(kf.valQuat);
+      kf.valQuantSize = 6;
+      for(int i=0; i<3; ++i)setQuantU16(kf, i, quatQuant >> (32 - i*16));
+      setStateQuat48(kf, quatQuant);
+      return;
+    }
+
     uint32_t quatQuant = Quantizer::quatTo32Bit(kf.valQuat);
     if(quatQuant == 0) {
       throw std::runtime_error(std::string{"Quantized rotation is zero: "} + std::to_string(kf.chanelIdx) + " Quat: " + kf.valQuat.toString());
     }
-    kf.valQuantSize = 2;
-    kf.valQuant[1] = quatQuant & 0xFFFF;
-    kf.valQuant[0] = quatQuant >> 16;
+    kf.valQuantSize = 4;
+    setQuantU16(kf, 0, quatQuant >> 16);
+    setQuantU16(kf, 1, quatQuant & 0xFFFF);
+    // snapshots store the value as it was decoded, re-quantizing it with more bits is (almost) lossless
+    setStateQuat48(kf, Quantizer::quatTo48Bit(Quantizer::quatFromBits(quatQuant, 10)));
+  }
+
+  // checks if 10 bits per component keep all rotations of a channel within the error reserved for quantization
+  bool needsPreciseRotation(const AnimChannelMapping &channel, ErrorThreshold threshold) {
+    if(config.animError <= 0.0f)return false; // the default threshold is stricter than 10 bits, only use it for explicit limits
+
+    for(const auto &kf : channel.keyframes) {
+      Vec4 quat = kf.valQuat.toVec4();
+      Vec4 quatQuant = Quantizer::quatFromBits(Quantizer::quatTo32Bit(kf.valQuat), 10).toVec4();
+      float error = sqrtf(std::min((quat - quatQuant).length2(), (quat + quatQuant).length2()));
+      if(error > threshold.quant)return true;
+    }
+    return false;
+  }
+
+  /**
+   * Returns the largest step for 8-bit deltas, such that the added rounding stays within the error reserved for quantization.
+   * Steps are in units of the 16-bit quantization, so a shift of 0 is lossless.
+   * Cubic channels always store absolute values, and return -1.
+   */
+  int32_t getDeltaShift(const AnimChannelMapping &channel, ErrorThreshold threshold) {
+    if(channel.isRotation() || channel.tangentScale != 0.0f)return -1;
+
+    float quantScale = (channel.valueMax - channel.valueMin) / (float)0xFFFF;
+    int32_t shift = 0;
+    // rounding to a step of '2^(shift+1)' has an error of up to '2^shift'
+    while(shift < MAX_DELTA_SHIFT && (float)(1 << shift) * quantScale <= threshold.quant)++shift;
+    return shift;
   }
 }
 
-void convertAnimation(Anim &anim, const std::unordered_map<std::string, const Bone*> &nodeMap)
+/**
+ * Creates snapshots of the runtime state every 'intervalTicks', used to seek without replaying the stream.
+ * This simulates the loading of keyframes: at runtime, a keyframe is loaded once the time reaches
+ * the end of the current segment in its channel, which is the 'timeNeeded' the keyframes are sorted by.
+ * So a snapshot at tick T contains the state after loading all keyframes needed before T.
+ * Once all keyframes are loaded, no more snapshots are created (seeking replays from the last one instead).
+ */
+void createAnimSnapshots(Anim &anim, uint32_t intervalTicks)
+{
+  std::vector<AnimSnapshotChannel> state(anim.channelMap.size());
+  std::vector<bool> hasKF(anim.channelMap.size(), false);
+  uint32_t durationTicks = time_to_ticks(anim.duration);
+  uint32_t nextSnapshot = intervalTicks;
+
+  anim.snapshots.clear();
+  for(uint32_t k=0; k<anim.keyframes.size(); ++k)
+  {
+    while(nextSnapshot < durationTicks && anim.keyframes[k].timeNeededTicks >= nextSnapshot) {
+      anim.snapshots.push_back({.kfIndex = k, .channels = state});
+      nextSnapshot += intervalTicks;
+    }
+
+    const auto &kf = anim.keyframes[k];
+    auto &ch = state[kf.chanelIdx];
+    ch.timeStartTicks = ch.timeEndTicks;
+    ch.timeEndTicks += kf.timeNextInChannelTicks;
+    for(int i=0; i<3; ++i) {
+      ch.valCurr[i] = ch.valNext[i];
+      ch.valNext[i] = kf.valState[i];
+    }
+
+    // the previous value of the first keyframe is never interpolated, but must be a valid value
+    if(!hasKF[kf.chanelIdx]) {
+      for(int i=0; i<3; ++i)ch.valCurr[i] = ch.valNext[i];
+      hasKF[kf.chanelIdx] = true;
+    }
+  }
+}
+
+std::vector<BoneReach> calcBoneReach(const T3DMData &t3dm)
+{
+  uint32_t boneCount = 0;
+  auto countBones = [&](auto&& countBones, const Bone &bone) -> void {
+    boneCount = std::max(boneCount, bone.index + 1);
+    for(const auto &child : bone.children)countBones(countBones, *child);
+  };
+  for(const auto &skel : t3dm.skeletons)countBones(countBones, skel);
+
+  std::vector<BoneReach> res(boneCount);
+
+  // skinned vertices are stored relative to their bone, so the length is the distance to it
+  for(const auto &model : t3dm.models) {
+    for(const auto &tri : model.triangles) {
+      for(const auto &v : tri.vert) {
+        if(v.boneIndex < 0 || v.boneIndex >= boneCount)continue;
+        Vec3 pos{(float)v.pos[0], (float)v.pos[1], (float)v.pos[2]};
+        res[v.boneIndex].reach = std::max(res[v.boneIndex].reach, pos.length());
+      }
+    }
+  }
+
+  // child bones extend the reach of their parents, returns the height of the sub-tree
+  auto calcReach = [&](auto&& calcReach, const Bone &bone, uint32_t depth) -> uint32_t {
+    uint32_t height = 0;
+    for(const auto &child : bone.children) {
+      height = std::max(height, calcReach(calcReach, *child, depth + 1) + 1);
+      float childDist = (child->pos * config.globalScale).length();
+      res[bone.index].reach = std::max(res[bone.index].reach, childDist + res[child->index].reach);
+    }
+    res[bone.index].chainLength = depth + 1 + height;
+    return height;
+  };
+  for(const auto &skel : t3dm.skeletons)calcReach(calcReach, skel, 0);
+
+  // the chain length must be the longest path, which is only known once all children are done
+  auto propagateChain = [&](auto&& propagateChain, const Bone &bone, uint32_t chainLength) -> void {
+    res[bone.index].chainLength = std::max(res[bone.index].chainLength, chainLength);
+    for(const auto &child : bone.children) {
+      propagateChain(propagateChain, *child, res[bone.index].chainLength);
+    }
+  };
+  for(const auto &skel : t3dm.skeletons)propagateChain(propagateChain, skel, 0);
+
+  if(config.verbose && config.animError > 0.0f) {
+    for(uint32_t b=0; b<boneCount; ++b) {
+      printf("[Bone %d] Reach: %.2f, Chain: %d\n", b, res[b].reach, res[b].chainLength);
+    }
+  }
+  return res;
+}
+
+float getChannelErrorLimit(const AnimChannelMapping &channel, const BoneReach *bone)
+{
+  ErrorThreshold threshold = bone ? getChannelThreshold(channel, *bone) : ErrorThreshold{};
+  return sqrtf(threshold.local);
+}
+
+void convertAnimation(Anim &anim, const std::unordered_map<std::string, const Bone*> &nodeMap, const std::vector<BoneReach> &boneReach)
 {
   // remove all empty channels
   anim.channelMap.erase(
@@ -102,11 +553,6 @@ void convertAnimation(Anim &anim, const std::unordered_map<std::string, const Bo
     anim.channelMap.end()
   );
 
-  // resample keyframes
-  for(auto &ch : anim.channelMap) {
-    optimizeChannel(ch, anim.duration);
-  }
-
   // Map the channel target by name to the node index
   for(auto &ch : anim.channelMap) {
     auto it = nodeMap.find(ch.targetName);
@@ -118,6 +564,25 @@ void convertAnimation(Anim &anim, const std::unordered_map<std::string, const Bo
     //printf("  - ChannelMapping %s %d.%d\n", ch.targetName.c_str(), ch.targetType, ch.targetIdx);
   }
 
+  // resample keyframes, each channel is independent so they can be processed in parallel
+  std::vector<uint32_t> sizeLinear(anim.channelMap.size(), 0);
+  std::vector<ErrorThreshold> thresholds(anim.channelMap.size());
+  {
+    bvh::v2::ThreadPool threadPool;
+    for(uint32_t c=0; c<anim.channelMap.size(); ++c) {
+      auto &ch = anim.channelMap[c];
+      auto threshold = ch.targetIdx < boneReach.size()
+        ? getChannelThreshold(ch, boneReach[ch.targetIdx])
+        : ErrorThreshold{};
+      thresholds[c] = threshold;
+
+      threadPool.push([&ch, &anim, &sizeLinear, c, threshold](size_t) {
+        sizeLinear[c] = optimizeChannel(ch, anim.duration, threshold);
+      });
+    }
+    threadPool.wait();
+  }
+
   // combine channel keyframes into the global timeline
   for(uint32_t c=0; c<anim.channelMap.size(); ++c) {
     auto &keyframes = anim.channelMap[c].keyframes;
@@ -138,6 +603,14 @@ void convertAnimation(Anim &anim, const std::unordered_map<std::string, const Bo
       kf.timeNextInChannel = nextNeededTime - kf.timeNeeded;
       if(kf.timeNextInChannel < 0)kf.timeNextInChannel = 0;
 
+      // the upper 2 bits of the time in the stream store the size of the next keyframe
+      if(roundf(kf.timeNextInChannel * 60.0f) >= (1 << 14)) {
+        const auto &ch = anim.channelMap[c];
+        throw std::runtime_error("Animation '" + anim.name + "', channel '" + ch.targetName + "." + std::to_string(ch.attributeIdx)
+          + "': keyframes are " + std::to_string(kf.timeNextInChannel) + "s apart, the max. is " + std::to_string(((1 << 14) - 1) / 60.0f) + "s"
+        );
+      }
+
       kf.timeTicks = time_to_ticks(kf.time);
       kf.timeNeededTicks = time_to_ticks(kf.timeNeeded);
       kf.timeNextInChannelTicks = time_to_ticks(kf.timeNextInChannel);
@@ -159,15 +632,79 @@ void convertAnimation(Anim &anim, const std::unordered_map<std::string, const Bo
   });
 
   // Now quantize/compress the values
-  for(auto &kf : anim.keyframes)
+  for(uint32_t c=0; c<anim.channelMap.size(); ++c) {
+    auto &ch = anim.channelMap[c];
+    ch.isPreciseQuat = ch.isRotation() && needsPreciseRotation(ch, thresholds[c]);
+    ch.deltaShift = getDeltaShift(ch, thresholds[c]);
+  }
+
+  // deltas are relative to the last decoded value, so any rounding is not accumulated over multiple keyframes
+  std::vector<int32_t> lastValue(anim.channelMap.size(), -1);
+  for(uint32_t k=0; k<anim.keyframes.size(); ++k)
   {
+    auto &kf = anim.keyframes[k];
     auto &ch = anim.channelMap[kf.chanelIdx];
+
+    // the first keyframe always has the max. size, so it is known before reading it
+    bool isFirst = k == 0;
     if(ch.targetType == AnimChannelTarget::ROTATION) {
-      quantizeRotation(kf);
-    } else {
-      kf.valQuantSize = 1;
-      kf.valQuant[0] = Quantizer::floatToU16(kf.valScalar, ch.valueMin, ch.valueMax - ch.valueMin);
+      quantizeRotation(kf, ch.isPreciseQuat || isFirst);
+      continue;
+    }
+
+    int32_t value = Quantizer::floatToU16(kf.valScalar, ch.valueMin, ch.valueMax - ch.valueMin);
+    int32_t &last = lastValue[kf.chanelIdx];
+    kf.valQuantSize = 0;
+
+    if(ch.deltaShift >= 0 && last >= 0 && !isFirst) {
+      int32_t delta = (int32_t)roundf((float)(value - last) / (float)(1 << ch.deltaShift));
+      int32_t valueDelta = last + delta * (1 << ch.deltaShift);
+      if(delta >= INT8_MIN && delta <= INT8_MAX && valueDelta >= 0 && valueDelta <= 0xFFFF) {
+        kf.valQuantSize = 1;
+        kf.valQuant[0] = (uint8_t)(int8_t)delta;
+        value = valueDelta;
+      }
+    }
+
+    uint16_t tangent = 0;
+    if(ch.tangentScale != 0.0f) {
+      tangent = (uint16_t)(int16_t)std::clamp(roundf(kf.tangent / ch.tangentScale), -32767.0f, 32767.0f);
+    }
+
+    if(kf.valQuantSize == 0) {
+      kf.valQuantSize = ch.tangentScale != 0.0f ? 4 : 2;
+      setQuantU16(kf, 0, value);
+      setQuantU16(kf, 1, tangent);
     }
+    if(isFirst) {
+      setQuantU16(kf, 1, tangent);
+      setQuantU16(kf, 2, 0);
+      kf.valQuantSize = 6;
+    }
+
+    last = value;
+    kf.valState[0] = value;
+    kf.valState[1] = tangent;
+    kf.valState[2] = 0;
+  }
+
+  if(config.verbose && config.animCubic) {
+    uint32_t sizeStream = 0;
+    for(const auto &kf : anim.keyframes)sizeStream += 4 + kf.valQuantSize;
+
+    uint32_t cubicCount = 0;
+    for(const auto &ch : anim.channelMap)cubicCount += ch.tangentScale != 0.0f;
+
+    uint32_t sizeStreamLinear = 0;
+    for(auto size : sizeLinear)sizeStreamLinear += size;
+
+    printf("[Anim %s] Stream size: %d bytes (linear: %d bytes), cubic channels: %d/%ld\n",
+      anim.name.c_str(), sizeStream, sizeStreamLinear, cubicCount, anim.channelMap.size()
+    );
+  }
+
+  if(config.animSnapshotTicks > 0) {
+    createAnimSnapshots(anim, config.animSnapshotTicks);
   }
 
   // re-count channels
@@ -180,4 +717,80 @@ void convertAnimation(Anim &anim, const std::unordered_map<std::string, const Bo
       anim.channelCountScalar++;
     }
   }
-}
\ No newline at end of file
+}
+
+namespace {
+  // keyframe sizes are encoded in the 2 MSBs of the time of the previous keyframe
+  uint16_t getKeyframeSizeClass(uint32_t dataSize) {
+    switch(dataSize) {
+      case 1: return 0;
+      case 2: return 1;
+      case 4: return 2;
+      case 6: return 3;
+      default: throw std::runtime_error("Invalid keyframe size: " + std::to_string(dataSize));
+    }
+  }
+}
+
+AnimStreamInfo writeAnimStream(const Anim &anim, BinaryFile &streamFile)
+{
+  // the runtime loads whole blocks relative to the start, aligning it makes each of them an aligned read
+  streamFile.align(STREAM_BLOCK_SIZE);
+  AnimStreamInfo res{.offset = streamFile.getPos()};
+
+  std::vector<uint32_t> kfOffsets{}; // relative to the stream start, used by snapshots
+  for(int k=0; k<anim.keyframes.size(); ++k) {
+    kfOffsets.push_back(streamFile.getPos() - res.offset);
+    bool isLastKF = (k >= anim.keyframes.size()-1);
+    const auto &kf = anim.keyframes[k];
+    const auto &kfNext = isLastKF ? kf : anim.keyframes[k+1];
+
+    uint16_t timeNext = kf.timeNextInChannelTicks;
+    assert(timeNext < (1 << 14)); // prevent conflicts with the size
+    timeNext |= getKeyframeSizeClass(kfNext.valQuantSize) << 14; // encode size of the next KF here
+
+    streamFile.write<uint16_t>(timeNext);
+    streamFile.write<uint16_t>(kf.chanelIdx);
+    for(int v=0; v<kf.valQuantSize; ++v) {
+      streamFile.write<uint8_t>(kf.valQuant[v]);
+    }
+  }
+
+  kfOffsets.push_back(streamFile.getPos() - res.offset);
+  res.size = streamFile.getPos() - res.offset;
+
+  if(!anim.snapshots.empty()) {
+    streamFile.align(STREAM_DATA_ALIGN);
+    res.snapshotOffset = streamFile.getPos();
+  }
+
+  for(const auto &snapshot : anim.snapshots) {
+    uint32_t k = snapshot.kfIndex;
+    streamFile.write<uint32_t>(kfOffsets[k]);
+    if(k >= anim.keyframes.size())throw std::runtime_error("Snapshot after the last keyframe in: " + anim.name);
+    streamFile.write<uint16_t>(kfOffsets[k+1] - kfOffsets[k]);
+    streamFile.write<uint16_t>(0);
+    for(const auto &ch : snapshot.channels) {
+      streamFile.write(ch.timeStartTicks);
+      streamFile.write(ch.timeEndTicks);
+      for(auto val : ch.valCurr)streamFile.write(val);
+      for(auto val : ch.valNext)streamFile.write(val);
+    }
+  }
+  return res;
+}
+
+void writeAnimChannels(const Anim &anim, BinaryFile &file)
+{
+  for(const auto &ch : anim.channelMap) {
+    file.write(ch.targetIdx);
+    file.write(ch.targetType);
+    file.write(ch.attributeIdx);
+    file.write((ch.valueMax - ch.valueMin) / (float)0xFFFF);
+    file.write(ch.valueMin);
+    file.write(ch.tangentScale);
+    file.write(ch.deltaShift < 0 ? 0.0f
+      : ((ch.valueMax - ch.valueMin) / (float)0xFFFF * (float)(1 << ch.deltaShift))
+    );
+  }
+}
@@ -7,6 +7,7 @@
 
 #include "../math/mat4.h"
 #include "../structs.h"
+#include "../binaryFile.h"
 
 void convertVertex(
   float modelScale, float texSizeX, float texSizeY, const VertexNorm &v, VertexT3D &vT3D,
@@ -14,4 +15,50 @@ void convertVertex(
 );
 ModelChunked chunkUpModel(const Model& model);
 
-void convertAnimation(Anim &anim, const std::unordered_map<std::string, const Bone*> &nodeMap);
\ No newline at end of file
+struct BoneReach {
+  float reach{}; // max. distance to anything moved by the bone (skinned vertices, child bones)
+  uint32_t chainLength{}; // bones on the longest root-to-leaf path going through this bone
+};
+
+std::vector<BoneReach> calcBoneReach(const T3DMData &t3dm);
+
+/**
+ * Max. error of a single value of a channel, this is the same budget used when removing keyframes.
+ * @param bone reach of the target bone, NULL if unknown
+ */
+float getChannelErrorLimit(const AnimChannelMapping &channel, const BoneReach *bone);
+void convertAnimation(Anim &anim, const std::unordered_map<std::string, const Bone*> &nodeMap, const std::vector<BoneReach> &boneReach);
+void createAnimSnapshots(Anim &anim, uint32_t intervalTicks);
+
+// location of an animation in the streaming-data file, offsets are absolute
+struct AnimStreamInfo {
+  uint32_t offset{};
+  uint32_t size{}; // size of the keyframes, snapshots are not included
+  uint32_t snapshotOffset{}; // 0 if there are none
+};
+
+/**
+ * Writes the keyframes of a converted animation into the streaming-data file, followed by its snapshots.
+ * This is the data read by the runtime while playing the animation.
+ */
+AnimStreamInfo writeAnimStream(const Anim &anim, BinaryFile &streamFile);
+
+// Writes the channel mappings of an animation, placed after the animation header in the model file
+void writeAnimChannels(const Anim &anim, BinaryFile &file);
+
+struct SpriteInfo {
+  std::string format{}; // as used by mksprite
+  uint32_t width{};
+  uint32_t height{};
+  uint32_t size{}; // texture data in bytes
+  uint32_t tmemSize{}; // including the palette
+};
+
+std::string getTexturePath(const std::string &texPath);
+std::string getSpriteFormat(const std::vector<uint8_t> &pixels, bool usesColor, bool usesAlpha);
+uint32_t getBitsPerTexel(const std::string &format);
+SpriteInfo getSpriteInfo(const std::string &pngPath, bool usesColor, bool usesAlpha, const std::string &format = "");
+bool convertSprite(const std::string &pngPath, const std::string &outDir, const std::string &format);
+void convertSprites(const T3DMData &t3dm);
+
+void bakeLighting(T3DMData &t3dm);
@@ -0,0 +1,239 @@
+/**
+* @copyright 2024 - Max Bebök
+* @license MIT
+*/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
+#include <unordered_map>
+#include "converter.h"
+#include "../hash.h"
+
+#include "bvh/v2/bvh.h"
+#include "bvh/v2/vec.h"
+#include "bvh/v2/ray.h"
+#include "bvh/v2/tri.h"
+#include "bvh/v2/node.h"
+#include "bvh/v2/stack.h"
+#include "bvh/v2/executor.h"
+#include "bvh/v2/thread_pool.h"
+#include "bvh/v2/default_builder.h"
+
+using Scalar  = float;
+using BVec3   = bvh::v2::Vec<Scalar, 3>;
+using BBox    = bvh::v2::BBox<Scalar, 3>;
+using Tri     = bvh::v2::Tri<Scalar, 3>;
+using PreTri  = bvh::v2::PrecomputedTri<Scalar>;
+using Ray     = bvh::v2::Ray<Scalar, 3>;
+using Node    = bvh::v2::Node<Scalar, 3>;
+using Bvh     = bvh::v2::Bvh<Node>;
+
+namespace
+{
+  constexpr Scalar AO_RAY_OFFSET = 1.0f; // in model units, avoids hitting the surface the ray starts on
+
+  BVec3 toVec(const int16_t pos[3]) {
+    return BVec3((Scalar)pos[0], (Scalar)pos[1], (Scalar)pos[2]);
+  }
+
+  BVec3 toVec(const Vec3 &v) {
+    return BVec3(v[0], v[1], v[2]);
+  }
+
+  bool isStatic(const Model &model) {
+    for(const auto &tri : model.triangles) {
+      for(const auto &vert : tri.vert) {
+        if(vert.boneIndex >= 0)return false;
+      }
+    }
+    return true;
+  }
+
+  Vec3 unpackNormal(uint16_t norm) {
+    // 5,6,5 bits, see 'convertVertex'
+    int32_t x = (int16_t)(norm << 0) >> 11;
+    int32_t y = (int16_t)(norm << 5) >> 10;
+    int32_t z = (int16_t)(norm << 11) >> 11;
+    Vec3 res{x / 15.5f, y / 31.5f, z / 15.5f};
+    float len = res.length();
+    return len > 0.0f ? (res / len) : Vec3{0.0f, 1.0f, 0.0f};
+  }
+
+  float radicalInverse(uint32_t bits) {
+    bits = (bits << 16u) | (bits >> 16u);
+    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+    return (float)bits * 2.3283064365386963e-10f;
+  }
+
+  /**
+   * Directions on the hemisphere around the normal (+Z), cosine weighted.
+   * A fixed sequence is used so the result is the same each time.
+   */
+  std::vector<Vec3> getHemisphereDirs(uint32_t count) {
+    std::vector<Vec3> res{};
+    for(uint32_t i=0; i<count; ++i) {
+      float u = ((float)i + 0.5f) / (float)count;
+      float phi = radicalInverse(i) * 2.0f * (float)M_PI;
+      float r = sqrtf(u);
+      res.push_back({r * cosf(phi), r * sinf(phi), sqrtf(1.0f - u)});
+    }
+    return res;
+  }
+
+  uint32_t packColor(uint32_t rgba, const Vec3 &light) {
+    uint32_t res = rgba & 0xFF;
+    for(int c=0; c<3; ++c) {
+      float col = (float)((rgba >> (24 - c*8)) & 0xFF) * light[c];
+      res |= (uint32_t)std::clamp(roundf(col), 0.0f, 255.0f) << (24 - c*8);
+    }
+    return res;
+  }
+}
+
+/**
+ * Bakes lambert + ambient lighting of directional lights into the vertex colors of static models.
+ * Optionally, ambient-occlusion is calculated by casting rays against the scene.
+ * Baked materials are marked as unlit, the runtime disables lighting while drawing them.
+ * This assumes models are drawn with an identity matrix, as lights are in model space.
+ *
+ * @param t3dm model data, lights must already be set
+ */
+void bakeLighting(T3DMData &t3dm)
+{
+  if(t3dm.lights.empty() && config.bakeAmbient.isZero()) {
+    throw std::runtime_error("No lights to bake, add a directional light to the scene or use '--bake-dir'");
+  }
+
+  // vertex colors are only used if the material is shaded
+  std::vector<Model*> models{};
+  for(auto &model : t3dm.models) {
+    if((model.material.drawFlags & DrawFlags::SHADED) && isStatic(model))models.push_back(&model);
+  }
+
+  bvh::v2::ThreadPool threadPool;
+  bvh::v2::ParallelExecutor executor(threadPool, 1);
+
+  std::vector<PreTri> preTris{};
+  Bvh bvh{};
+  if(config.bakeAORays > 0) {
+    // any static triangle can occlude, not just the baked ones
+    std::vector<Tri> tris{};
+    for(const auto &model : t3dm.models) {
+      if(!isStatic(model))continue;
+      for(const auto &tri : model.triangles) {
+        tris.emplace_back(toVec(tri.vert[0].pos), toVec(tri.vert[1].pos), toVec(tri.vert[2].pos));
+      }
+    }
+
+    std::vector<BBox> bboxes(tris.size());
+    std::vector<BVec3> centers(tris.size());
+    executor.for_each(0, tris.size(), [&](size_t begin, size_t end) {
+      for(size_t i=begin; i<end; ++i) {
+        bboxes[i] = tris[i].get_bbox();
+        centers[i] = tris[i].get_center();
+      }
+    });
+
+    typename bvh::v2::DefaultBuilder<Node>::Config bvhConfig;
+    bvhConfig.quality = bvh::v2::DefaultBuilder<Node>::Quality::High;
+    if(!tris.empty()) {
+      bvh = bvh::v2::DefaultBuilder<Node>::build(threadPool, bboxes, centers, bvhConfig);
+    }
+
+    preTris.resize(tris.size());
+    for(size_t i=0; i<tris.size(); ++i) {
+      preTris[i] = tris[bvh.prim_ids[i]];
+    }
+  }
+
+  auto hemisphereDirs = getHemisphereDirs(config.bakeAORays);
+  Scalar aoDistance = config.bakeAODistance * config.globalScale;
+
+  auto isOccluded = [&](const BVec3 &from, const BVec3 &dir) {
+    Ray ray{from, dir, (Scalar)0.0, aoDistance};
+    bool hit = false;
+    bvh::v2::SmallStack<Bvh::Index, 64> stack;
+    bvh.intersect<true, false>(ray, bvh.get_root().index, stack, [&](size_t begin, size_t end) {
+      for(size_t i=begin; i<end; ++i) {
+        if(preTris[i].intersect(ray)) {
+          hit = true;
+          return true;
+        }
+      }
+      return false;
+    });
+    return hit;
+  };
+
+  // vertices are stored per triangle, only calculate each unique position + normal once
+  std::unordered_map<uint64_t, uint32_t> vertIndexMap{};
+  std::vector<const VertexT3D*> uniqueVerts{};
+  for(const auto *model : models) {
+    for(const auto &tri : model->triangles) {
+      for(const auto &vert : tri.vert) {
+        uint64_t key = ((uint64_t)(uint16_t)vert.pos[0] << 48) | ((uint64_t)(uint16_t)vert.pos[1] << 32)
+                     | ((uint64_t)(uint16_t)vert.pos[2] << 16) | vert.norm;
+        if(vertIndexMap.emplace(key, uniqueVerts.size()).second)uniqueVerts.push_back(&vert);
+      }
+    }
+  }
+
+  std::vector<Vec3> vertLight(uniqueVerts.size());
+  executor.for_each(0, uniqueVerts.size(), [&](size_t begin, size_t end) {
+    for(size_t v=begin; v<end; ++v) {
+      const auto &vert = *uniqueVerts[v];
+      Vec3 norm = unpackNormal(vert.norm);
+
+      Vec3 light = config.bakeAmbient;
+      for(const auto &dirLight : t3dm.lights) {
+        light += dirLight.color * std::max(norm.dot(dirLight.dir), 0.0f);
+      }
+
+      if(!hemisphereDirs.empty() && !preTris.empty()) {
+        // build a basis around the normal to orient the hemisphere
+        Vec3 up = fabsf(norm.y()) < 0.99f ? Vec3{0.0f, 1.0f, 0.0f} : Vec3{1.0f, 0.0f, 0.0f};
+        Vec3 tangent = up.cross(norm).normalize();
+        Vec3 bitangent = norm.cross(tangent);
+
+        BVec3 origin = toVec(vert.pos) + toVec(norm) * AO_RAY_OFFSET;
+        uint32_t hits = 0;
+        for(const auto &dir : hemisphereDirs) {
+          Vec3 rayDir = tangent * dir[0] + bitangent * dir[1] + norm * dir[2];
+          if(isOccluded(origin, toVec(rayDir)))++hits;
+        }
+        light *= 1.0f - (float)hits / (float)hemisphereDirs.size();
+      }
+      vertLight[v] = light.clamp(0.0f, 1.0f);
+    }
+  });
+
+  for(auto *model : models) {
+    for(auto &tri : model->triangles) {
+      for(auto &vert : tri.vert) {
+        uint64_t key = ((uint64_t)(uint16_t)vert.pos[0] << 48) | ((uint64_t)(uint16_t)vert.pos[1] << 32)
+                     | ((uint64_t)(uint16_t)vert.pos[2] << 16) | vert.norm;
+        // colors are part of the hash used to de-dupe vertices, swap them out there too
+        vert.hash ^= ((uint64_t)vert.rgba) << 5;
+        vert.rgba = packColor(vert.rgba, vertLight[vertIndexMap[key]]);
+        vert.hash ^= ((uint64_t)vert.rgba) << 5;
+      }
+    }
+
+    // the same material may also be used by lit models, so it needs to be unique
+    auto &mat = model->material;
+    if(!mat.unlit) {
+      mat.unlit = true;
+      mat.uuid = stringHash(std::to_string(mat.uuid) + "/unlit");
+    }
+  }
+
+  if(config.verbose) {
+    printf("[Bake] Lights: %d, models: %d, vertices: %d, AO rays: %d\n",
+      (int)t3dm.lights.size(), (int)models.size(), (int)uniqueVerts.size(), config.bakeAORays);
+  }
+}
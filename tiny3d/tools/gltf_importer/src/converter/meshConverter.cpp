@@ -377,5 +377,23 @@ ModelChunked chunkUpModel(const Model &model)
     res.aabbMax[2] = std::max(res.aabbMax[2], v.pos[2]);
   }
 
+  // per-part AABB, vertices with bones are in bone-space and can't be culled (full range)
+  for(auto &chunk : res.chunks) {
+    bool hasBones = chunk.boneCount > 0 || chunk.boneIndex != 0xFFFFFFFF;
+    for(int i=0; i<3; ++i) {
+      chunk.aabbMin[i] = hasBones ? -32768 : 32767;
+      chunk.aabbMax[i] = hasBones ? 32767 : -32768;
+    }
+    if(hasBones)continue;
+
+    for(uint32_t v=chunk.vertexOffset; v<(chunk.vertexOffset + chunk.vertexCount); ++v) {
+      const auto &pos = res.vertices[v].pos;
+      for(int i=0; i<3; ++i) {
+        chunk.aabbMin[i] = std::min(chunk.aabbMin[i], pos[i]);
+        chunk.aabbMax[i] = std::max(chunk.aabbMax[i], pos[i]);
+      }
+    }
+  }
+
   return res;
 }
@@ -0,0 +1,228 @@
+/**
+* @copyright 2024 - Max Bebök
+* @license MIT
+*/
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include "converter.h"
+#include "../lib/lodepng.h"
+
+#include "bvh/v2/thread_pool.h"
+#include "bvh/v2/executor.h"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+  constexpr uint32_t TMEM_SIZE = 4096;
+
+  struct SpriteTexture {
+    std::string pngPath{};
+    std::string spritePath{};
+    std::string format{}; // fixed format, e.g. of an atlas
+    bool usesColor{false};
+    bool usesAlpha{false};
+    SpriteInfo info{};
+    bool converted{false};
+  };
+
+  // checks if all values can be stored in 4 bits without any loss
+  bool fitsIn4Bits(const std::vector<uint8_t> &pixels, int channel) {
+    for(size_t i = channel; i < pixels.size(); i += 4) {
+      if((pixels[i] >> 4) != (pixels[i] & 0x0F))return false;
+    }
+    return true;
+  }
+
+  std::string getMksprite() {
+    const char* n64Inst = getenv("N64_INST");
+    if(!n64Inst)return "";
+    return std::string(n64Inst) + "/bin/mksprite";
+  }
+}
+
+// picks the smallest format that keeps everything the material actually reads from the texture
+std::string getSpriteFormat(const std::vector<uint8_t> &pixels, bool usesColor, bool usesAlpha)
+{
+  bool isGray = true;
+  bool isOpaque = true;
+  bool isAlphaBinary = true;
+  bool isAlphaGray = true; // intensity formats use the same value for color and alpha
+  std::set<uint32_t> colors{};
+
+  for(size_t i = 0; i < pixels.size(); i += 4) {
+    const uint8_t *px = &pixels[i];
+    if(px[0] != px[1] || px[0] != px[2])isGray = false;
+    if(px[3] != 0xFF)isOpaque = false;
+    if(px[3] != 0xFF && px[3] != 0)isAlphaBinary = false;
+    if(px[3] != px[0] || px[0] != px[1] || px[0] != px[2])isAlphaGray = false;
+    if(colors.size() <= 256)colors.insert(px[0] | (px[1] << 8) | (px[2] << 16) | (px[3] << 24));
+  }
+
+  if(!usesColor)isGray = true;
+  if(!usesAlpha) {
+    isOpaque = true;
+    isAlphaBinary = true;
+    isAlphaGray = true;
+  }
+
+  if(isGray) {
+    if(isAlphaGray)return fitsIn4Bits(pixels, 0) ? "I4" : "I8";
+    if(!usesColor)return fitsIn4Bits(pixels, 3) ? "IA8" : "IA16";
+    return (fitsIn4Bits(pixels, 0) && fitsIn4Bits(pixels, 3)) ? "IA8" : "IA16";
+  }
+
+  // palettes and RGBA16 only have a single bit of alpha
+  if(!isOpaque && !isAlphaBinary)return "RGBA32";
+  if(colors.size() <= 16)return "CI4";
+  if(colors.size() <= 256)return "CI8";
+  return "RGBA16";
+}
+
+uint32_t getBitsPerTexel(const std::string &format)
+{
+  if(format == "RGBA32")return 32;
+  if(format == "RGBA16" || format == "IA16")return 16;
+  if(format == "CI8" || format == "I8" || format == "IA8")return 8;
+  return 4;
+}
+
+std::string getTexturePath(const std::string &texPath)
+{
+  std::string res = fs::relative(texPath, std::filesystem::current_path()).string();
+  std::replace(res.begin(), res.end(), '\\', '/');
+
+  if(res.find("assets/") == 0) {
+    res.replace(0, 7, "rom:/");
+  }
+  if(res.find(".png") != std::string::npos) {
+    res.replace(res.find(".png"), 4, ".sprite");
+  }
+  // generated textures (e.g. atlases) are placed next to the model
+  if(res.find("filesystem/") == 0) {
+    res.replace(0, 11, "rom:/");
+  }
+  return res;
+}
+
+SpriteInfo getSpriteInfo(const std::string &pngPath, bool usesColor, bool usesAlpha, const std::string &format)
+{
+  SpriteInfo info{};
+  std::vector<uint8_t> pixels{};
+  auto error = lodepng::decode(pixels, info.width, info.height, pngPath);
+  if(error) {
+    throw std::runtime_error("Error loading texture " + pngPath + ": " + lodepng_error_text(error));
+  }
+
+  info.format = format.empty() ? getSpriteFormat(pixels, usesColor, usesAlpha) : format;
+  info.size = info.width * info.height * getBitsPerTexel(info.format) / 8;
+
+  // TMEM is loaded in lines of 8 bytes, palettes are stored with each entry repeated 4 times
+  uint32_t lineSize = (info.width * getBitsPerTexel(info.format) / 8 + 7) & ~7;
+  info.tmemSize = lineSize * info.height;
+  if(info.format == "CI4")info.tmemSize += 16 * 8;
+  if(info.format == "CI8")info.tmemSize += 256 * 8;
+  return info;
+}
+
+bool convertSprite(const std::string &pngPath, const std::string &outDir, const std::string &format)
+{
+  auto mksprite = getMksprite();
+  if(mksprite.empty())return false;
+
+  std::string cmd = "\"" + mksprite + "\"";
+  if(!format.empty())cmd += " --format " + format;
+  cmd += " -o \"" + (outDir.empty() ? std::string(".") : outDir) + "\" \"" + pngPath + "\"";
+  return std::system(cmd.c_str()) == 0;
+}
+
+void convertSprites(const T3DMData &t3dm)
+{
+  if(getMksprite().empty()) {
+    throw std::runtime_error("Converting sprites requires N64_INST to be set");
+  }
+
+  // collect all textures, each one is only converted once even if shared
+  std::map<std::string, SpriteTexture> textures{};
+  for(const auto &model : t3dm.models) {
+    for(const MaterialTexture *tex : {&model.material.texA, &model.material.texB}) {
+      if(tex->texPath.empty() || tex->texReference)continue;
+      if(fs::path(tex->texPath).extension() != ".png")continue;
+
+      auto &sprite = textures[tex->texPath];
+      if(sprite.pngPath.empty()) {
+        sprite.pngPath = tex->texPath;
+        sprite.spritePath = getTexturePath(tex->texPath);
+      }
+      sprite.usesColor |= tex->usesColor;
+      sprite.usesAlpha |= tex->usesAlpha;
+      if(!tex->spriteFormat.empty())sprite.format = tex->spriteFormat;
+    }
+  }
+
+  std::vector<SpriteTexture*> sprites{};
+  for(auto &[path, sprite] : textures) {
+    if(sprite.spritePath.find("rom:/") != 0) {
+      printf("Warning: texture %s is outside of 'assets/', not converting it\n", path.c_str());
+      continue;
+    }
+    sprite.spritePath.replace(0, 5, "filesystem/");
+    sprites.push_back(&sprite);
+  }
+
+  bvh::v2::ThreadPool threadPool;
+  bvh::v2::ParallelExecutor executor(threadPool, 1);
+  executor.for_each(0, sprites.size(), [&](size_t begin, size_t end) {
+    for(size_t i=begin; i<end; ++i) {
+      // errors are reported afterwards, exceptions can't leave the thread
+      auto &sprite = *sprites[i];
+      try {
+        sprite.info = getSpriteInfo(sprite.pngPath, sprite.usesColor, sprite.usesAlpha, sprite.format);
+        auto outDir = fs::path(sprite.spritePath).parent_path();
+        fs::create_directories(outDir);
+        sprite.converted = convertSprite(sprite.pngPath, outDir.string(), sprite.info.format);
+      } catch(const std::exception &e) {
+        printf("Error: %s\n", e.what());
+      }
+    }
+  });
+
+  for(const auto *sprite : sprites) {
+    if(!sprite->converted) {
+      throw std::runtime_error("Failed to convert texture " + sprite->pngPath);
+    }
+    // images generated into the output directory (e.g. atlases) are not needed anymore
+    auto pngDir = fs::weakly_canonical(fs::path(sprite->pngPath).parent_path());
+    if(pngDir == fs::weakly_canonical(fs::path(sprite->spritePath).parent_path())) {
+      fs::remove(sprite->pngPath);
+    }
+    if(config.verbose) {
+      printf("[Sprite] %s: %s %dx%d (%d bytes)\n", sprite->spritePath.c_str(),
+        sprite->info.format.c_str(), sprite->info.width, sprite->info.height, sprite->info.size);
+    }
+  }
+
+  // report how much of TMEM each material needs, the same material can be used by multiple models
+  std::set<uint32_t> reportedMaterials{};
+  for(const auto &model : t3dm.models) {
+    const auto &mat = model.material;
+    if(!reportedMaterials.insert(mat.uuid).second)continue;
+
+    uint32_t tmemSize = 0;
+    for(const MaterialTexture *tex : {&mat.texA, &mat.texB}) {
+      auto texIt = textures.find(tex->texPath);
+      if(texIt != textures.end() && texIt->second.converted)tmemSize += texIt->second.info.tmemSize;
+    }
+    if(tmemSize > TMEM_SIZE) {
+      printf("Warning: material %s needs %d bytes of TMEM (max. %d)\n", mat.name.c_str(), tmemSize, TMEM_SIZE);
+    } else if(config.verbose && tmemSize > 0) {
+      printf("[Material] %s: %d/%d bytes of TMEM\n", mat.name.c_str(), tmemSize, TMEM_SIZE);
+    }
+  }
+}
@@ -33,9 +33,29 @@ namespace {
     return strPos;
   }
 
-  int writeBone(BinaryFile &file, const Bone &bone, std::string &stringTable, int level) {
+  struct NameHash {
+    uint32_t hash;
+    uint16_t index; // chunk or bone index
+    char type;
+  };
+
+  // writes hashes sorted for a binary search, entries with the same hash keep their order
+  void writeNameHashes(BinaryFile &file, std::vector<NameHash> hashes) {
+    std::stable_sort(hashes.begin(), hashes.end(), [](const NameHash &a, const NameHash &b) {
+      return a.hash < b.hash;
+    });
+    for(const auto &entry : hashes) {
+      file.write(entry.hash);
+      file.write(entry.index);
+      file.write<uint8_t>(entry.type);
+      file.write<uint8_t>(0);
+    }
+  }
+
+  int writeBone(BinaryFile &file, const Bone &bone, std::string &stringTable, int level, std::vector<NameHash> &hashes) {
     //printf("Bone[%d]: %s -> %d\n", bone.index, bone.name.c_str(), bone.parentIndex);
 
+    hashes.push_back({stringHash(bone.name), (uint16_t)hashes.size(), 'S'});
     file.write(insertString(stringTable, bone.name));
     file.write<uint16_t>(bone.parentIndex);
     file.write<uint16_t>(level); // level
@@ -47,11 +67,20 @@ namespace {
 
     int boneCount = 1;
     for(const auto& child : bone.children) {
-      boneCount += writeBone(file, *child, stringTable, level+1);
+      boneCount += writeBone(file, *child, stringTable, level+1, hashes);
     }
     return boneCount;
   };
 
+  // order-independent hash of all bone names and their parents, skeletons with the same signature can share animations
+  uint32_t getSkeletonSignature(const Bone &bone, const std::string &parentName) {
+    uint32_t hash = stringHash(parentName + "/" + bone.name);
+    for(const auto& child : bone.children) {
+      hash += getSkeletonSignature(*child, bone.name);
+    }
+    return hash;
+  }
+
   std::string getRomPath(const std::string &path) {
     if(path.find("filesystem/") == 0) {
       return std::string("rom:/") + path.substr(11);
@@ -59,33 +88,27 @@ namespace {
     return path;
   }
 
-  std::string getStreamDataPath(const char* filePath, uint32_t idx) {
+  std::string getStreamDataPath(const char* filePath) {
     auto sdataPath = std::string(filePath).substr(0, std::string(filePath).size()-5);
     std::replace(sdataPath.begin(), sdataPath.end(), '\\', '/');
-    return sdataPath + "." + std::to_string(idx) + ".sdata";
+    return sdataPath + ".sdata";
   }
-}
 
-int main(int argc, char* argv[])
-{
-  EnvArgs args{argc, argv};
-  if(args.checkArg("--help")) {
-    printf("Usage: %s <gltf-file> <t3dm-file> [--bvh] [--base-scale=64] [--ignore-materials] [--verbose]\n", argv[0]);
-    return 1;
+  // parses a hex color like 'FF8040', in the 0-1 range
+  Vec3 parseColorArg(const std::string &arg, Vec3 fallback)
+  {
+    if(arg.empty())return fallback;
+    uint32_t col = std::stoul(arg, nullptr, 16);
+    return Vec3{
+      (float)((col >> 16) & 0xFF),
+      (float)((col >> 8) & 0xFF),
+      (float)(col & 0xFF)
+    } / 255.0f;
   }
+}
 
-  const std::string gltfPath = args.getFilenameArg(0);
-  const std::string t3dmPath = args.getFilenameArg(1);
-
-  config.globalScale = (float)args.getU32Arg("--base-scale", 64);
-  config.ignoreMaterials = args.checkArg("--ignore-materials");
-  config.createBVH = args.checkArg("--bvh");
-  config.verbose = args.checkArg("--verbose");
-  config.animSampleRate = 60;
-
-  auto t3dm = parseGLTF(gltfPath.c_str(), config.globalScale);
-  fs::path gltfBasePath{gltfPath};
-
+void writeModelFile(T3DMData &t3dm, const std::string &t3dmPath)
+{
   // sort models by transparency mode (opaque -> cutout -> transparent)
   // within the same transparency mode, sort by material
   std::sort(t3dm.models.begin(), t3dm.models.end(), [](const Model &a, const Model &b) {
@@ -121,6 +144,7 @@ int main(int argc, char* argv[])
   uint32_t chunkIndex = 0;
   uint32_t chunkCount = 2; // vertices + indices
   if(config.createBVH)chunkCount += 1;
+  if(config.createPVS)chunkCount += 1;
   chunkCount += usedMaterials.size();
   std::vector<ModelChunked> modelChunks{};
   modelChunks.reserve(t3dm.models.size());
@@ -129,6 +153,7 @@ int main(int argc, char* argv[])
     if(config.verbose) {
       printf("[%s] Vertices out: %d\n", model.name.c_str(), chunks.vertices.size());
     }
+    createChunkCones(chunks);
     optimizeModelChunk(chunks);
 
     if(config.verbose) {
@@ -163,8 +188,9 @@ int main(int argc, char* argv[])
   }
   chunkCount += t3dm.skeletons.empty() ? 0 : 1;
   chunkCount += t3dm.animations.size();
+  chunkCount += 1; // name index
 
-  std::vector<BinaryFile> streamFiles{};
+  BinaryFile streamFile{}; // all animations are packed into a single file
 
   // Main file
   BinaryFile file{};
@@ -182,6 +208,7 @@ int main(int argc, char* argv[])
   file.skip(sizeof(uint32_t)); // string table offset (filled later)
 
   file.write<uint32_t>(0); // block, set by users at runtime
+  file.write<uint32_t>(0); // draw cache, set at runtime
   file.writeArray(aabbMin, 3);
   file.writeArray(aabbMax, 3);
 
@@ -209,28 +236,36 @@ int main(int argc, char* argv[])
   BinaryFile chunkVerts{};
   BinaryFile chunkIndices{};
   BinaryFile chunkBVH{};
+  BinaryFile chunkPVS{};
   std::vector<std::shared_ptr<BinaryFile>> chunkMaterials{};
   std::vector<BinaryFile> chunkSkeletons{};
 
   std::string stringTable = "S";
+  std::vector<NameHash> nameHashes{}; // objects, materials and animations
 
   // now write out each model (aka. collection of mesh-parts + materials)
   int m=0;
-  uint16_t totalVertCount = 0;
-  uint16_t totalIndexCount = 0;
+  uint32_t totalVertCount = 0;
+  uint32_t totalIndexCount = 0;
 
   if(!t3dm.skeletons.empty())
   {
     auto &chunkBone = chunkSkeletons.emplace_back();
-    chunkBone.skip(4); // size, filed later
+    chunkBone.skip(8); // size + signature, filed later
 
     int boneCount = 0;
+    uint32_t signature = 0;
+    std::vector<NameHash> boneHashes{};
     for(auto &skel : t3dm.skeletons) {
-      boneCount += writeBone(chunkBone, skel, stringTable, 0);
+      boneCount += writeBone(chunkBone, skel, stringTable, 0, boneHashes);
+      signature += getSkeletonSignature(skel, "");
     }
+    writeNameHashes(chunkBone, boneHashes);
 
     chunkBone.setPos(0);
     chunkBone.write<uint16_t>(boneCount);
+    chunkBone.write<uint16_t>(boneHashes.size());
+    chunkBone.write<uint32_t>(signature);
   }
 
   if(config.createBVH) {
@@ -238,6 +273,32 @@ int main(int argc, char* argv[])
     chunkBVH.writeArray(bvhData.data(), bvhData.size());
   }
 
+  if(config.createPVS) {
+    auto pvs = createMeshPVS(t3dm, modelChunks, aabbMin, aabbMax, config.pvsCellSize);
+    uint32_t wordsPerRow = pvs.rows.empty() ? 0 : pvs.rows[0].size();
+
+    chunkPVS.writeArray(pvs.aabbMin, 3);
+    chunkPVS.write(pvs.cellSize);
+    chunkPVS.writeArray(pvs.cellCount, 3);
+    chunkPVS.write((uint16_t)modelChunks.size());
+    chunkPVS.write((uint16_t)pvs.rows.size());
+    chunkPVS.write((uint16_t)wordsPerRow);
+    uint32_t offsetRows = chunkPVS.getPos();
+    chunkPVS.write<uint32_t>(0); // offset to rows (set later)
+
+    chunkPVS.writeArray(pvs.cellRows.data(), pvs.cellRows.size());
+    chunkPVS.align(4);
+
+    uint32_t rowsPos = chunkPVS.posPush();
+      chunkPVS.setPos(offsetRows);
+      chunkPVS.write(rowsPos);
+    chunkPVS.posPop();
+
+    for(const auto &row : pvs.rows) {
+      chunkPVS.writeArray(row.data(), row.size());
+    }
+  }
+
   // write used materials
   for(auto &material_ : usedMaterials) {
     auto &material = *material_;
@@ -253,7 +314,8 @@ int main(int argc, char* argv[])
     f->write<uint8_t>(
       material.setPrimColor |
       (material.setEnvColor << 1) |
-      (material.setBlendColor << 2)
+      (material.setBlendColor << 2) |
+      (material.unlit << 3)
     );
     f->write(material.vertexFxFunc);
 
@@ -270,15 +332,7 @@ int main(int argc, char* argv[])
       f->write(mat.texReference);
       std::string texPath = "";
       if(!mat.texPath.empty()) {
-        texPath = fs::relative(mat.texPath, std::filesystem::current_path()).string();
-        std::replace(texPath.begin(), texPath.end(), '\\', '/');
-
-        if(texPath.find("assets/") == 0) {
-          texPath.replace(0, 7, "rom:/");
-        }
-        if(texPath.find(".png") != std::string::npos) {
-          texPath.replace(texPath.find(".png"), 4, ".sprite");
-        }
+        texPath = getTexturePath(mat.texPath);
       }
 
       if(!texPath.empty()) {
@@ -319,11 +373,12 @@ int main(int argc, char* argv[])
   file.align(8);
   for(auto &model : t3dm.models)
   {
+    const auto &chunks = modelChunks[m];
+    nameHashes.push_back({stringHash(chunks.chunks.back().name), (uint16_t)chunkIndex, 'O'});
     addToChunkTable('O');
     uint32_t matIdx = materialUUIDMap[model.material.uuid];
 
     // write object chunk
-    const auto &chunks = modelChunks[m];
     file.write(insertString(stringTable, chunks.chunks.back().name));
     file.write((uint16_t)chunks.chunks.size());
     file.write(chunks.triCount);
@@ -352,6 +407,12 @@ int main(int argc, char* argv[])
       file.write((uint8_t)chunk.stripIndices[1].size());
       file.write((uint8_t)chunk.stripIndices[2].size());
       file.write((uint8_t)chunk.stripIndices[3].size());
+      file.writeArray(chunk.coneAxis, 3);
+      file.write(chunk.coneCutoff);
+      file.writeArray(chunk.sphereCenter, 3);
+      file.write(chunk.sphereRadius);
+      file.writeArray(chunk.aabbMin, 3);
+      file.writeArray(chunk.aabbMax, 3);
 
       // write indices data
       chunkIndices.writeArray(chunk.indices.data(), chunk.indices.size());
@@ -395,10 +456,9 @@ int main(int argc, char* argv[])
     ++m;
   }
 
-  uint16_t animIdx = 0;
   for(const auto &anim : t3dm.animations) {
-    BinaryFile streamFile{};
     file.align(4);
+    nameHashes.push_back({stringHash(anim.name), (uint16_t)chunkIndex, 'A'});
     addToChunkTable('A');
 
     file.write(insertString(stringTable, anim.name));
@@ -407,45 +467,15 @@ int main(int argc, char* argv[])
     file.write<uint16_t>(anim.channelCountQuat);
     file.write<uint16_t>(anim.channelCountScalar);
     file.write<uint32_t>(insertString(stringTable,
-      getRomPath(getStreamDataPath(t3dmPath.c_str(), animIdx))
+      getRomPath(getStreamDataPath(t3dmPath.c_str()))
     ));
-
-    std::unordered_set<uint32_t> channelHasKF{};
-    for(int k=0; k<anim.keyframes.size(); ++k) {
-      bool isLastKF = (k >= anim.keyframes.size()-1);
-      const auto &kf = anim.keyframes[k];
-      const auto &kfNext = isLastKF ? kf : anim.keyframes[k+1];
-
-      bool nextIsLarge = kfNext.valQuantSize > 1;
-
-      uint16_t timeNext = kf.timeNextInChannelTicks;
-      assert(timeNext < (1 << 15)); // prevent conflicts with size flag
-      if(nextIsLarge)timeNext |= (1 << 15); // encode size of the next KF here
-
-      //printf("KF[%d]: %.4f, needed: %.4f, next: %.4f\n", k, kf.time, kf.timeNeeded, kf.timeNextInChannel);
-
-      streamFile.write<uint16_t>(timeNext);
-      streamFile.write<uint16_t>(kf.chanelIdx);
-      for(int v=0; v<kf.valQuantSize; ++v) {
-        streamFile.write<uint16_t>(kf.valQuant[v]);
-      }
-
-      // force the first keyframe to have 2 values, this is to have a known initial state
-      if(k == 0 && kf.valQuantSize == 1) {
-        streamFile.write<uint16_t>(0);
-      }
-    }
-    streamFiles.push_back(streamFile);
-
-    for(const auto &ch : anim.channelMap) {
-      file.write(ch.targetIdx);
-      file.write(ch.targetType);
-      file.write(ch.attributeIdx);
-      file.write((ch.valueMax - ch.valueMin) / (float)0xFFFF);
-      file.write(ch.valueMin);
-    }
-
-    ++animIdx;
+    auto streamInfo = writeAnimStream(anim, streamFile);
+    file.write<uint32_t>(streamInfo.offset);
+    file.write<uint32_t>(streamInfo.size);
+    file.write<uint32_t>(streamInfo.snapshotOffset);
+    file.write<uint16_t>(anim.snapshots.size());
+    file.write<uint16_t>(config.animSnapshotTicks);
+    writeAnimChannels(anim, file);
   }
 
   // Now patch all chunks together and write out the chunk-table
@@ -456,6 +486,12 @@ int main(int argc, char* argv[])
     file.writeMemFile(chunkBVH);
   }
 
+  if(config.createPVS) {
+    file.align(8);
+    addToChunkTable('P');
+    file.writeMemFile(chunkPVS);
+  }
+
   file.align(16);
   addChunkTypeIndex();
   addToChunkTable('V');
@@ -467,8 +503,10 @@ int main(int argc, char* argv[])
   file.writeMemFile(chunkIndices);
 
   addChunkTypeIndex();
-  for(auto &f : chunkMaterials) {
+  for(uint32_t i=0; i<chunkMaterials.size(); ++i) {
+    auto &f = chunkMaterials[i];
     file.align(8);
+    nameHashes.push_back({stringHash(usedMaterials[i]->name), (uint16_t)chunkIndex, 'M'});
     addToChunkTable('M');
     file.writeMemFile(*f);
   }
@@ -479,6 +517,12 @@ int main(int argc, char* argv[])
     file.writeMemFile(chunkSkel);
   }
 
+  // name index, always the last chunk so it can be found without a search
+  file.align(4);
+  addToChunkTable('H');
+  file.write<uint32_t>(nameHashes.size());
+  writeNameHashes(file, nameHashes);
+
   // String table
   file.align(4);
   uint32_t stringTableOffset = file.getPos();
@@ -487,16 +531,165 @@ int main(int argc, char* argv[])
   file.setPos(offsetStringTablePtr);
   file.write(stringTableOffset);
 
+  // chunk offsets are only 24-bit, and vertex/index counts 16-bit
+  if(stringTableOffset > 0xFF'FFFF || totalVertCount > 0xFFFF || totalIndexCount > 0xFFFF) {
+    throw std::runtime_error("Model is too large (" + std::to_string(stringTableOffset) + " bytes, "
+      + std::to_string(totalVertCount) + " vertices, " + std::to_string(totalIndexCount) + " indices), split it with --tiles");
+  }
+
   // patch vertex/index count
   file.setPos(0x08);
-  file.write(totalVertCount);
-  file.write(totalIndexCount);
+  file.write<uint16_t>(totalVertCount);
+  file.write<uint16_t>(totalIndexCount);
 
   // write to actual file
   file.writeToFile(t3dmPath.c_str());
 
-  for(int s=0; s<streamFiles.size(); ++s) {
-    auto sdataPath = getStreamDataPath(t3dmPath.c_str(), s);
-    streamFiles[s].writeToFile(sdataPath.c_str());
+  if(!t3dm.animations.empty()) {
+    streamFile.align(STREAM_DATA_ALIGN);
+    streamFile.writeToFile(getStreamDataPath(t3dmPath.c_str()).c_str());
   }
-}
\ No newline at end of file
+}
+
+// Splits all models into tiles on the XZ plane, each written as its own model.
+// The file at 't3dmPath' is then a manifest referencing them.
+void writeTiles(T3DMData &t3dm, const std::string &t3dmPath)
+{
+  if(!t3dm.skeletons.empty() || !t3dm.animations.empty()) {
+    throw std::runtime_error("Tiles can't contain skeletons or animations");
+  }
+
+  // triangles are assigned by their center, so models spanning multiple tiles get split up
+  float tileSize = (float)config.tileSize;
+  std::map<std::pair<int32_t, int32_t>, T3DMData> tiles{};
+  for(const auto &model : t3dm.models) {
+    std::map<std::pair<int32_t, int32_t>, Model> modelTiles{};
+    for(const auto &tri : model.triangles) {
+      float centerX = (tri.vert[0].pos[0] + tri.vert[1].pos[0] + tri.vert[2].pos[0]) / 3.0f;
+      float centerZ = (tri.vert[0].pos[2] + tri.vert[1].pos[2] + tri.vert[2].pos[2]) / 3.0f;
+      std::pair<int32_t, int32_t> tileIdx{(int32_t)floorf(centerX / tileSize), (int32_t)floorf(centerZ / tileSize)};
+
+      auto &tileModel = modelTiles[tileIdx];
+      if(tileModel.triangles.empty()) {
+        tileModel.name = model.name;
+        tileModel.material = model.material;
+      }
+      tileModel.triangles.push_back(tri);
+    }
+    for(auto &[tileIdx, tileModel] : modelTiles) {
+      tiles[tileIdx].models.push_back(std::move(tileModel));
+    }
+  }
+
+  std::string basePath = t3dmPath.substr(0, t3dmPath.find_last_of('.'));
+  std::replace(basePath.begin(), basePath.end(), '\\', '/');
+
+  BinaryFile file{};
+  file.writeChars("T3T", 3);
+  file.write<uint8_t>(T3DT_VERSION);
+  file.write<uint32_t>(tiles.size());
+  file.write<float>(tileSize);
+  uint32_t offsetStringTablePtr = file.getPos();
+  file.write<uint32_t>(0); // string table offset (set later)
+
+  std::string stringTable = "S";
+  uint32_t tileIdx = 0;
+  for(auto &[tilePos, tile] : tiles) {
+    std::string tilePath = basePath + "." + std::to_string(tileIdx++) + ".t3dm";
+    writeModelFile(tile, tilePath);
+
+    int16_t aabbMin[3] = {32767, 32767, 32767};
+    int16_t aabbMax[3] = {-32768, -32768, -32768};
+    for(const auto &model : tile.models) {
+      for(const auto &tri : model.triangles) {
+        for(const auto &vert : tri.vert) {
+          for(int i=0; i<3; ++i) {
+            aabbMin[i] = std::min(aabbMin[i], vert.pos[i]);
+            aabbMax[i] = std::max(aabbMax[i], vert.pos[i]);
+          }
+        }
+      }
+    }
+
+    if(config.verbose) {
+      printf("[Tile %d,%d] %s: %d models\n", tilePos.first, tilePos.second, tilePath.c_str(), (int)tile.models.size());
+    }
+
+    file.writeArray(aabbMin, 3);
+    file.writeArray(aabbMax, 3);
+    file.write(insertString(stringTable, getRomPath(tilePath)));
+    file.write<uint32_t>(fs::file_size(tilePath)); // memory needed once loaded
+  }
+
+  file.align(4);
+  uint32_t stringTableOffset = file.getPos();
+  file.write(stringTable);
+  file.setPos(offsetStringTablePtr);
+  file.write(stringTableOffset);
+
+  file.writeToFile(t3dmPath.c_str());
+}
+
+int main(int argc, char* argv[])
+{
+  EnvArgs args{argc, argv};
+  if(args.checkArg("--help")) {
+    printf("Usage: %s <gltf-file> <t3dm-file> [--bvh] [--pvs] [--pvs-cell=0] [--anim-error=0] [--anim-cubic] [--anim-snapshot=0] [--anim-source-keys] [--anim-lib] [--tiles=0] [--atlas] [--sprites] [--bake-light] [--bake-ambient=404040] [--bake-dir=x,y,z] [--bake-color=FFFFFF] [--bake-ao=0] [--bake-ao-dist=1] [--base-scale=64] [--ignore-materials] [--verbose]\n", argv[0]);
+    return 1;
+  }
+
+  const std::string gltfPath = args.getFilenameArg(0);
+  const std::string t3dmPath = args.getFilenameArg(1);
+
+  config.globalScale = (float)args.getU32Arg("--base-scale", 64);
+  config.ignoreMaterials = args.checkArg("--ignore-materials");
+  config.createBVH = args.checkArg("--bvh");
+  config.pvsCellSize = args.getU32Arg("--pvs-cell", 0);
+  config.createPVS = args.checkArg("--pvs") || config.pvsCellSize > 0;
+  config.verbose = args.checkArg("--verbose");
+  config.animSampleRate = 60;
+  config.animError = args.getFloatArg("--anim-error", 0.0f);
+  config.animCubic = args.checkArg("--anim-cubic");
+  config.animSnapshotTicks = args.getU32Arg("--anim-snapshot", 0);
+  config.animSourceKeys = args.checkArg("--anim-source-keys");
+  config.animLibrary = args.checkArg("--anim-lib");
+  config.tileSize = args.getU32Arg("--tiles", 0);
+  config.createAtlas = args.checkArg("--atlas");
+  config.createSprites = args.checkArg("--sprites");
+  config.bakeLight = args.checkArg("--bake-light");
+  config.bakeAmbient = parseColorArg(args.getStringArg("--bake-ambient"), {0.25f, 0.25f, 0.25f});
+  config.bakeAORays = args.getU32Arg("--bake-ao", 0);
+  config.bakeAODistance = args.getFloatArg("--bake-ao-dist", 1.0f);
+
+  auto t3dm = parseGLTF(gltfPath.c_str(), config.globalScale);
+
+  // libraries only contain the skeleton and animations, to be used with any model sharing the same skeleton
+  if(config.animLibrary) {
+    if(t3dm.skeletons.empty()) {
+      throw std::runtime_error("Animation library requires a skeleton");
+    }
+    t3dm.models.clear();
+  }
+  if(config.bakeLight) {
+    // an extra light can be set from the command line, in addition to the ones in the scene
+    if(args.checkArg("--bake-dir")) {
+      Vec3 dir{};
+      if(sscanf(args.getStringArg("--bake-dir").c_str(), "%f,%f,%f", &dir[0], &dir[1], &dir[2]) != 3 || dir.isZero()) {
+        throw std::runtime_error("Invalid light direction, expected '--bake-dir=x,y,z'");
+      }
+      t3dm.lights.push_back({dir.normalize(), parseColorArg(args.getStringArg("--bake-color"), {1.0f, 1.0f, 1.0f})});
+    }
+    bakeLighting(t3dm);
+  }
+  if(config.createAtlas) {
+    createTextureAtlases(t3dm, t3dmPath);
+  }
+  if(config.createSprites) {
+    convertSprites(t3dm);
+  }
+  if(config.tileSize > 0) {
+    writeTiles(t3dm, t3dmPath);
+  } else {
+    writeModelFile(t3dm, t3dmPath);
+  }
+}
@@ -68,4 +68,39 @@ namespace Quantizer
 
     return (largestIdx << 30) | (q0 << 20) | (q1 << 10) | q2;
   }
+
+  // Same as 'quatTo32Bit' but with 15 bits per component, used where 10 bits are not precise enough
+  inline uint64_t quatTo48Bit(const Quat &q)
+  {
+    constexpr float rangeMin = -SQRT_2_INV;
+    constexpr float rangeScale = SQRT_2_INV + SQRT_2_INV;
+
+    auto qSq = q.toVec4() * q.toVec4();
+    int largestIdx = qSq.getLargestIdx();
+    float valNeg = q[largestIdx] >= 0 ? 1.0f : -1.0f;
+
+    uint64_t res = largestIdx;
+    for(int i=1; i<4; ++i) {
+      float val = valNeg * q[(largestIdx + i) % 4];
+      res = (res << 15) | (uint64_t)round((double)(val - rangeMin) / rangeScale * 32767.0);
+    }
+    return res;
+  }
+
+  // Reverse of 'quatTo32Bit' / 'quatTo48Bit', matches the unpacking done at runtime
+  inline Quat quatFromBits(uint64_t value, int bits)
+  {
+    uint64_t mask = (1 << bits) - 1;
+    int largestIdx = (value >> (bits * 3)) & 0b11;
+    Quat res{};
+    float sum = 0.0f;
+    for(int i=3; i>0; --i) {
+      float val = (float)(value & mask) / (float)mask * (SQRT_2_INV + SQRT_2_INV) - SQRT_2_INV;
+      res[(largestIdx + i) % 4] = val;
+      sum += val * val;
+      value >>= bits;
+    }
+    res[largestIdx] = sqrtf(std::max(0.0f, 1.0f - sum));
+    return res;
+  }
 }
\ No newline at end of file
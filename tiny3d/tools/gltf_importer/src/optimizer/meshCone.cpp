@@ -0,0 +1,65 @@
+/**
+* @copyright 2024 - Max Bebök
+* @license MIT
+*/
+#include "optimizer.h"
+#include <algorithm>
+#include <cmath>
+
+#include "../lib/meshopt/meshoptimizer.h"
+
+namespace {
+  constexpr int8_t CONE_CUTOFF_NONE = 127; // cone covers all directions, part is never culled
+  constexpr size_t MAX_CONE_TRIANGLES = 512; // limit of 'meshopt_computeClusterBounds'
+}
+
+/**
+ * Calculates the normal cone and bounding sphere of each part, used to cull back-facing parts at runtime.
+ * This must be called before 'optimizeModelChunk', as it needs the plain triangle list.
+ * Parts that are skinned, only load vertices, or have no (or front-face) culling in their material are never culled.
+ */
+void createChunkCones(ModelChunked &model)
+{
+  std::vector<float> positions{};
+  positions.reserve(model.vertices.size() * 3);
+  for(const auto &v : model.vertices) {
+    positions.push_back(v.pos[0]);
+    positions.push_back(v.pos[1]);
+    positions.push_back(v.pos[2]);
+  }
+
+  for(auto &chunk : model.chunks)
+  {
+    chunk.coneCutoff = CONE_CUTOFF_NONE;
+
+    // vertices of skinned parts are loaded by multiple parts, which also move independently
+    if(chunk.boneCount > 0 || chunk.boneIndex != 0xFFFFFFFF)continue;
+    if(chunk.indices.empty() || chunk.indices.size() / 3 > MAX_CONE_TRIANGLES)continue;
+
+    // cones are calculated for back-faces, front-face culling works by flipping the cone
+    uint32_t cullFlags = chunk.material.drawFlags & (DrawFlags::CULL_BACK | DrawFlags::CULL_FRONT);
+    if(cullFlags != DrawFlags::CULL_BACK && cullFlags != DrawFlags::CULL_FRONT)continue;
+
+    std::vector<uint32_t> indices{};
+    for(auto idx : chunk.indices)indices.push_back(chunk.vertexOffset + idx);
+
+    auto bounds = meshopt_computeClusterBounds(
+      indices.data(), indices.size(), positions.data(), model.vertices.size(), sizeof(float) * 3
+    );
+
+    // round the center to the vertex grid, and grow the radius to still enclose everything
+    for(int i=0; i<3; ++i) {
+      chunk.sphereCenter[i] = (int16_t)std::clamp(roundf(bounds.center[i]), -32768.0f, 32767.0f);
+    }
+    float centerError = sqrtf(3.0f) * 0.5f;
+    chunk.sphereRadius = (uint16_t)std::min(ceilf(bounds.radius + centerError), 65535.0f);
+
+    if(bounds.cone_cutoff_s8 >= CONE_CUTOFF_NONE)continue;
+
+    int8_t axisSign = cullFlags == DrawFlags::CULL_FRONT ? -1 : 1;
+    chunk.coneAxis[0] = bounds.cone_axis_s8[0] * axisSign;
+    chunk.coneAxis[1] = bounds.cone_axis_s8[1] * axisSign;
+    chunk.coneAxis[2] = bounds.cone_axis_s8[2] * axisSign;
+    chunk.coneCutoff = bounds.cone_cutoff_s8;
+  }
+}
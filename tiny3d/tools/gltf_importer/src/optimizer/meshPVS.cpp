@@ -0,0 +1,236 @@
+/**
+* @copyright 2024 - Max Bebök
+* @license MIT
+*/
+#include "optimizer.h"
+#include "../parser/rdp.h"
+
+#include <map>
+
+#include "bvh/v2/bvh.h"
+#include "bvh/v2/vec.h"
+#include "bvh/v2/ray.h"
+#include "bvh/v2/tri.h"
+#include "bvh/v2/node.h"
+#include "bvh/v2/stack.h"
+#include "bvh/v2/executor.h"
+#include "bvh/v2/thread_pool.h"
+#include "bvh/v2/default_builder.h"
+
+using Scalar  = float;
+using BVec3   = bvh::v2::Vec<Scalar, 3>;
+using BBox    = bvh::v2::BBox<Scalar, 3>;
+using Tri     = bvh::v2::Tri<Scalar, 3>;
+using PreTri  = bvh::v2::PrecomputedTri<Scalar>;
+using Ray     = bvh::v2::Ray<Scalar, 3>;
+using Node    = bvh::v2::Node<Scalar, 3>;
+using Bvh     = bvh::v2::Bvh<Node>;
+
+namespace
+{
+  constexpr uint32_t DEFAULT_CELLS_PER_AXIS = 16;
+
+  bool isOccluder(const Model &model) {
+    // anything that can be seen through must not hide other objects
+    const auto &mat = model.material;
+    if(mat.blendMode == RDP::BLEND::MULTIPLY)return false;
+    if(mat.otherModeValue & RDP::SOM::ALPHA_COMPARE)return false;
+    if((mat.otherModeValue & RDP::SOM::ZMODE_MASK) == RDP::SOM::ZMODE_DECAL)return false;
+    return true;
+  }
+
+  BVec3 toVec(const int16_t pos[3]) {
+    return BVec3((Scalar)pos[0], (Scalar)pos[1], (Scalar)pos[2]);
+  }
+
+  /**
+   * Sample points inside a box: center, corners and face-centers.
+   * Points are pulled slightly inwards to not start exactly on a surface.
+   */
+  std::vector<BVec3> getSamplePoints(const BVec3 &min, const BVec3 &max) {
+    constexpr Scalar INSET = 0.1f;
+    BVec3 center = (min + max) * (Scalar)0.5;
+    BVec3 halfExt = (max - min) * ((Scalar)0.5 - INSET);
+
+    std::vector<BVec3> res{center};
+    for(int i=0; i<8; ++i) {
+      res.push_back(BVec3(
+        center[0] + ((i & 1) ? halfExt[0] : -halfExt[0]),
+        center[1] + ((i & 2) ? halfExt[1] : -halfExt[1]),
+        center[2] + ((i & 4) ? halfExt[2] : -halfExt[2])
+      ));
+    }
+    for(int a=0; a<3; ++a) {
+      BVec3 p = center; p[a] += halfExt[a]; res.push_back(p);
+      p = center;       p[a] -= halfExt[a]; res.push_back(p);
+    }
+    return res;
+  }
+}
+
+/**
+ * Creates a potentially-visible-set of all objects.
+ * The model AABB is split into a grid of cells, for each cell rays are cast to all objects
+ * against the static & opaque triangles of the model.
+ * If any ray reaches an object, it is marked as visible from that cell.
+ * Since this is a sampled process, objects only visible through tiny gaps may be missed.
+ *
+ * @param t3dm model data, used for triangles and materials
+ * @param modelChunks objects in the order they are written to the file
+ * @param aabbMin AABB of the entire model
+ * @param aabbMax AABB of the entire model
+ * @param cellSize size of a cell in model units, 0 to select a size automatically
+ */
+PVSData createMeshPVS(
+  const T3DMData &t3dm, const std::vector<ModelChunked> &modelChunks,
+  const int16_t aabbMin[3], const int16_t aabbMax[3], uint32_t cellSize
+) {
+  PVSData pvs{};
+  uint32_t objCount = modelChunks.size();
+
+  int32_t maxExtend = 1;
+  for(int i=0; i<3; ++i)maxExtend = std::max(maxExtend, aabbMax[i] - aabbMin[i]);
+  if(cellSize == 0) {
+    cellSize = (maxExtend + DEFAULT_CELLS_PER_AXIS - 1) / DEFAULT_CELLS_PER_AXIS;
+  }
+  cellSize = std::clamp(cellSize, 1u, 0xFFFFu);
+
+  pvs.cellSize = cellSize;
+  for(int i=0; i<3; ++i) {
+    pvs.aabbMin[i] = aabbMin[i];
+    pvs.cellCount[i] = std::max(1u, ((uint32_t)(aabbMax[i] - aabbMin[i]) + cellSize - 1) / cellSize);
+  }
+  uint32_t cellCount = pvs.cellCount[0] * pvs.cellCount[1] * pvs.cellCount[2];
+  if(cellCount > 0xFFFF) {
+    throw std::runtime_error("PVS has too many cells (" + std::to_string(cellCount) + "), increase '--pvs-cell'");
+  }
+
+  // collect occluders, skinned meshes are ignored since they can move
+  std::vector<Tri> tris{};
+  std::vector<uint32_t> triObject{};
+  for(uint32_t o=0; o<objCount; ++o) {
+    const auto &model = t3dm.models[o];
+    if(!isOccluder(model))continue;
+    for(const auto &tri : model.triangles) {
+      if(tri.vert[0].boneIndex >= 0 || tri.vert[1].boneIndex >= 0 || tri.vert[2].boneIndex >= 0)continue;
+      tris.emplace_back(toVec(tri.vert[0].pos), toVec(tri.vert[1].pos), toVec(tri.vert[2].pos));
+      triObject.push_back(o);
+    }
+  }
+
+  bvh::v2::ThreadPool threadPool;
+  bvh::v2::ParallelExecutor executor(threadPool, 1);
+
+  std::vector<PreTri> preTris(tris.size());
+  std::vector<BBox> bboxes(tris.size());
+  std::vector<BVec3> centers(tris.size());
+  executor.for_each(0, tris.size(), [&](size_t begin, size_t end) {
+    for(size_t i=begin; i<end; ++i) {
+      bboxes[i] = tris[i].get_bbox();
+      centers[i] = tris[i].get_center();
+    }
+  });
+
+  typename bvh::v2::DefaultBuilder<Node>::Config bvhConfig;
+  bvhConfig.quality = bvh::v2::DefaultBuilder<Node>::Quality::High;
+  Bvh bvh{};
+  if(!tris.empty()) {
+    bvh = bvh::v2::DefaultBuilder<Node>::build(threadPool, bboxes, centers, bvhConfig);
+  }
+
+  // permute triangles to match the BVH order, avoids indirection during traversal
+  std::vector<uint32_t> preTriObject(tris.size());
+  for(size_t i=0; i<tris.size(); ++i) {
+    preTris[i] = tris[bvh.prim_ids[i]];
+    preTriObject[i] = triObject[bvh.prim_ids[i]];
+  }
+
+  std::vector<std::vector<BVec3>> objectSamples{};
+  for(const auto &obj : modelChunks) {
+    objectSamples.push_back(getSamplePoints(toVec(obj.aabbMin), toVec(obj.aabbMax)));
+  }
+
+  // checks if nothing except the target object itself is between the two points
+  auto isUnoccluded = [&](const BVec3 &from, const BVec3 &to, uint32_t targetObj) {
+    BVec3 dir = to - from;
+    Scalar dist = bvh::v2::length(dir);
+    if(tris.empty() || dist < (Scalar)0.001)return true;
+
+    Ray ray{from, dir * ((Scalar)1.0 / dist), (Scalar)0.0, dist};
+    bool hit = false;
+    bvh::v2::SmallStack<Bvh::Index, 64> stack;
+    bvh.intersect<true, false>(ray, bvh.get_root().index, stack, [&](size_t begin, size_t end) {
+      for(size_t i=begin; i<end; ++i) {
+        if(preTriObject[i] == targetObj)continue;
+        if(preTris[i].intersect(ray)) {
+          hit = true;
+          return true;
+        }
+      }
+      return false;
+    });
+    return !hit;
+  };
+
+  uint32_t wordsPerRow = (objCount + 31) / 32;
+  std::vector<std::vector<uint32_t>> cellBits(cellCount, std::vector<uint32_t>(wordsPerRow, 0));
+
+  executor.for_each(0, cellCount, [&](size_t begin, size_t end) {
+    for(size_t c=begin; c<end; ++c) {
+      uint32_t cx = c % pvs.cellCount[0];
+      uint32_t cy = (c / pvs.cellCount[0]) % pvs.cellCount[1];
+      uint32_t cz = c / (pvs.cellCount[0] * pvs.cellCount[1]);
+
+      BVec3 cellMin(
+        (Scalar)pvs.aabbMin[0] + cx * cellSize,
+        (Scalar)pvs.aabbMin[1] + cy * cellSize,
+        (Scalar)pvs.aabbMin[2] + cz * cellSize
+      );
+      BVec3 cellMax = cellMin + BVec3((Scalar)cellSize);
+      auto cellSamples = getSamplePoints(cellMin, cellMax);
+      auto &bits = cellBits[c];
+
+      for(uint32_t o=0; o<objCount; ++o) {
+        const auto &obj = modelChunks[o];
+        bool visible = true;
+        // objects overlapping the cell are always visible
+        for(int a=0; a<3; ++a) {
+          if(obj.aabbMax[a] < cellMin[a] || obj.aabbMin[a] > cellMax[a]) {
+            visible = false;
+            break;
+          }
+        }
+
+        for(const auto &from : cellSamples) {
+          if(visible)break;
+          for(const auto &to : objectSamples[o]) {
+            if(isUnoccluded(from, to, o)) {
+              visible = true;
+              break;
+            }
+          }
+        }
+        if(visible)bits[o / 32] |= 1u << (o % 32);
+      }
+    }
+  });
+
+  // most cells share the same set, so only store unique ones
+  std::map<std::vector<uint32_t>, uint16_t> rowMap{};
+  for(const auto &bits : cellBits) {
+    auto it = rowMap.find(bits);
+    if(it == rowMap.end()) {
+      it = rowMap.emplace(bits, pvs.rows.size()).first;
+      pvs.rows.push_back(bits);
+    }
+    pvs.cellRows.push_back(it->second);
+  }
+
+  if(config.verbose) {
+    printf("[PVS] Cells: %dx%dx%d (size: %d), unique sets: %ld, occluder tris: %ld\n",
+      pvs.cellCount[0], pvs.cellCount[1], pvs.cellCount[2], cellSize,
+      pvs.rows.size(), tris.size()
+    );
+  }
+  return pvs;
+}
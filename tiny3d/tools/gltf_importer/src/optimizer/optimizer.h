@@ -7,4 +7,10 @@
 #include "../structs.h"
 
 void optimizeModelChunk(ModelChunked &model);
-std::vector<int16_t> createMeshBVH(const std::vector<ModelChunked> &modelChunks);
\ No newline at end of file
+void createChunkCones(ModelChunked &model);
+std::vector<int16_t> createMeshBVH(const std::vector<ModelChunked> &modelChunks);
+PVSData createMeshPVS(
+  const T3DMData &t3dm, const std::vector<ModelChunked> &modelChunks,
+  const int16_t aabbMin[3], const int16_t aabbMax[3], uint32_t cellSize
+);
+void createTextureAtlases(T3DMData &t3dm, const std::string &t3dmPath);
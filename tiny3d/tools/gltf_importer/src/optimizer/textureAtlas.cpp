@@ -0,0 +1,386 @@
+/**
+* @copyright 2024 - Max Bebök
+* @license MIT
+*/
+#include "optimizer.h"
+#include "../lib/lodepng.h"
+#include "../converter/converter.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <set>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+  constexpr uint32_t TMEM_SIZE = 4096;
+  constexpr uint32_t MAX_TEX_SIZE = 64; // larger textures rarely leave room for others
+  constexpr uint32_t MIN_ATLAS_SIZE = 16;
+  constexpr uint32_t MAX_ATLAS_SIZE = 256;
+
+  // format a texture ends up in (as used by mksprite), textures are only packed together if this matches
+  struct TexFormat {
+    std::string name{};
+
+    auto operator<=>(const TexFormat&) const = default;
+
+    bool isPalette() const {
+      return name == "CI4" || name == "CI8";
+    }
+
+    uint32_t getBitsPerTexel() const {
+      return ::getBitsPerTexel(name);
+    }
+
+    // palettes (TLUT) occupy the upper half of TMEM
+    uint32_t getMaxBytes() const {
+      return isPalette() ? (TMEM_SIZE / 2) : TMEM_SIZE;
+    }
+
+    uint32_t getMaxColors() const {
+      return isPalette() ? (1u << getBitsPerTexel()) : 0xFFFF'FFFF;
+    }
+  };
+
+  struct AtlasTexture {
+    std::string path{};
+    TexFormat format{};
+    uint32_t width{};
+    uint32_t height{};
+    std::vector<uint8_t> pixels{}; // RGBA8
+    std::set<uint32_t> colors{}; // only for palettes
+    uint32_t gutter{0}; // border of repeated edge-texels, avoids bleeding with filtering
+    bool usesColor{false};
+    bool usesAlpha{false};
+    bool canPack{true};
+
+    int32_t atlasIndex{-1};
+    uint32_t posX{}; // position in the atlas, excluding the gutter
+    uint32_t posY{};
+  };
+
+  struct Atlas {
+    TexFormat format{};
+    uint32_t width{};
+    uint32_t height{};
+    std::vector<AtlasTexture*> textures{};
+    std::set<uint32_t> colors{};
+  };
+
+  uint32_t getLog2(uint32_t value) {
+    uint32_t res = 0;
+    while((1u << res) < value)++res;
+    return res;
+  }
+
+  // same format mksprite picks for a PNG on its own
+  TexFormat getTexFormat(const LodePNGColorMode &color) {
+    switch(color.colortype) {
+      case LCT_PALETTE   : return {color.bitdepth <= 4 ? "CI4" : "CI8"};
+      case LCT_GREY      : return {color.bitdepth <= 4 ? "I4" : "I8"};
+      case LCT_GREY_ALPHA: return {"IA16"};
+      default            : return {"RGBA16"};
+    }
+  }
+
+  // 'high' only matters for clamping, which has no effect as long as UVs stay inside the texture
+  bool isTileSafe(const TileParam &tile, uint32_t size) {
+    if(tile.low != 0 || tile.shift != 0 || tile.mirror)return false;
+    return tile.mask == 0 || (1u << tile.mask) >= size;
+  }
+
+  // only plain single-texture materials whose UVs stay inside the texture can be moved into an atlas
+  bool canUseAtlas(const Model &model) {
+    const auto &mat = model.material;
+    const auto &tex = mat.texA;
+    if(tex.texPath.empty() || tex.texReference)return false;
+    if(!mat.texB.texPath.empty() || mat.texB.texReference)return false;
+    if(mat.vertexFxFunc != UvGenFunc::NONE)return false;
+    if(!isTileSafe(tex.s, tex.texWidth) || !isTileSafe(tex.t, tex.texHeight))return false;
+
+    int32_t uvOffset = mat.uvFilterAdjust ? 16 : 0;
+    int32_t maxS = tex.texWidth * 32;
+    int32_t maxT = tex.texHeight * 32;
+    for(const auto &tri : model.triangles) {
+      for(const auto &vert : tri.vert) {
+        int32_t s = vert.s + uvOffset;
+        int32_t t = vert.t + uvOffset;
+        if(s < 0 || t < 0 || s > maxS || t > maxT)return false;
+      }
+    }
+    return true;
+  }
+
+  bool loadTexture(AtlasTexture &tex) {
+    std::vector<uint8_t> pngData{};
+    if(lodepng::load_file(pngData, tex.path))return false;
+
+    lodepng::State state{};
+    if(lodepng::decode(tex.pixels, tex.width, tex.height, state, pngData))return false;
+
+    tex.format = getTexFormat(state.info_png.color);
+    return true;
+  }
+
+  void loadColors(AtlasTexture &tex) {
+    for(size_t i = 0; i < tex.pixels.size(); i += 4) {
+      uint32_t col;
+      memcpy(&col, &tex.pixels[i], 4);
+      tex.colors.insert(col);
+    }
+  }
+
+  // simple shelf-packing, tries atlas sizes from small to large
+  bool packAtlas(Atlas &atlas, std::vector<AtlasTexture*> textures) {
+    std::stable_sort(textures.begin(), textures.end(), [](const AtlasTexture *a, const AtlasTexture *b) {
+      return (a->height + a->gutter*2) > (b->height + b->gutter*2);
+    });
+
+    std::vector<std::pair<uint32_t, uint32_t>> sizes{};
+    for(uint32_t w = MIN_ATLAS_SIZE; w <= MAX_ATLAS_SIZE; w *= 2) {
+      for(uint32_t h = MIN_ATLAS_SIZE; h <= MAX_ATLAS_SIZE; h *= 2) {
+        if(w * h * atlas.format.getBitsPerTexel() / 8 <= atlas.format.getMaxBytes()) {
+          sizes.push_back({w, h});
+        }
+      }
+    }
+    // prefer small and square atlases
+    std::stable_sort(sizes.begin(), sizes.end(), [](const auto &a, const auto &b) {
+      uint32_t areaA = a.first * a.second;
+      uint32_t areaB = b.first * b.second;
+      if(areaA != areaB)return areaA < areaB;
+      return std::max(a.first, a.second) < std::max(b.first, b.second);
+    });
+
+    for(const auto &[width, height] : sizes) {
+      std::vector<std::pair<uint32_t, uint32_t>> positions{};
+      uint32_t x = 0, y = 0, rowHeight = 0;
+      for(const auto *tex : textures) {
+        uint32_t w = tex->width + tex->gutter*2;
+        uint32_t h = tex->height + tex->gutter*2;
+        if(x + w > width) {
+          x = 0;
+          y += rowHeight;
+          rowHeight = 0;
+        }
+        if(x + w > width || y + h > height)break;
+        positions.push_back({x + tex->gutter, y + tex->gutter});
+        x += w;
+        rowHeight = std::max(rowHeight, h);
+      }
+
+      if(positions.size() == textures.size()) {
+        atlas.width = width;
+        atlas.height = height;
+        atlas.textures = textures;
+        for(size_t i = 0; i < textures.size(); ++i) {
+          textures[i]->posX = positions[i].first;
+          textures[i]->posY = positions[i].second;
+        }
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool tryAddToAtlas(Atlas &atlas, AtlasTexture *tex) {
+    auto colors = atlas.colors;
+    colors.insert(tex->colors.begin(), tex->colors.end());
+    if(colors.size() > atlas.format.getMaxColors())return false;
+
+    auto textures = atlas.textures;
+    textures.push_back(tex);
+    if(!packAtlas(atlas, textures))return false;
+
+    atlas.colors = colors;
+    return true;
+  }
+
+  bool writeAtlas(const Atlas &atlas, const std::string &pngPath) {
+    // unused areas get a color already in the palette, everything else is transparent
+    uint32_t clearColor = atlas.colors.empty() ? 0 : *atlas.colors.begin();
+    std::vector<uint32_t> pixels(atlas.width * atlas.height, clearColor);
+
+    for(const auto *tex : atlas.textures) {
+      int32_t g = (int32_t)tex->gutter;
+      for(int32_t y = -g; y < (int32_t)tex->height + g; ++y) {
+        for(int32_t x = -g; x < (int32_t)tex->width + g; ++x) {
+          int32_t srcX = std::clamp(x, 0, (int32_t)tex->width - 1);
+          int32_t srcY = std::clamp(y, 0, (int32_t)tex->height - 1);
+          uint32_t &dst = pixels[(tex->posY + y) * atlas.width + (tex->posX + x)];
+          memcpy(&dst, &tex->pixels[(srcY * tex->width + srcX) * 4], 4);
+        }
+      }
+    }
+
+    // the sprite format is set explicitly, the PNG itself only has to be lossless
+    std::vector<uint8_t> pngData{};
+    auto error = lodepng::encode(pngData, (const uint8_t*)pixels.data(), atlas.width, atlas.height);
+    if(error) {
+      printf("Error writing atlas %s: %s\n", pngPath.c_str(), lodepng_error_text(error));
+      return false;
+    }
+    return lodepng::save_file(pngData, pngPath) == 0;
+  }
+
+  // converts the atlas into a sprite next to it, the PNG is not needed afterwards
+  void convertAtlas(const std::string &pngPath, const TexFormat &format) {
+    if(convertSprite(pngPath, fs::path(pngPath).parent_path().string(), format.name)) {
+      fs::remove(pngPath);
+      return;
+    }
+    printf("Warning: atlas %s must be converted with mksprite\n", pngPath.c_str());
+  }
+
+  void updateVertexUV(VertexT3D &vert, int32_t offsetS, int32_t offsetT) {
+    // UVs are part of the hash used to de-dupe vertices, swap them out there too
+    vert.hash ^= ((uint64_t)(uint16_t)vert.s << 16) | ((uint64_t)(uint16_t)vert.t << 0);
+    vert.s += offsetS;
+    vert.t += offsetT;
+    vert.hash ^= ((uint64_t)(uint16_t)vert.s << 16) | ((uint64_t)(uint16_t)vert.t << 0);
+  }
+
+  bool isSameTile(const TileParam &a, const TileParam &b) {
+    return a.low == b.low && a.high == b.high && a.clamp == b.clamp
+      && a.mirror == b.mirror && a.mask == b.mask && a.shift == b.shift;
+  }
+
+  bool isSameTexture(const MaterialTexture &a, const MaterialTexture &b) {
+    return a.texPath == b.texPath && a.texWidth == b.texWidth && a.texHeight == b.texHeight
+      && a.texReference == b.texReference && isSameTile(a.s, b.s) && isSameTile(a.t, b.t);
+  }
+
+  // checks if two materials result in the same state, ignoring their name
+  bool isSameMaterial(const Material &a, const Material &b) {
+    return isSameTexture(a.texA, b.texA) && isSameTexture(a.texB, b.texB)
+      && a.colorCombiner == b.colorCombiner
+      && a.otherModeValue == b.otherModeValue && a.otherModeMask == b.otherModeMask
+      && a.blendMode == b.blendMode && a.drawFlags == b.drawFlags
+      && a.fogMode == b.fogMode && a.vertexFxFunc == b.vertexFxFunc
+      && memcmp(a.primColor, b.primColor, 4) == 0
+      && memcmp(a.envColor, b.envColor, 4) == 0
+      && memcmp(a.blendColor, b.blendColor, 4) == 0
+      && a.setPrimColor == b.setPrimColor && a.setEnvColor == b.setEnvColor
+      && a.setBlendColor == b.setBlendColor && a.uvFilterAdjust == b.uvFilterAdjust
+      && a.unlit == b.unlit;
+  }
+}
+
+void createTextureAtlases(T3DMData &t3dm, const std::string &t3dmPath)
+{
+  // textures are identified by path, all materials using one must be able to use the atlas
+  std::map<std::string, AtlasTexture> textures{};
+  for(const auto &model : t3dm.models) {
+    const auto &path = model.material.texA.texPath;
+    if(path.empty())continue;
+
+    auto texIt = textures.find(path);
+    if(texIt == textures.end()) {
+      texIt = textures.emplace(path, AtlasTexture{.path = path}).first;
+      texIt->second.canPack = loadTexture(texIt->second);
+    }
+    auto &tex = texIt->second;
+    if(!canUseAtlas(model))tex.canPack = false;
+    if(model.material.uvFilterAdjust)tex.gutter = 1;
+    tex.usesColor |= model.material.texA.usesColor;
+    tex.usesAlpha |= model.material.texA.usesAlpha;
+  }
+
+  std::vector<AtlasTexture*> candidates{};
+  for(auto &[path, tex] : textures) {
+    if(!tex.canPack || tex.width > MAX_TEX_SIZE || tex.height > MAX_TEX_SIZE)continue;
+    // with '--sprites' the format depends on how the texture is used, the atlas is sized and converted with it
+    if(config.createSprites)tex.format = TexFormat{getSpriteFormat(tex.pixels, tex.usesColor, tex.usesAlpha)};
+    if(tex.format.isPalette())loadColors(tex);
+
+    // must leave room for at least one more texture
+    uint32_t size = (tex.width + tex.gutter*2) * (tex.height + tex.gutter*2) * tex.format.getBitsPerTexel() / 8;
+    if(size > tex.format.getMaxBytes() / 2)continue;
+    candidates.push_back(&tex);
+  }
+
+  // pack the largest textures first, they are the hardest to fit
+  std::stable_sort(candidates.begin(), candidates.end(), [](const AtlasTexture *a, const AtlasTexture *b) {
+    return (a->width * a->height) > (b->width * b->height);
+  });
+
+  std::vector<Atlas> atlases{};
+  for(auto *tex : candidates) {
+    bool added = false;
+    for(auto &atlas : atlases) {
+      if(atlas.format == tex->format && tryAddToAtlas(atlas, tex)) {
+        added = true;
+        break;
+      }
+    }
+    if(!added) {
+      Atlas atlas{.format = tex->format, .colors = tex->colors};
+      if(packAtlas(atlas, {tex}))atlases.push_back(atlas);
+    }
+  }
+
+  // an atlas with a single texture would only waste space
+  std::erase_if(atlases, [](const Atlas &atlas) { return atlas.textures.size() < 2; });
+  if(atlases.empty())return;
+
+  std::string basePath = t3dmPath.substr(0, t3dmPath.find_last_of('.'));
+  std::replace(basePath.begin(), basePath.end(), '\\', '/');
+
+  std::vector<std::string> atlasPaths{};
+  for(uint32_t a = 0; a < atlases.size(); ++a) {
+    auto &atlas = atlases[a];
+    std::string pngPath = basePath + ".atlas" + std::to_string(a) + ".png";
+    if(!writeAtlas(atlas, pngPath))continue;
+    // with '--sprites' it's converted later together with all other textures
+    if(!config.createSprites)convertAtlas(pngPath, atlas.format);
+
+    for(auto *tex : atlas.textures)tex->atlasIndex = atlasPaths.size();
+    atlasPaths.push_back(pngPath);
+
+    if(config.verbose) {
+      printf("[Atlas] %s: %s %dx%d, %d textures\n", pngPath.c_str(), atlas.format.name.c_str(), atlas.width, atlas.height, (int)atlas.textures.size());
+    }
+  }
+
+  // move UVs into the atlas and let the material point to it
+  std::vector<Model*> changedModels{};
+  for(auto &model : t3dm.models) {
+    auto texIt = textures.find(model.material.texA.texPath);
+    if(texIt == textures.end() || texIt->second.atlasIndex < 0)continue;
+
+    const auto &tex = texIt->second;
+    const auto &atlas = *std::find_if(atlases.begin(), atlases.end(), [&](const Atlas &atlas) {
+      return std::find(atlas.textures.begin(), atlas.textures.end(), &tex) != atlas.textures.end();
+    });
+
+    for(auto &tri : model.triangles) {
+      for(auto &vert : tri.vert) {
+        updateVertexUV(vert, tex.posX * 32, tex.posY * 32);
+      }
+    }
+
+    auto &matTex = model.material.texA;
+    matTex.texPath = atlasPaths[tex.atlasIndex];
+    matTex.spriteFormat = atlas.format.name;
+    matTex.texWidth = atlas.width;
+    matTex.texHeight = atlas.height;
+    matTex.s = {.low = 0, .high = (float)(atlas.width - 1), .mask = (int8_t)getLog2(atlas.width)};
+    matTex.t = {.low = 0, .high = (float)(atlas.height - 1), .mask = (int8_t)getLog2(atlas.height)};
+    changedModels.push_back(&model);
+  }
+
+  // materials only differing in their texture before are now the same, merge them
+  for(size_t i = 0; i < changedModels.size(); ++i) {
+    auto &matA = changedModels[i]->material;
+    for(size_t j = 0; j < i; ++j) {
+      const auto &matB = changedModels[j]->material;
+      if(matA.uuid != matB.uuid && isSameMaterial(matA, matB)) {
+        matA.uuid = matB.uuid;
+        matA.name = matB.name;
+        break;
+      }
+    }
+  }
+}
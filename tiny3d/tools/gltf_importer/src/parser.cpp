@@ -113,14 +113,21 @@ T3DMData parseGLTF(const char *gltfPath, float modelScale)
     }
   }
 
-  // Animations
-  //printf("Animations: %d\n", data->animations_count);
-
-  for(int i=0; i<data->animations_count; ++i) {
-    auto anim = parseAnimation(data->animations[i], boneMap, config.animSampleRate);
-    if(anim.duration < 0.0001f)continue; // ignore empty animations
-    convertAnimation(anim, boneMap);
-    t3dm.animations.push_back(anim);
+  // Lights, only directional ones are used to bake lighting
+  for(int i=0; i<data->nodes_count; ++i) {
+    auto node = &data->nodes[i];
+    if(!node->light || node->light->type != cgltf_light_type_directional)continue;
+
+    // lights point along -Z, intensity is only used to dim them since the units depend on the exporter
+    float mat[16];
+    cgltf_node_transform_world(node, mat);
+    Vec3 dir = Vec3{mat[8], mat[9], mat[10]}.normalize();
+    float intensity = std::min(node->light->intensity, 1.0f);
+
+    // linear to gamma, same as material colors
+    Vec3 color{};
+    for(int c=0; c<3; ++c)color[c] = powf(node->light->color[c], 0.4545f) * intensity;
+    t3dm.lights.push_back({dir, color});
   }
 
   // Meshes
@@ -328,6 +335,17 @@ T3DMData parseGLTF(const char *gltfPath, float modelScale)
     }
   }
 
+  // Animations, this is done after meshes since the error metric depends on the skinned vertices
+  //printf("Animations: %d\n", data->animations_count);
+  auto boneReach = calcBoneReach(t3dm);
+
+  for(int i=0; i<data->animations_count; ++i) {
+    auto anim = parseAnimation(data->animations[i], boneMap, boneReach, config.animSampleRate);
+    if(anim.duration < 0.0001f)continue; // ignore empty animations
+    convertAnimation(anim, boneMap, boneReach);
+    t3dm.animations.push_back(anim);
+  }
+
   cgltf_free(data);
   return t3dm;
 }
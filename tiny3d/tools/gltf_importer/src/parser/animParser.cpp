@@ -4,6 +4,7 @@
 */
 
 #include "parser.h"
+#include <algorithm>
 #include <cassert>
 
 namespace
@@ -40,10 +41,183 @@ namespace
       anim.channelMap[chIdx + i].valueMax = std::max(anim.channelMap[chIdx + i].valueMax, value[i]);
     }
   }
+
+  /**
+   * Keyframes of a glTF sampler as stored in the file.
+   * Values are always read as vec4, for translation/scale the last component is unused.
+   * Cubic-splines also store an in- and out-tangent per keyframe.
+   */
+  struct SourceSampler
+  {
+    std::vector<float> times{};
+    std::vector<Vec4> values{};
+    std::vector<Vec4> tangentIn{};
+    std::vector<Vec4> tangentOut{};
+    cgltf_interpolation_type interpolation{};
+    bool isRotation{};
+
+    SourceSampler(const cgltf_animation_sampler &sampler, bool isRotation)
+      : interpolation{sampler.interpolation}, isRotation{isRotation}
+    {
+      const auto &samplerIn = *sampler.input;
+      const auto &samplerOut = *sampler.output;
+      uint8_t *dataInput = ((uint8_t*)samplerIn.buffer_view->buffer->data) + samplerIn.offset + samplerIn.buffer_view->offset;
+      uint8_t *dataOutput = ((uint8_t*)samplerOut.buffer_view->buffer->data) + samplerOut.offset + samplerOut.buffer_view->offset;
+
+      bool isCubic = interpolation == cgltf_interpolation_type_cubic_spline;
+      if(samplerOut.count != samplerIn.count * (isCubic ? 3 : 1)) {
+        throw std::runtime_error("Animation sampler has mismatching input/output count");
+      }
+
+      auto readValue = [&]() {
+        Vec4 res = isRotation
+          ? Gltf::readAsVec4(dataOutput, samplerOut.type, samplerOut.component_type)
+          : Vec4{Gltf::readAsVec3(dataOutput, samplerOut.type, samplerOut.component_type)};
+        dataOutput += samplerOut.stride;
+        return res;
+      };
+
+      for(uint32_t k=0; k<samplerIn.count; ++k) {
+        times.push_back(Gltf::readAsFloat(dataInput + k * samplerIn.stride, samplerIn.component_type));
+        if(isCubic)tangentIn.push_back(readValue());
+        values.push_back(readValue());
+        if(isCubic)tangentOut.push_back(readValue());
+      }
+    }
+
+    // evaluates the curve as defined by the glTF spec.
+    [[nodiscard]] Vec4 evaluate(float t) const
+    {
+      if(t <= times.front())return values.front();
+      if(t >= times.back())return values.back();
+
+      uint32_t i = (std::upper_bound(times.begin(), times.end(), t) - times.begin()) - 1;
+      if(interpolation == cgltf_interpolation_type_step)return values[i];
+
+      float tDiff = times[i+1] - times[i];
+      float interp = (t - times[i]) / tDiff;
+
+      if(interpolation == cgltf_interpolation_type_cubic_spline) {
+        float t2 = interp * interp;
+        float t3 = t2 * interp;
+        Vec4 res = values[i]       * (2*t3 - 3*t2 + 1)
+                 + tangentOut[i]   * ((t3 - 2*t2 + interp) * tDiff)
+                 + values[i+1]     * (-2*t3 + 3*t2)
+                 + tangentIn[i+1]  * ((t3 - t2) * tDiff);
+        return isRotation ? (res / sqrtf(res.length2())) : res;
+      }
+
+      if(isRotation) {
+        return Quat{values[i]}.slerp(Quat{values[i+1]}, interp).toVec4();
+      }
+      return values[i] + (values[i+1] - values[i]) * interp;
+    }
+  };
+
+  // interpolates values the same way the runtime does (lerp for scalars, nlerp for rotations)
+  Vec4 interpolateRuntime(const Vec4 &a, const Vec4 &b, float interp, bool isRotation) {
+    if(!isRotation)return a + (b - a) * interp;
+    float blend = a.dot(b) < 0.0f ? (interp - 1.0f) : (1.0f - interp);
+    Vec4 res = a * blend + b * interp;
+    return res / sqrtf(res.length2());
+  }
+
+  float getValueError(const Vec4 &a, const Vec4 &b, bool isRotation) {
+    if(isRotation) {
+      // 'q' and '-q' are the same rotation
+      return sqrtf(std::min((a - b).length2(), (a + b).length2()));
+    }
+    return std::max(std::max(fabsf(a[0] - b[0]), fabsf(a[1] - b[1])), fabsf(a[2] - b[2]));
+  }
+
+  /**
+   * Inserts ticks between 'tickA' and 'tickB' until interpolating between them matches the source curve.
+   * Each step only adds the tick with the largest error, so straight parts of the curve stay untouched.
+   * 'tolerance' is the max. deviation of a value, see 'getChannelErrorLimit'.
+   */
+  void refineSegment(const SourceSampler &sampler, uint32_t tickA, uint32_t tickB, float tickStep, float tolerance, std::vector<uint32_t> &ticks)
+  {
+    if(tickB - tickA < 2)return;
+    Vec4 valA = sampler.evaluate(tickA * tickStep);
+    Vec4 valB = sampler.evaluate(tickB * tickStep);
+
+    float maxError = 0.0f;
+    uint32_t maxTick = 0;
+    for(uint32_t tick = tickA+1; tick < tickB; ++tick) {
+      float interp = (float)(tick - tickA) / (float)(tickB - tickA);
+      Vec4 val = interpolateRuntime(valA, valB, interp, sampler.isRotation);
+      float error = getValueError(val, sampler.evaluate(tick * tickStep), sampler.isRotation);
+      if(error > maxError) {
+        maxError = error;
+        maxTick = tick;
+      }
+    }
+
+    if(maxError <= tolerance)return;
+    refineSegment(sampler, tickA, maxTick, tickStep, tolerance, ticks);
+    ticks.push_back(maxTick);
+    refineSegment(sampler, maxTick, tickB, tickStep, tolerance, ticks);
+  }
+
+  void insertSourceKeyframe(Anim &anim, float time, uint32_t chIdx, const Vec4 &value, bool isRot, bool isTranslate) {
+    if(isRot) {
+      Quat quat{value};
+      if(quat.isInvalid()) {
+        throw std::runtime_error("Invalid Quaternion in anim-parser: " + quat.toString());
+      }
+      anim.channelMap[chIdx].keyframes.push_back({.time = time, .chanelIdx = chIdx, .valQuat = quat});
+    } else {
+      insertScalarKeyframe(anim, time, chIdx, Vec3{value[0], value[1], value[2]}, isTranslate);
+    }
+  }
+
+  /**
+   * Creates keyframes from the ones stored in the glTF file, instead of resampling it at a fixed rate.
+   * Times are still rounded to ticks, since that's what the runtime can represent.
+   * Steps are stored as two keyframes at the same time (old and new value), the runtime skips over the empty segment.
+   * Linear and cubic-spline curves only get additional keyframes where the runtime interpolation deviates too much.
+   */
+  void insertSourceKeyframes(Anim &anim, const SourceSampler &sampler, uint32_t chIdx, bool isRot, bool isTranslate, uint32_t sampleRate, float tolerance)
+  {
+    float tickStep = 1.0f / sampleRate;
+    auto timeToTick = [&](float t) { return (uint32_t)roundf(t * sampleRate); };
+
+    if(sampler.interpolation == cgltf_interpolation_type_step) {
+      uint32_t lastTick = 0;
+      for(uint32_t k=0; k<sampler.times.size(); ++k) {
+        uint32_t tick = timeToTick(sampler.times[k]);
+        if(k > 0 && tick == lastTick) { // multiple steps in one tick, only the last one is visible
+          for(int i=0; i<(isRot ? 1 : 3); ++i)anim.channelMap[chIdx + i].keyframes.pop_back();
+          insertSourceKeyframe(anim, tick * tickStep, chIdx, sampler.values[k], isRot, isTranslate);
+          continue;
+        }
+        if(k > 0)insertSourceKeyframe(anim, tick * tickStep, chIdx, sampler.values[k-1], isRot, isTranslate);
+        insertSourceKeyframe(anim, tick * tickStep, chIdx, sampler.values[k], isRot, isTranslate);
+        lastTick = tick;
+      }
+      return;
+    }
+
+    std::vector<uint32_t> keyTicks{};
+    for(float t : sampler.times)keyTicks.push_back(timeToTick(t));
+    keyTicks.erase(std::unique(keyTicks.begin(), keyTicks.end()), keyTicks.end());
+
+    std::vector<uint32_t> ticks{keyTicks[0]};
+    for(uint32_t k=1; k<keyTicks.size(); ++k) {
+      refineSegment(sampler, keyTicks[k-1], keyTicks[k], tickStep, tolerance, ticks);
+      ticks.push_back(keyTicks[k]);
+    }
+
+    for(uint32_t tick : ticks) {
+      insertSourceKeyframe(anim, tick * tickStep, chIdx, sampler.evaluate(tick * tickStep), isRot, isTranslate);
+    }
+  }
 }
 
-Anim parseAnimation(const cgltf_animation &anim, const std::unordered_map<std::string, const Bone*> &nodeMap, uint32_t sampleRate)
-{
+Anim parseAnimation(
+  const cgltf_animation &anim, const std::unordered_map<std::string, const Bone*> &nodeMap,
+  const std::vector<BoneReach> &boneReach, uint32_t sampleRate
+) {
   Anim res{
     .name = std::string(anim.name),
     .keyframes = {},
@@ -101,6 +275,17 @@ Anim parseAnimation(const cgltf_animation &anim, const std::unordered_map<std::s
 
     timeStart = Gltf::readAsFloat(dataInput, samplerIn.component_type);
     timeEnd = Gltf::readAsFloat(dataInput + (samplerIn.count-1) * samplerIn.stride, samplerIn.component_type);
+
+    if(config.animSourceKeys) {
+      // same limit as used when removing keyframes later on, all axes of a scalar channel share it
+      uint32_t boneIdx = it->second->index;
+      float tolerance = getChannelErrorLimit(res.channelMap[chIdx], boneIdx < boneReach.size() ? &boneReach[boneIdx] : nullptr);
+      insertSourceKeyframes(res, SourceSampler{*channel.sampler, isRot}, chIdx, isRot, isTranslate, sampleRate, tolerance);
+      chIdx += isRot ? 1 : 3;
+      res.duration = std::max(timeEnd - timeStart, res.duration);
+      continue;
+    }
+
     float sampleStep = 1.0f / sampleRate;
     float time = timeStart;
     float nextTime = timeStart;
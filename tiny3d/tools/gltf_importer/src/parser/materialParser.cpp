@@ -115,6 +115,17 @@ namespace {
     return false;
   }
 
+  void setTextureUsage(MaterialTexture &tex, const ColorCombiner &cc)
+  {
+    // in 2-cycle mode the inputs of both textures can switch places, so they are not told apart here
+    auto isTex = [](uint8_t in) { return in == CC::TEX0 || in == CC::TEX1; };
+    auto isTexAlpha = [](uint8_t in) { return in == CC::TEX0_ALPHA || in == CC::TEX1_ALPHA; };
+
+    if(isTex(cc.a) || isTex(cc.b) || isTex(cc.c) || isTex(cc.d))tex.usesColor = true;
+    if(isTexAlpha(cc.c))tex.usesAlpha = true;
+    if(isTex(cc.aAlpha) || isTex(cc.bAlpha) || isTex(cc.cAlpha) || isTex(cc.dAlpha))tex.usesAlpha = true;
+  }
+
   bool isUsingShade(const ColorCombiner &cc)
   {
     if(cc.a == CC::SHADE || cc.b == CC::SHADE || cc.c == CC::SHADE || cc.d == CC::SHADE)return true;
@@ -293,6 +304,11 @@ void parseMaterial(const fs::path &gltfBasePath, int i, int j, Model &model, cgl
 
       if(f3dData.contains("tex0"))readMaterialFromJson(model.material.texA, f3dData["tex0"], gltfBasePath);
       if(f3dData.contains("tex1"))readMaterialFromJson(model.material.texB, f3dData["tex1"], gltfBasePath);
+
+      for(MaterialTexture *tex : {&model.material.texA, &model.material.texB}) {
+        setTextureUsage(*tex, cc1);
+        if(is2Cycle)setTextureUsage(*tex, cc2);
+      }
     }
 
     if(is2Cycle) {
@@ -13,10 +13,14 @@
 #include "../math/mat4.h"
 #include "../cgltfHelper.h"
 #include "../structs.h"
+#include "../converter/converter.h"
 
 namespace fs = std::filesystem;
 
 void parseMaterial(const fs::path &gltfBasePath, int i, int j, Model &model, cgltf_primitive *prim);
 Mat4 parseNodeMatrix(const cgltf_node *node, const Vec3 &posScale = {1.0f, 1.0f, 1.0f});
 Bone parseBoneTree(const cgltf_node *rootBone, Bone *parentBone, int &count);
-Anim parseAnimation(const cgltf_animation &anim, const std::unordered_map<std::string, const Bone*> &nodeMap, uint32_t sampleRate);
\ No newline at end of file
+Anim parseAnimation(
+  const cgltf_animation &anim, const std::unordered_map<std::string, const Bone*> &nodeMap,
+  const std::vector<BoneReach> &boneReach, uint32_t sampleRate
+);
\ No newline at end of file
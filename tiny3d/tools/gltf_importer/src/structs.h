@@ -113,6 +113,9 @@ struct MaterialTexture {
   uint32_t texWidth{};
   uint32_t texHeight{};
   uint32_t texReference{};
+  bool usesColor{false}; // if the combiner reads the color / alpha of the texture
+  bool usesAlpha{false};
+  std::string spriteFormat{}; // fixed format for mksprite (e.g. atlases), empty to pick one based on the pixels
 
   TileParam s{};
   TileParam t{};
@@ -142,6 +145,7 @@ struct Material {
   bool setEnvColor{false};
   bool setBlendColor{false};
   bool uvFilterAdjust{false};
+  bool unlit{false}; // lighting is baked into the vertex colors
 };
 
 struct MeshChunk {
@@ -153,6 +157,13 @@ struct MeshChunk {
   uint32_t vertexDestOffset{0};
   uint32_t boneIndex{0};
   uint32_t boneCount{0};
+  // normal cone (8-bit SNORM) and bounding sphere, used to cull back-facing parts
+  int8_t coneAxis[3]{};
+  int8_t coneCutoff{127};
+  int16_t sphereCenter[3]{};
+  uint16_t sphereRadius{0};
+  int16_t aabbMin[3]{};
+  int16_t aabbMax[3]{};
   std::string name{};
 };
 
@@ -210,9 +221,11 @@ struct Keyframe {
   uint32_t chanelIdx;
   Quat valQuat;
   float valScalar;
+  float tangent{}; // slope (value per second), only used by cubic channels
 
-  uint32_t valQuantSize = 0;
-  uint16_t valQuant[2];
+  uint32_t valQuantSize = 0; // in bytes: 1 (scalar delta), 2 (scalar), 4 (rotation / cubic scalar), 6 (precise rotation)
+  uint8_t valQuant[6];
+  uint16_t valState[3]{}; // absolute value after this keyframe, precise rotations are always used here (snapshots)
 };
 
 struct AnimChannelMapping {
@@ -223,6 +236,9 @@ struct AnimChannelMapping {
 
   float valueMin{INFINITY};
   float valueMax{-INFINITY};
+  float tangentScale{0.0f}; // quantization of tangents, 0 for linear channels
+  int32_t deltaShift{-1}; // 8-bit deltas are in steps of '1 << deltaShift' (quantized units), -1 if not used
+  bool isPreciseQuat{false}; // rotations use 15 instead of 10 bits per component
 
   std::vector<Keyframe> keyframes{}; // temp. storage after parsing
 
@@ -231,6 +247,19 @@ struct AnimChannelMapping {
   }
 };
 
+// State of a channel at runtime, as it would be after playing up to a snapshot
+struct AnimSnapshotChannel {
+  uint16_t timeStartTicks{};
+  uint16_t timeEndTicks{};
+  uint16_t valCurr[3]{};
+  uint16_t valNext[3]{};
+};
+
+struct AnimSnapshot {
+  uint32_t kfIndex{}; // amount of keyframes loaded before this snapshot
+  std::vector<AnimSnapshotChannel> channels{};
+};
+
 struct Anim {
   std::string name{};
   float duration{};
@@ -238,23 +267,55 @@ struct Anim {
   uint32_t channelCountScalar{};
   std::vector<Keyframe> keyframes{}; // output used for writing to the file
   std::vector<AnimChannelMapping> channelMap{};
+  std::vector<AnimSnapshot> snapshots{}; // snapshot 'i' is at tick '(i+1) * config.animSnapshotTicks'
+};
+
+struct PVSData {
+  int16_t aabbMin[3]{};
+  uint16_t cellSize{};
+  uint16_t cellCount[3]{};
+  std::vector<uint16_t> cellRows{}; // per cell, index into 'rows'
+  std::vector<std::vector<uint32_t>> rows{}; // unique visibility bitsets, one bit per object
+};
+
+struct LightDirectional {
+  Vec3 dir{}; // towards the light
+  Vec3 color{}; // 0.0 - 1.0
 };
 
 struct T3DMData {
   std::vector<Model> models{};
   std::vector<Bone> skeletons{};
   std::vector<Anim> animations{};
+  std::vector<LightDirectional> lights{};
 };
 
 struct Config {
   float globalScale{64.0f};
   uint32_t animSampleRate{30};
+  float animError{0.0f};
+  bool animCubic{false};
+  uint32_t animSnapshotTicks{0};
+  bool animSourceKeys{false};
+  bool animLibrary{false};
   bool ignoreMaterials{false};
   bool createBVH{false};
+  bool createPVS{false};
+  uint32_t pvsCellSize{0};
+  uint32_t tileSize{0};
+  bool createAtlas{false};
+  bool createSprites{false};
+  bool bakeLight{false};
+  Vec3 bakeAmbient{};
+  uint32_t bakeAORays{0};
+  float bakeAODistance{1.0f};
   bool verbose{false};
 };
 extern Config config;
 
 constexpr int MAX_VERTEX_COUNT = 70;
 constexpr int CACHE_VERTEX_SIZE = 36;
-constexpr u8 T3DM_VERSION = 0x03;
\ No newline at end of file
+constexpr u8 T3DM_VERSION = 0x0C;
+constexpr u8 T3DT_VERSION = 0x01;
+constexpr u32 STREAM_DATA_ALIGN = 16;
+constexpr u32 STREAM_BLOCK_SIZE = 256; // must match 'T3D_ANIM_STREAM_BLOCK_SIZE'
\ No newline at end of file